@@ -1,4 +1,68 @@
 #include "json.hpp"
+#include <new>
+#include <atomic>
+#include <utility>
+#include <type_traits>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <cerrno>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+/*
+ * Contatori di allocazione. Sono compilati solo con -DJSON_MEMORY_STATS:
+ * altrimenti le macro JSON_TRACK_* non generano codice.
+ */
+#ifdef JSON_MEMORY_STATS
+namespace memory_stats {
+    enum Kind { Node, Array, DictNode, Kinds };
+
+    std::atomic<std::size_t> allocations[Kinds];
+    std::atomic<std::size_t> bytes[Kinds];
+    std::atomic<std::size_t> live_bytes;
+    std::atomic<std::size_t> peak_bytes;
+
+    inline void allocated(Kind kind, std::size_t n) {
+        allocations[kind].fetch_add(1, std::memory_order_relaxed);
+        bytes[kind].fetch_add(n, std::memory_order_relaxed);
+        std::size_t live = live_bytes.fetch_add(n, std::memory_order_relaxed) + n;
+        std::size_t peak = peak_bytes.load(std::memory_order_relaxed);
+        while (live > peak && !peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+    }
+
+    inline void freed(std::size_t n) {
+        live_bytes.fetch_sub(n, std::memory_order_relaxed);
+    }
+}
+
+#define JSON_TRACK_ALLOC(kind, n) memory_stats::allocated(memory_stats::kind, (n))
+#define JSON_TRACK_FREE(n) memory_stats::freed(n)
+#else
+#define JSON_TRACK_ALLOC(kind, n) ((void)0)
+#define JSON_TRACK_FREE(n) ((void)0)
+#endif
 
 template <typename T>
 class LinkedList {
@@ -6,20 +70,25 @@ public:
     struct Node {
         T data;
         Node* next;
+        Node* prev;
 
-        Node(const T& data) : data(data), next(nullptr) {}
+        Node(const T& data) : data(data), next(nullptr), prev(nullptr) {}
+        Node(T&& data) : data(std::move(data)), next(nullptr), prev(nullptr) {}
     };
 
     Node* head;
     Node* tail;
+    std::size_t count; // Numero di nodi, mantenuto ad ogni inserimento per avere size() in O(1)
+    std::pmr::memory_resource* res; // Risorsa da cui sono allocati i nodi
 
-    LinkedList() : head(nullptr), tail(nullptr) {}
+    explicit LinkedList(std::pmr::memory_resource* r = std::pmr::get_default_resource())
+        : head(nullptr), tail(nullptr), count(0), res(r) {}
 
     ~LinkedList() {
         clear();
     }
 
-    LinkedList(const LinkedList& other) : head(nullptr), tail(nullptr) {
+    LinkedList(const LinkedList& other) : head(nullptr), tail(nullptr), count(0), res(other.res) {
         Node* current = other.head;
         while (current) {
             push_back(current->data);
@@ -39,9 +108,11 @@ public:
         return *this;
     }
 
-    LinkedList(LinkedList&& other) noexcept : head(other.head), tail(other.tail) {
+    LinkedList(LinkedList&& other) noexcept
+        : head(other.head), tail(other.tail), count(other.count), res(other.res) {
         other.head = nullptr;
         other.tail = nullptr;
+        other.count = 0;
     }
 
     LinkedList& operator=(LinkedList&& other) noexcept {
@@ -49,48 +120,119 @@ public:
             clear();
             head = other.head;
             tail = other.tail;
+            count = other.count;
+            res = other.res;
 
             other.head = nullptr;
             other.tail = nullptr;
+            other.count = 0;
         }
         return *this;
     }
 
+    template <typename U>
+    Node* create_node(U&& data) {
+        void* memory = res->allocate(sizeof(Node), alignof(Node));
+        JSON_TRACK_ALLOC(DictNode, sizeof(Node));
+        try {
+            return new (memory) Node(std::forward<U>(data));
+        } catch (...) {
+            JSON_TRACK_FREE(sizeof(Node));
+            res->deallocate(memory, sizeof(Node), alignof(Node));
+            throw;
+        }
+    }
+
+    void destroy_node(Node* node) {
+        node->~Node();
+        JSON_TRACK_FREE(sizeof(Node));
+        res->deallocate(node, sizeof(Node), alignof(Node));
+    }
+
     void push_back(const T& data) {
-        Node* newNode = new Node(data);
+        Node* newNode = create_node(data);
+        if (!head) {
+            head = newNode;
+            tail = newNode;
+        } else {
+            newNode->prev = tail;
+            tail->next = newNode;
+            tail = newNode;
+        }
+        ++count;
+    }
+
+    void push_back(T&& data) {
+        Node* newNode = create_node(std::move(data));
         if (!head) {
             head = newNode;
             tail = newNode;
         } else {
+            newNode->prev = tail;
             tail->next = newNode;
             tail = newNode;
         }
+        ++count;
     }
 
     void push_front(const T& data) {
-        Node* newNode = new Node(data);
+        Node* newNode = create_node(data);
         if (!head) {
             head = newNode;
             tail = newNode;
         } else {
             newNode->next = head;
+            head->prev = newNode;
+            head = newNode;
+        }
+        ++count;
+    }
+
+    // Inserisce data prima di at (in coda se at è nullptr) e restituisce il nuovo nodo
+    Node* insert_before(Node* at, T&& data) {
+        if (!at) {
+            push_back(std::move(data));
+            return tail;
+        }
+        Node* newNode = create_node(std::move(data));
+        newNode->next = at;
+        newNode->prev = at->prev;
+        if (at->prev) {
+            at->prev->next = newNode;
+        } else {
             head = newNode;
         }
+        at->prev = newNode;
+        ++count;
+        return newNode;
+    }
+
+    // Scollega e distrugge node
+    void erase(Node* node) {
+        (node->prev ? node->prev->next : head) = node->next;
+        (node->next ? node->next->prev : tail) = node->prev;
+        destroy_node(node);
+        --count;
     }
 
     bool isEmpty() const {
         return head == nullptr;
     }
 
+    std::size_t size() const {
+        return count;
+    }
+
     void clear() {
         Node* current = head;
         while (current) {
             Node* toDelete = current;
             current = current->next;
-            delete toDelete;
+            destroy_node(toDelete);
         }
         head = nullptr;
         tail = nullptr;
+        count = 0;
     }
 
     class iterator {
@@ -180,733 +322,6810 @@ public:
     }
 };
 
-enum class JsonType {
-    Null,
-    Number,
-    Bool,
-    String,
-    List,
-    Dict
-};
+/*
+ * Array dinamico contiguo usato per gli elementi delle liste json.
+ * Gli elementi sono costruiti in place in un unico blocco di memoria, che
+ * cresce geometricamente (o una volta sola tramite reserve()).
+ */
+template <typename T>
+class ArrayList {
+public:
+    T* items;
+    std::size_t count;
+    std::size_t cap;
+    std::pmr::memory_resource* res; // Risorsa da cui è allocato il blocco
 
-struct json::impl {
-    JsonType type = JsonType::Null;
-    double numberValue = 0.0;
-    bool boolValue = false;
-    std::string stringValue;
-    LinkedList<json> listValue;
-    LinkedList<std::pair<std::string, json>> dictValue;
-
-    impl() = default; // Costruttore di default
-    
-    impl(const impl& other) // Copy constructor
-        : type(other.type),
-          numberValue(other.numberValue),
-          boolValue(other.boolValue),
-          stringValue(other.stringValue),
-          listValue(other.listValue),
-          dictValue(other.dictValue) {}
-
-    impl(impl&& other) // Move constructor
-        : type(other.type),
-          numberValue(other.numberValue),
-          boolValue(other.boolValue),
-          stringValue(std::move(other.stringValue)),
-          listValue(std::move(other.listValue)),
-          dictValue(std::move(other.dictValue)) {
-        other.type = JsonType::Null;
-    }
-
-    impl& operator=(const impl& other) { // Copy assignment
-        if (this != &other) {
-            type = other.type;
-            numberValue = other.numberValue;
-            boolValue = other.boolValue;
-            stringValue = other.stringValue;
-            listValue = other.listValue;
-            dictValue = other.dictValue;
+    explicit ArrayList(std::pmr::memory_resource* r = std::pmr::get_default_resource())
+        : items(nullptr), count(0), cap(0), res(r) {}
+
+    ~ArrayList() {
+        clear();
+        release();
+    }
+
+    ArrayList(const ArrayList& other) : ArrayList(other, other.res) {}
+
+    ArrayList(const ArrayList& other, std::pmr::memory_resource* r) : items(nullptr), count(0), cap(0), res(r) {
+        reserve(other.count);
+        for (std::size_t i = 0; i < other.count; ++i) {
+            push_back(other.items[i]);
         }
-        return *this;
     }
 
-    impl& operator=(impl&& other) noexcept { // Move assignment
+    // La copia usa la risorsa di questa lista, come json::operator=
+    ArrayList& operator=(const ArrayList& other) {
         if (this != &other) {
-            type = other.type;
-            numberValue = other.numberValue;
-            boolValue = other.boolValue;
-            stringValue = std::move(other.stringValue);
-            listValue = std::move(other.listValue);
-            dictValue = std::move(other.dictValue);
-            other.type = JsonType::Null;
+            ArrayList tmp(other, res);
+            swap(tmp);
         }
         return *this;
     }
 
-    void clear_data() {
-        switch (type) {
-            case JsonType::String:
-                stringValue.clear();
-                break;
-            case JsonType::Bool:
-                // bool non necessita di operazioni particolari di pulizia
-                break;
-            case JsonType::Number:
-                // double non necessita di operazioni particolari di pulizia
-                break;
-            case JsonType::List:
-                listValue.clear();
-                break;
-            case JsonType::Dict:
-                dictValue.clear();
-                break;
-            case JsonType::Null:
-                // Null non necessita di operazioni particolari di pulizia
-                break;
-        }
+    ArrayList(ArrayList&& other) noexcept
+        : items(other.items), count(other.count), cap(other.cap), res(other.res) {
+        other.items = nullptr;
+        other.count = 0;
+        other.cap = 0;
     }
-};
-
-json::json() 
-    : pimpl(new impl()) {} // Costruttore di default
-
-json::~json() { 
-    if(pimpl) delete pimpl;
-}
-
-json::json(const json& other) 
-    : pimpl(new impl(*other.pimpl)) {} // Copy constructor
-
-json::json(json&& other) 
-    : pimpl(other.pimpl) {
-    other.pimpl = nullptr; // Move constructor
-}
 
-json& json::operator=(const json& other) {
-    if (this != &other) {
-        delete pimpl;
-        pimpl = new impl(*other.pimpl);
+    ArrayList& operator=(ArrayList&& other) noexcept {
+        if (this != &other) {
+            clear();
+            release();
+            items = other.items;
+            count = other.count;
+            cap = other.cap;
+            res = other.res;
+
+            other.items = nullptr;
+            other.count = 0;
+            other.cap = 0;
+        }
+        return *this;
     }
-    return *this;
-}
 
-json& json::operator=(json&& other) {
-    if (this != &other) {
-        delete pimpl;
-        pimpl = other.pimpl;
-        other.pimpl = nullptr; // Move assignment
+    void swap(ArrayList& other) noexcept {
+        std::swap(items, other.items);
+        std::swap(count, other.count);
+        std::swap(cap, other.cap);
+        std::swap(res, other.res);
     }
-    return *this;
-}
-
-bool json::is_list() const {
-    return pimpl->type == JsonType::List;
-}
-
-bool json::is_dictionary() const {
-    return pimpl->type == JsonType::Dict;
-}
-
-bool json::is_string() const {
-    return pimpl->type == JsonType::String;
-}
-
-bool json::is_number() const {
-    return pimpl->type == JsonType::Number;
-}
-
-bool json::is_bool() const {
-    return pimpl->type == JsonType::Bool;
-}
-
-bool json::is_null() const {
-    return pimpl->type == JsonType::Null;
-}
 
-json const& json::operator[](std::string const& key) const {
-    if (!is_dictionary()) {
-        throw json_exception{"json object is not a dictionary"};
+    void reserve(std::size_t n) {
+        if (n <= cap) {
+            return;
+        }
+        if (n > static_cast<std::size_t>(-1) / sizeof(T)) {
+            throw std::length_error("ArrayList: dimensione troppo grande");
+        }
+        T* newItems = static_cast<T*>(res->allocate(n * sizeof(T), alignof(T)));
+        JSON_TRACK_ALLOC(Array, n * sizeof(T));
+        for (std::size_t i = 0; i < count; ++i) {
+            new (newItems + i) T(std::move(items[i]));
+            items[i].~T();
+        }
+        release();
+        items = newItems;
+        cap = n;
     }
 
-    // Utilizziamo una ricerca lineare, dato che non ci aspettiamo che sia efficiente
-    for (auto it = pimpl->dictValue.begin(); it != pimpl->dictValue.end(); ++it) {
-        if (it->first == key) {
-            return it->second;
+    // Libera il blocco di memoria (gli elementi devono essere già distrutti)
+    void release() {
+        if (items) {
+            JSON_TRACK_FREE(cap * sizeof(T));
+            res->deallocate(items, cap * sizeof(T), alignof(T));
         }
+        items = nullptr;
+        cap = 0;
     }
 
-    // Se la chiave non esiste, lanciamo un'eccezione
-    throw json_exception{"Key not found in json dictionary"};
-}
-
-json& json::operator[](std::string const& key) {
-    if (!is_dictionary()) {
-        throw json_exception{"json object is not a dictionary"};
+    void push_back(const T& data) {
+        if (count == cap) {
+            T copy(data); // data potrebbe essere un elemento della lista stessa
+            reserve(cap ? cap * 2 : 4);
+            new (items + count) T(std::move(copy));
+        } else {
+            new (items + count) T(data);
+        }
+        ++count;
     }
 
-    // Utilizziamo una ricerca lineare, dato che non ci aspettiamo che sia efficiente
-    for (auto it = pimpl->dictValue.begin(); it != pimpl->dictValue.end(); ++it) {
-        if (it->first == key) {
-            return it->second;
+    void push_back(T&& data) {
+        if (count == cap) {
+            T tmp(std::move(data));
+            reserve(cap ? cap * 2 : 4);
+            new (items + count) T(std::move(tmp));
+        } else {
+            new (items + count) T(std::move(data));
         }
+        ++count;
     }
 
-    // Se la chiave non esiste, inseriamo un nuovo elemento con valore predefinito
-    pimpl->dictValue.push_back(std::make_pair(key, json()));
-
-    // Restituisci una reference all'elemento appena inserito
-    return pimpl->dictValue.back().second;
-}
-
-double& json::get_number() {
-    if (is_number()) {
-        return pimpl->numberValue;
-    } else {
-        throw json_exception{"The JSON object is not a number."};
+    void push_front(T copy) {
+        insert(0, std::move(copy));
     }
-}
 
-double const& json::get_number() const {
-    if (is_number()) {
-        return pimpl->numberValue;
-    } else {
-        throw json_exception{"The JSON object is not a number."};
+    // Inserisce value in posizione index (<= size()) spostando a destra gli elementi successivi
+    void insert(std::size_t index, T value) {
+        if (count == cap) {
+            reserve(cap ? cap * 2 : 4);
+        }
+        if (index == count) {
+            new (items + count) T(std::move(value));
+        } else {
+            new (items + count) T(std::move(items[count - 1]));
+            for (std::size_t i = count - 1; i > index; --i) {
+                items[i] = std::move(items[i - 1]);
+            }
+            items[index] = std::move(value);
+        }
+        ++count;
     }
-}
 
-bool& json::get_bool() {
-    if (is_bool()) {
-        return pimpl->boolValue;
-    } else {
-        throw json_exception{"The JSON object is not a boolean."};
+    // Rimuove l'elemento in posizione index spostando a sinistra i successivi
+    void erase(std::size_t index) {
+        for (std::size_t i = index; i + 1 < count; ++i) {
+            items[i] = std::move(items[i + 1]);
+        }
+        items[--count].~T();
     }
-}
 
-bool const& json::get_bool() const {
-    if (is_bool()) {
-        return pimpl->boolValue;
-    } else {
-        throw json_exception{"The JSON object is not a boolean."};
+    void pop_back() {
+        if (count) {
+            items[--count].~T();
+        }
     }
-}
 
-std::string& json::get_string() {
-    if (is_string()) {
-        return pimpl->stringValue;
-    } else {
-        throw json_exception{"The JSON object is not a string."};
+    bool isEmpty() const {
+        return count == 0;
     }
-}
 
-std::string const& json::get_string() const {
-    if (is_string()) {
-        return pimpl->stringValue;
-    } else {
-        throw json_exception{"The JSON object is not a string."};
+    std::size_t size() const {
+        return count;
     }
-}
 
-void json::set_string(std::string const& x) {
-    pimpl->clear_data();
-    pimpl->type = JsonType::String;
-    pimpl->stringValue = x;
-}
-
-void json::set_bool(bool x) {
-    pimpl->clear_data();
-    pimpl->type = JsonType::Bool;
-    pimpl->boolValue = x;
-}
-
-void json::set_number(double x) {
-    pimpl->clear_data();
-    pimpl->type = JsonType::Number;
-    pimpl->numberValue = x;
-}
+    std::size_t capacity() const {
+        return cap;
+    }
 
-void json::set_null() {
-    pimpl->clear_data();
-    pimpl->type = JsonType::Null;
-}
+    void clear() {
+        for (std::size_t i = 0; i < count; ++i) {
+            items[i].~T();
+        }
+        count = 0;
+    }
 
-void json::set_list() {
-    pimpl->clear_data();
-    pimpl->type = JsonType::List;
-    pimpl->listValue = LinkedList<json>();
-}
+    T& operator[](std::size_t i) {
+        return items[i];
+    }
 
-void json::set_dictionary() {
-    pimpl->clear_data();
-    pimpl->type = JsonType::Dict;
-    pimpl->dictValue = LinkedList<std::pair<std::string, json>>();
-}
+    const T& operator[](std::size_t i) const {
+        return items[i];
+    }
 
-void json::push_front(json const& x) {
-    if (!is_list()) {
-        throw json_exception{"Il json non è di tipo lista."};
+    T* begin() {
+        return items;
     }
-    pimpl->listValue.push_front(x);
-}
 
-void json::push_back(json const& x) {
-    if (!is_list()) {
-        throw json_exception{"Il json non è di tipo lista."};
+    T* end() {
+        return items + count;
     }
-    pimpl->listValue.push_back(x);
-}
 
-void json::insert(std::pair<std::string, json> const& x) {
-    if (!is_dictionary()) {
-        throw json_exception{"Il json non è di tipo dizionario."};
+    const T* begin() const {
+        return items;
     }
-    pimpl->dictValue.push_back(x);
-}
 
-struct json::list_iterator
-{
-    friend class json;
+    const T* end() const {
+        return items + count;
+    }
 
-private:
-    LinkedList<json>::Node *current;
+    T& back() {
+        if (count) {
+            return items[count - 1];
+        }
+        throw std::runtime_error("Called back() on an empty list");
+    }
 
-    list_iterator(LinkedList<json>::Node *node) : current(node) {}
+    const T& back() const {
+        if (count) {
+            return items[count - 1];
+        }
+        throw std::runtime_error("Called back() on an empty list");
+    }
+};
 
+/*
+ * Sequenza compatta di booleani, un bit per elemento.
+ */
+class BitArray {
 public:
-    list_iterator() : current(nullptr) {}
+    ArrayList<std::uint64_t> words;
+    std::size_t count;
 
-    list_iterator &operator++()
-    {
-        if (current)
-        {
-            current = current->next;
-        }
-        return *this;
-    }
+    explicit BitArray(std::pmr::memory_resource* r = std::pmr::get_default_resource())
+        : words(r), count(0) {}
 
-    list_iterator operator++(int)
-    {
-        list_iterator temp = *this;
-        ++(*this);
-        return temp;
+    void reserve(std::size_t n) {
+        words.reserve((n + 63) / 64);
     }
 
-    json &operator*() const
-    {
-        if (current)
-        {
-            return current->data;
+    void push_back(bool value) {
+        if (count % 64 == 0) {
+            words.push_back(0);
         }
-        throw json_exception{"ERRORE: Tentativo di dereferenziare un iteratore vuoto"};
+        if (value) {
+            words[count / 64] |= std::uint64_t(1) << (count % 64);
+        }
+        ++count;
     }
 
-    json *operator->() const
-    {
-        return &operator*();
+    bool get(std::size_t i) const {
+        return (words[i / 64] >> (i % 64)) & 1;
     }
 
-    bool operator==(const list_iterator &other) const
-    {
-        return current == other.current;
+    std::size_t size() const {
+        return count;
     }
 
-    bool operator!=(const list_iterator &other) const
-    {
-        return !(*this == other);
+    std::size_t capacity() const {
+        return words.capacity() * 64;
+    }
+
+    void clear() {
+        words.clear();
+        count = 0;
+    }
+};
+
+/*
+ * Kernel di riduzione su array di double. Con SSE2 si elaborano 4 valori per
+ * iterazione su due accumulatori indipendenti; la somma può quindi differire
+ * nell'ultimo bit da quella sequenziale.
+ */
+static double sum_doubles(const double* v, std::size_t n) {
+    std::size_t i = 0;
+    double result = 0.0;
+#if defined(__SSE2__)
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(v + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(v + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    result = lanes[0] + lanes[1];
+#endif
+    for (; i < n; ++i) {
+        result += v[i];
+    }
+    return result;
+}
+
+static double min_doubles(const double* v, std::size_t n) {
+    std::size_t i = 0;
+    double result = v[0];
+#if defined(__SSE2__)
+    if (n >= 4) {
+        __m128d acc0 = _mm_loadu_pd(v);
+        __m128d acc1 = _mm_loadu_pd(v + 2);
+        for (i = 4; i + 4 <= n; i += 4) {
+            acc0 = _mm_min_pd(acc0, _mm_loadu_pd(v + i));
+            acc1 = _mm_min_pd(acc1, _mm_loadu_pd(v + i + 2));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_min_pd(acc0, acc1));
+        result = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    }
+#endif
+    for (; i < n; ++i) {
+        if (v[i] < result) {
+            result = v[i];
+        }
+    }
+    return result;
+}
+
+static double max_doubles(const double* v, std::size_t n) {
+    std::size_t i = 0;
+    double result = v[0];
+#if defined(__SSE2__)
+    if (n >= 4) {
+        __m128d acc0 = _mm_loadu_pd(v);
+        __m128d acc1 = _mm_loadu_pd(v + 2);
+        for (i = 4; i + 4 <= n; i += 4) {
+            acc0 = _mm_max_pd(acc0, _mm_loadu_pd(v + i));
+            acc1 = _mm_max_pd(acc1, _mm_loadu_pd(v + i + 2));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_max_pd(acc0, acc1));
+        result = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    }
+#endif
+    for (; i < n; ++i) {
+        if (v[i] > result) {
+            result = v[i];
+        }
+    }
+    return result;
+}
+
+enum class JsonType : unsigned char {
+    Null,
+    Number,
+    Bool,
+    String,
+    List,
+    Dict
+};
+
+struct json::impl {
+    JsonType type = JsonType::Null;
+    bool boolValue = false;
+    mutable bool hashValid = false;
+
+    /*
+     * Riferimenti al nodo: più di uno solo per i sottoalberi condivisi da
+     * deduplicate(), che non vengono più modificati (vedi anche sharedChildren).
+     */
+    std::uint32_t refs = 1;
+
+    /*
+     * Tratto [sourceBegin, sourceBegin + sourceLength) del testo di un
+     * json_source_document da cui è stato letto il valore, valido finché
+     * sourceId è l'identificativo di quel documento. Come l'hash, touch() lo
+     * invalida (sourceId = 0) risalendo i genitori: un nodo con sourceId
+     * valido non è stato modificato, e con lui nessuno dei suoi discendenti.
+     * Un valore più lungo di 4 GiB non tiene il tratto e viene riscritto.
+     */
+    std::uint32_t sourceId = 0;
+    std::uint32_t sourceLength = 0;
+    std::size_t sourceBegin = 0;
+
+    double numberValue = 0.0;
+
+    /*
+     * Hash strutturale del sottoalbero, calcolato da json::hash() e valido
+     * finché hashValid. Ogni modifica chiama touch(), che invalida la cache
+     * risalendo i genitori: se un nodo ha la cache valida ce l'hanno anche
+     * tutti i suoi discendenti, quindi la risalita si ferma al primo nodo già
+     * invalido. parent è il nodo che contiene questo valore (nullptr per una
+     * radice); lo mantengono i metodi che inseriscono o spostano i figli.
+     */
+    impl* parent = nullptr;
+    mutable std::uint64_t hashValue = 0;
+
+    // Risorsa di memoria usata per questo nodo e ereditata dai nuovi figli
+    std::pmr::memory_resource* resource;
+
+    std::string stringValue;
+
+    /*
+     * Le liste omogenee di numeri o di booleani sono memorizzate in forma
+     * compatta (8 byte o 1 bit per elemento) invece che come json separati.
+     * Gli elementi vengono materializzati in listValue solo quando serve
+     * un riferimento modificabile a un singolo elemento (iteratori non
+     * const, push_front, ...); le letture const restituiscono il valore
+     * senza toccare la lista.
+     */
+    enum class Packing { None, Numbers, Bools };
+
+    /*
+     * Layout di sola lettura dei dizionari prodotto da freeze(): le coppie
+     * stanno in un unico blocco in ordine di inserimento e flatIndex le
+     * ordina per chiave. Ogni voce dell'indice porta i primi 8 byte della
+     * chiave, così la ricerca binaria confronta quasi sempre solo interi.
+     */
+    struct FlatKey {
+        std::uint64_t prefix;
+        std::uint32_t index;
+    };
+
+    /*
+     * Lo stato di liste e dizionari sta in un blocco separato, allocato dalla
+     * stessa risorsa solo per i nodi di quei tipi (storage è nullptr per gli
+     * altri): i valori scalari, la gran parte dei nodi di un documento, non
+     * pagano lo spazio dei contenitori.
+     */
+    struct containers {
+        ArrayList<json> listValue;
+        LinkedList<std::pair<std::string, json>> dictValue;
+
+        Packing packing = Packing::None;
+        ArrayList<double> packedNumbers;
+        BitArray packedBools;
+
+        bool frozen = false;
+        ArrayList<std::pair<std::string, json>> flatEntries;
+        ArrayList<FlatKey> flatIndex;
+
+        /*
+         * Qualche figlio può essere condiviso da deduplicate() (o avere parent
+         * non aggiornato) e va reso esclusivo con own() prima di darne un
+         * riferimento modificabile.
+         */
+        bool sharedChildren = false;
+
+        explicit containers(std::pmr::memory_resource* r)
+            : listValue(r), dictValue(r), packedNumbers(r), packedBools(r), flatEntries(r), flatIndex(r) {}
+    };
+    containers* storage = nullptr;
+
+    // Come per gli altri campi, un impl const dà accesso solo in lettura ai contenitori
+    containers* box() { return storage; }
+    const containers* box() const { return storage; }
+
+    // Da chiamare dopo clear_data(): crea o libera storage secondo il nuovo tipo
+    void set_type(JsonType t);
+
+    std::size_t source_end() const {
+        return sourceBegin + sourceLength;
+    }
+
+    // Registra il tratto di testo del valore, se la lunghezza sta nel campo
+    void set_source(std::uint32_t id, std::size_t begin, std::size_t end) {
+        bool fits = end - begin <= UINT32_MAX;
+        sourceId = fits ? id : 0;
+        sourceBegin = begin;
+        sourceLength = fits ? static_cast<std::uint32_t>(end - begin) : 0;
+    }
+
+    void touch() {
+        for (impl* node = this; node && (node->hashValid || node->sourceId); node = node->parent) {
+            node->hashValid = false;
+            node->sourceId = 0;
+        }
+    }
+
+    // Rende questo nodo il genitore di tutti i figli (dopo copie o spostamenti in blocco)
+    void adopt_children();
+
+    // Accoda una coppia al dizionario (non compattato) e la collega a questo nodo
+    void add_entry(std::pair<std::string, json>&& entry);
+
+    /*
+     * Chiavi ripetute in un dizionario appena letto: come con dict[key] = value
+     * resta la posizione della prima e il valore dell'ultima. Le coppie sono
+     * ordinate per chiave, quindi il costo è O(n log n) (senza allocazioni
+     * fino a 32 chiavi) anche quando le chiavi sono tutte diverse.
+     */
+    void merge_duplicate_keys();
+
+    // Rende esclusivo il figlio in slot (copiandolo se condiviso) e lo collega a questo nodo
+    void own(json& slot);
+    void own_children();
+
+    std::uint64_t hash() const;
+    // Ricollega al contenitore un figlio esclusivo durante il calcolo dell'hash
+    void relink(const json& child) const;
+    static bool equal(const impl& a, const impl& b);
+    static bool dict_equal(const impl& a, const impl& b);
+    // Confronto dell'elemento i di due liste, anche in forma compatta, senza espanderle
+    static bool list_item_equal(const impl& a, const impl& b, std::size_t i);
+
+    explicit impl(std::pmr::memory_resource* r) : resource(r) {}
+
+    /*
+     * Copia profonda: tutto il sottoalbero viene allocato da r. Con share i
+     * figli non vengono copiati ma condivisi (copy-on-write di un nodo condiviso).
+     */
+    impl(const impl& other, std::pmr::memory_resource* r, bool share = false);
+
+    ~impl();
+
+    impl(const impl&) = delete;
+    impl& operator=(const impl&) = delete;
+
+    // Allocazione e distruzione dei nodi tramite la loro risorsa di memoria
+    static impl* create(std::pmr::memory_resource* r) {
+        void* memory = r->allocate(sizeof(impl), alignof(impl));
+        JSON_TRACK_ALLOC(Node, sizeof(impl));
+        return new (memory) impl(r);
+    }
+
+    static impl* create(const impl& other, std::pmr::memory_resource* r, bool share = false) {
+        void* memory = r->allocate(sizeof(impl), alignof(impl));
+        JSON_TRACK_ALLOC(Node, sizeof(impl));
+        try {
+            return new (memory) impl(other, r, share);
+        } catch (...) {
+            JSON_TRACK_FREE(sizeof(impl));
+            r->deallocate(memory, sizeof(impl), alignof(impl));
+            throw;
+        }
+    }
+
+    static void destroy(impl* node) {
+        std::pmr::memory_resource* r = node->resource;
+        node->~impl();
+        JSON_TRACK_FREE(sizeof(impl));
+        r->deallocate(node, sizeof(impl), alignof(impl));
+    }
+
+    // Rilascia un riferimento, distruggendo il nodo con l'ultimo
+    static void release(impl* node) {
+        if (--node->refs == 0) {
+            destroy(node);
+        }
+    }
+
+    // Tabella di nodi indicizzata da un hash a 64 bit (vedi sotto)
+    struct node_table;
+
+    /*
+     * Somma a usage la memoria di questo valore e dei suoi figli. I nodi
+     * condivisi sono contati alla prima visita, registrata in seen; senza
+     * seen non sono contati affatto (vedi released_bytes).
+     */
+    void account(json_memory_usage& usage, node_table* seen) const;
+
+    // Byte liberati distruggendo questo nodo: i figli condivisi sopravvivono
+    std::size_t released_bytes() const;
+
+    /*
+     * Uguaglianza di rappresentazione usata dalla deduplicazione: a differenza
+     * di equal conta l'ordine delle chiavi e distingue 0 da -0, perché il nodo
+     * condiviso deve comportarsi allo stesso modo in ogni posizione.
+     */
+    static bool identical(const impl& a, const impl& b);
+
+    // Stato della deduplicazione, condiviso tra deduplicate() e il parser
+    struct interner;
+
+    // Applicazione di JSON Patch e JSON Merge Patch (vedi apply_patch)
+    struct patcher;
+
+    // Calcolo della differenza tra due documenti (vedi json::diff)
+    struct differ;
+
+    // Serializzazione di operator<< e di json_source_document::write
+    struct writer;
+
+    // Serializzazione parallela di json::write (vedi json_write_options::threads)
+    struct splitter;
+
+    // Verifica (una volta sola) che il json sia una lista di soli numeri
+    void check_numbers() const;
+
+    std::size_t list_size() const {
+        switch (box()->packing) {
+            case Packing::Numbers:
+                return box()->packedNumbers.size();
+            case Packing::Bools:
+                return box()->packedBools.size();
+            default:
+                return box()->listValue.size();
+        }
+    }
+
+    // Riporta una lista compatta alla rappresentazione con un json per elemento
+    void unpack();
+    // L'inverso: compatta una lista espansa che contiene solo numeri o solo booleani
+    void repack();
+
+    // Accoda un elemento a una lista, mantenendo la forma compatta se possibile
+    template <typename J>
+    void append(J&& x);
+
+    std::size_t dict_size() const {
+        return box()->frozen ? box()->flatEntries.size() : box()->dictValue.size();
+    }
+
+    // Visita le coppie del dizionario in ordine di inserimento, in entrambi i layout
+    template <typename F>
+    void for_each_entry(F f) const {
+        if (box()->frozen) {
+            for (const auto& entry : box()->flatEntries) {
+                f(entry);
+            }
+        } else {
+            for (auto node = box()->dictValue.get_head(); node; node = node->next) {
+                f(node->data);
+            }
+        }
+    }
+
+    static std::uint64_t key_prefix(const std::string& key) {
+        std::uint64_t prefix = 0;
+        for (std::size_t i = 0; i < 8; ++i) {
+            unsigned char c = i < key.size() ? static_cast<unsigned char>(key[i]) : 0;
+            prefix = (prefix << 8) | c;
+        }
+        return prefix;
+    }
+
+    // Compatta ricorsivamente i dizionari nel layout piatto
+    void freeze();
+    // Compatta solo questo dizionario
+    void compact();
+    // Come freeze, ma espande anche le liste compatte: le letture non modificano più l'albero
+    void seal();
+    // Riporta un dizionario compattato alla lista collegata (prima di una modifica)
+    void thaw();
+    // Ricerca binaria nell'indice ordinato, nullptr se la chiave non c'è
+    json* flat_find(const std::string& key) const {
+        return flat_find(key, key_prefix(key));
+    }
+    json* flat_find(const std::string& key, std::uint64_t prefix) const;
+    // Ordine di flatIndex: prefisso, poi chiave, poi posizione (a parità di chiave vince la più vecchia)
+    bool flat_less(const FlatKey& a, const FlatKey& b) const {
+        if (a.prefix != b.prefix) {
+            return a.prefix < b.prefix;
+        }
+        int cmp = box()->flatEntries[a.index].first.compare(box()->flatEntries[b.index].first);
+        return cmp != 0 ? cmp < 0 : a.index < b.index;
+    }
+    // Posizione in flatEntries della chiave, npos se non c'è
+    std::size_t flat_position(const std::string& key, std::uint64_t prefix) const;
+    // Inserimento e rimozione nella posizione pos di flatEntries senza uscire dal layout piatto
+    void flat_insert(std::size_t pos, std::pair<std::string, json>&& entry);
+    std::pair<std::string, json> flat_erase(std::size_t pos);
+
+    // Ricerca di una chiave senza inserimenti, nullptr se la chiave non c'è
+    json* find_key(const std::string& key, std::uint64_t prefix) const;
+
+    // Parser su buffer in memoria (vedi sotto)
+    struct parser;
+
+    // Codifica e decodifica CBOR (RFC 8949)
+    struct cbor_writer;
+    struct cbor_reader;
+
+    // Scrittura del formato a nastro letto da json_tape/json_view
+    struct tape_writer;
+
+    void clear_data() {
+        switch (type) {
+            case JsonType::String:
+                stringValue.clear();
+                break;
+            case JsonType::Bool:
+                // bool non necessita di operazioni particolari di pulizia
+                break;
+            case JsonType::Number:
+                // double non necessita di operazioni particolari di pulizia
+                break;
+            case JsonType::List:
+                box()->listValue.clear();
+                box()->packedNumbers.clear();
+                box()->packedBools.clear();
+                box()->packing = Packing::None;
+                break;
+            case JsonType::Dict:
+                box()->dictValue.clear();
+                box()->flatEntries.clear();
+                box()->flatIndex.clear();
+                box()->frozen = false;
+                break;
+            case JsonType::Null:
+                // Null non necessita di operazioni particolari di pulizia
+                break;
+        }
+    }
+};
+
+void json::impl::set_type(JsonType t) {
+    bool container = t == JsonType::List || t == JsonType::Dict;
+    if (container && !storage) {
+        void* memory = resource->allocate(sizeof(containers), alignof(containers));
+        JSON_TRACK_ALLOC(Node, sizeof(containers));
+        storage = new (memory) containers(resource);
+    } else if (!container && storage) {
+        storage->~containers();
+        JSON_TRACK_FREE(sizeof(containers));
+        resource->deallocate(storage, sizeof(containers), alignof(containers));
+        storage = nullptr;
+    }
+    type = t;
+}
+
+json::impl::~impl() {
+    set_type(JsonType::Null);
+}
+
+json::impl::impl(const impl& other, std::pmr::memory_resource* r, bool share)
+    : boolValue(other.boolValue),
+      numberValue(other.numberValue),
+      resource(r),
+      stringValue(other.stringValue) {
+    set_type(other.type);
+    if (storage) {
+        auto copy = [r, share](const json& item) {
+            if (share) {
+                ++item.pimpl->refs;
+                return json(item.pimpl);
+            }
+            return json(item, r);
+        };
+        const containers& from = *other.storage;
+        box()->packing = from.packing;
+        box()->frozen = from.frozen;
+        box()->listValue.reserve(from.listValue.size());
+        for (const json& item : from.listValue) {
+            box()->listValue.push_back(copy(item));
+        }
+        for (auto node = from.dictValue.get_head(); node; node = node->next) {
+            box()->dictValue.push_back(std::make_pair(node->data.first, copy(node->data.second)));
+        }
+        box()->packedNumbers.reserve(from.packedNumbers.size());
+        for (double value : from.packedNumbers) {
+            box()->packedNumbers.push_back(value);
+        }
+        box()->packedBools.reserve(from.packedBools.size());
+        for (std::size_t i = 0; i < from.packedBools.size(); ++i) {
+            box()->packedBools.push_back(from.packedBools.get(i));
+        }
+        box()->flatEntries.reserve(from.flatEntries.size());
+        for (const auto& entry : from.flatEntries) {
+            box()->flatEntries.push_back(std::make_pair(entry.first, copy(entry.second)));
+        }
+        box()->flatIndex.reserve(from.flatIndex.size());
+        for (const FlatKey& key : from.flatIndex) {
+            box()->flatIndex.push_back(key);
+        }
+        adopt_children();
+        box()->sharedChildren = share;
+    }
+    // La copia ha lo stesso valore, quindi anche lo stesso hash e lo stesso testo di origine
+    hashValue = other.hashValue;
+    hashValid = other.hashValid;
+    sourceId = other.sourceId;
+    sourceLength = other.sourceLength;
+    sourceBegin = other.sourceBegin;
+}
+
+void json::impl::adopt_children() {
+    if (!storage) {
+        return;
+    }
+    for (json& item : box()->listValue) {
+        item.pimpl->parent = this;
+    }
+    for (auto node = box()->dictValue.get_head(); node; node = node->next) {
+        node->data.second.pimpl->parent = this;
+    }
+    for (auto& entry : box()->flatEntries) {
+        entry.second.pimpl->parent = this;
+    }
+}
+
+void json::impl::add_entry(std::pair<std::string, json>&& entry) {
+    box()->dictValue.push_back(std::move(entry));
+    box()->dictValue.back().second.pimpl->parent = this;
+    touch();
+}
+
+void json::impl::merge_duplicate_keys() {
+    using node_type = LinkedList<std::pair<std::string, json>>::Node;
+    struct item {
+        node_type* node;
+        std::size_t position;
+    };
+    std::size_t n = box()->dictValue.size();
+    if (n < 2) {
+        return;
+    }
+    item local[32];
+    ArrayList<item> spill(resource);
+    if (n > 32) {
+        spill.reserve(n);
+    }
+    std::size_t i = 0;
+    for (node_type* node = box()->dictValue.get_head(); node; node = node->next, ++i) {
+        if (n > 32) {
+            spill.push_back(item{node, i});
+        } else {
+            local[i] = item{node, i};
+        }
+    }
+    item* items = n > 32 ? spill.begin() : local;
+    std::sort(items, items + n, [](const item& a, const item& b) {
+        int cmp = a.node->data.first.compare(b.node->data.first);
+        return cmp != 0 ? cmp < 0 : a.position < b.position;
+    });
+    for (std::size_t first = 0, last; first < n; first = last) {
+        for (last = first + 1; last < n && items[last].node->data.first == items[first].node->data.first; ++last) {
+        }
+        if (last - first > 1) {
+            items[first].node->data.second = std::move(items[last - 1].node->data.second);
+            for (std::size_t k = first + 1; k < last; ++k) {
+                box()->dictValue.erase(items[k].node);
+            }
+        }
+    }
+}
+
+/*
+ * Tabella a indirizzamento aperto (scansione lineare) di nodi con la loro
+ * chiave a 64 bit, usata come insieme di puntatori da account() e come
+ * tabella dei rappresentanti dalla deduplicazione. Non possiede i nodi.
+ */
+struct json::impl::node_table {
+    struct slot {
+        std::uint64_t key;
+        impl* node;
+    };
+    slot* slots;
+    std::size_t shift;
+    std::size_t used = 0;
+
+    node_table() : slots(new slot[16]()), shift(60) {}
+    ~node_table() { delete[] slots; }
+    node_table(const node_table&) = delete;
+    node_table& operator=(const node_table&) = delete;
+
+    std::size_t capacity() const { return std::size_t(1) << (64 - shift); }
+
+    // Hashing di Fibonacci: anche chiavi con i bit bassi a zero (puntatori) si distribuiscono bene
+    std::size_t index(std::uint64_t key) const {
+        return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> shift);
+    }
+
+    /*
+     * Restituisce il primo nodo già presente con la stessa chiave per cui
+     * same è vero; se non c'è inserisce node e restituisce node.
+     */
+    template <typename Same>
+    impl* insert(std::uint64_t key, impl* node, Same same) {
+        if ((used + 1) * 2 > capacity()) {
+            grow();
+        }
+        std::size_t mask = capacity() - 1;
+        for (std::size_t i = index(key);; i = (i + 1) & mask) {
+            if (!slots[i].node) {
+                slots[i] = slot{key, node};
+                ++used;
+                return node;
+            }
+            if (slots[i].key == key && same(*slots[i].node, *node)) {
+                return slots[i].node;
+            }
+        }
+    }
+
+    // true se node non era già stato inserito
+    bool insert_pointer(const impl* node) {
+        std::size_t before = used;
+        insert(reinterpret_cast<std::uintptr_t>(node), const_cast<impl*>(node),
+               [](const impl& a, const impl& b) { return &a == &b; });
+        return used != before;
+    }
+
+    void grow() {
+        slot* old = slots;
+        std::size_t count = capacity();
+        slots = new slot[count * 2]();
+        --shift;
+        std::size_t mask = capacity() - 1;
+        for (std::size_t j = 0; j < count; ++j) {
+            if (old[j].node) {
+                std::size_t i = index(old[j].key);
+                while (slots[i].node) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = old[j];
+            }
+        }
+        delete[] old;
+    }
+};
+
+/*
+ * Hash-consing: table contiene un rappresentante per ogni valore già visto,
+ * indicizzato dall'hash strutturale. intern() sostituisce il figlio in slot
+ * con il rappresentante, se esiste, e somma a saved i byte liberati.
+ */
+struct json::impl::interner {
+    node_table table;
+    std::size_t saved = 0;
+
+    void intern(json& slot, impl& owner);
+    // Deduplica i discendenti di node, dal basso verso l'alto
+    void walk(impl& node);
+};
+
+json::json() 
+    : pimpl(impl::create(std::pmr::get_default_resource())) {} // Costruttore di default
+
+json::json(std::pmr::memory_resource* resource)
+    : pimpl(impl::create(resource ? resource : std::pmr::get_default_resource())) {}
+
+json::json(impl* node)
+    : pimpl(node) {}
+
+json::~json() { 
+    if(pimpl) impl::release(pimpl);
+}
+
+json::json(const json& other) 
+    : pimpl(impl::create(*other.pimpl, std::pmr::get_default_resource())) {} // Copy constructor
+
+json::json(const json& other, std::pmr::memory_resource* resource)
+    : pimpl(impl::create(*other.pimpl, resource ? resource : std::pmr::get_default_resource())) {}
+
+std::pmr::memory_resource* json::get_memory_resource() const {
+    return pimpl->resource;
+}
+
+json::json(json&& other) 
+    : pimpl(other.pimpl) {
+    other.pimpl = nullptr; // Move constructor
+    // Il valore spostato è indipendente: chi lo inserisce in un contenitore ne aggiorna il genitore
+    if (pimpl) pimpl->parent = nullptr;
+}
+
+json& json::operator=(const json& other) {
+    if (this != &other) {
+        // La copia resta nella risorsa di memoria di questo json
+        impl* tmp = impl::create(*other.pimpl, pimpl ? pimpl->resource : std::pmr::get_default_resource());
+        impl* parent = pimpl ? pimpl->parent : nullptr;
+        if (pimpl) impl::release(pimpl);
+        pimpl = tmp;
+        pimpl->parent = parent;
+        if (parent) parent->touch();
+    }
+    return *this;
+}
+
+json& json::operator=(json&& other) {
+    if (this != &other) {
+        impl* parent = pimpl ? pimpl->parent : nullptr;
+        if (pimpl) impl::release(pimpl);
+        pimpl = other.pimpl;
+        other.pimpl = nullptr; // Move assignment
+        if (pimpl) {
+            pimpl->parent = parent;
+            if (parent) parent->touch();
+        }
+    }
+    return *this;
+}
+
+bool json::is_list() const {
+    return pimpl->type == JsonType::List;
+}
+
+bool json::is_dictionary() const {
+    return pimpl->type == JsonType::Dict;
+}
+
+bool json::is_string() const {
+    return pimpl->type == JsonType::String;
+}
+
+bool json::is_number() const {
+    return pimpl->type == JsonType::Number;
+}
+
+bool json::is_bool() const {
+    return pimpl->type == JsonType::Bool;
+}
+
+bool json::is_null() const {
+    return pimpl->type == JsonType::Null;
+}
+
+json const& json::operator[](std::string const& key) const {
+    if (!is_dictionary()) {
+        throw json_exception{"json object is not a dictionary"};
+    }
+
+    if (pimpl->box()->frozen) {
+        if (const json* found = pimpl->flat_find(key)) {
+            return *found;
+        }
+        throw json_exception{"Key not found in json dictionary"};
+    }
+
+    // Utilizziamo una ricerca lineare, dato che non ci aspettiamo che sia efficiente
+    for (auto it = pimpl->box()->dictValue.begin(); it != pimpl->box()->dictValue.end(); ++it) {
+        if (it->first == key) {
+            return it->second;
+        }
+    }
+
+    // Se la chiave non esiste, lanciamo un'eccezione
+    throw json_exception{"Key not found in json dictionary"};
+}
+
+json& json::operator[](std::string const& key) {
+    if (!is_dictionary()) {
+        throw json_exception{"json object is not a dictionary"};
+    }
+    pimpl->touch(); // Il riferimento restituito permette di modificare il valore
+
+    // Un valore condiviso viene copiato prima di restituirne un riferimento modificabile
+    if (pimpl->box()->frozen) {
+        if (json* found = pimpl->flat_find(key)) {
+            pimpl->own(*found);
+            return *found;
+        }
+        pimpl->thaw();
+    }
+
+    // Utilizziamo una ricerca lineare, dato che non ci aspettiamo che sia efficiente
+    for (auto it = pimpl->box()->dictValue.begin(); it != pimpl->box()->dictValue.end(); ++it) {
+        if (it->first == key) {
+            pimpl->own(it->second);
+            return it->second;
+        }
+    }
+
+    // Se la chiave non esiste, inseriamo un nuovo elemento con valore predefinito
+    pimpl->add_entry(std::make_pair(key, json(pimpl->resource)));
+
+    // Restituisci una reference all'elemento appena inserito
+    return pimpl->box()->dictValue.back().second;
+}
+
+double& json::get_number() {
+    if (is_number()) {
+        pimpl->touch(); // Il riferimento restituito permette di modificare il valore
+        return pimpl->numberValue;
+    } else {
+        throw json_exception{"The JSON object is not a number."};
+    }
+}
+
+double const& json::get_number() const {
+    if (is_number()) {
+        return pimpl->numberValue;
+    } else {
+        throw json_exception{"The JSON object is not a number."};
+    }
+}
+
+bool& json::get_bool() {
+    if (is_bool()) {
+        pimpl->touch(); // Il riferimento restituito permette di modificare il valore
+        return pimpl->boolValue;
+    } else {
+        throw json_exception{"The JSON object is not a boolean."};
+    }
+}
+
+bool const& json::get_bool() const {
+    if (is_bool()) {
+        return pimpl->boolValue;
+    } else {
+        throw json_exception{"The JSON object is not a boolean."};
+    }
+}
+
+std::string& json::get_string() {
+    if (is_string()) {
+        pimpl->touch(); // Il riferimento restituito permette di modificare il valore
+        return pimpl->stringValue;
+    } else {
+        throw json_exception{"The JSON object is not a string."};
+    }
+}
+
+std::string const& json::get_string() const {
+    if (is_string()) {
+        return pimpl->stringValue;
+    } else {
+        throw json_exception{"The JSON object is not a string."};
+    }
+}
+
+void json::set_string(std::string const& x) {
+    pimpl->touch();
+    pimpl->clear_data();
+    pimpl->set_type(JsonType::String);
+    pimpl->stringValue = x;
+}
+
+void json::set_bool(bool x) {
+    pimpl->touch();
+    pimpl->clear_data();
+    pimpl->set_type(JsonType::Bool);
+    pimpl->boolValue = x;
+}
+
+void json::set_number(double x) {
+    pimpl->touch();
+    pimpl->clear_data();
+    pimpl->set_type(JsonType::Number);
+    pimpl->numberValue = x;
+}
+
+void json::set_null() {
+    pimpl->touch();
+    pimpl->clear_data();
+    pimpl->set_type(JsonType::Null);
+}
+
+void json::set_list() {
+    pimpl->touch();
+    pimpl->clear_data();
+    pimpl->set_type(JsonType::List);
+    pimpl->box()->listValue = ArrayList<json>(pimpl->resource);
+}
+
+void json::set_dictionary() {
+    pimpl->touch();
+    pimpl->clear_data();
+    pimpl->set_type(JsonType::Dict);
+    pimpl->box()->dictValue = LinkedList<std::pair<std::string, json>>(pimpl->resource);
+}
+
+/*
+ * Validazione UTF-8 (RFC 3629: niente sequenze overlong, surrogati o code
+ * point oltre U+10FFFF). utf8_sequence_length restituisce la lunghezza della
+ * sequenza multibyte in p, o 0 se non è valida.
+ */
+static std::size_t utf8_sequence_length(const unsigned char* p, std::size_t left) {
+    unsigned char c = p[0];
+    std::size_t len;
+    unsigned char lo = 0x80, hi = 0xBF; // intervallo ammesso per il secondo byte
+    if (c >= 0xC2 && c <= 0xDF) {
+        len = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        len = 3;
+        if (c == 0xE0) lo = 0xA0;
+        if (c == 0xED) hi = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        if (c == 0xF0) lo = 0x90;
+        if (c == 0xF4) hi = 0x8F;
+    } else {
+        return 0;
+    }
+    if (left < len || p[1] < lo || p[1] > hi) {
+        return 0;
+    }
+    for (std::size_t i = 2; i < len; ++i) {
+        if ((p[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+#if defined(__SSSE3__)
+/*
+ * Errori UTF-8 di un blocco di 16 byte (algoritmo a tabelle di Keiser e
+ * Lemire). Per ogni byte, tre tabelle da 16 voci indicizzate dai nibble del
+ * byte precedente e dal nibble alto del byte corrente dicono quali errori
+ * sono possibili; l'AND delle tre lascia solo quelli presenti. Un confronto
+ * saturato sui byte a distanza 2 e 3 controlla le continuazioni delle
+ * sequenze lunghe. prev è il blocco precedente (zeri all'inizio).
+ */
+static inline __m128i utf8_block_errors(__m128i input, __m128i prev) {
+    const unsigned char too_short = 1 << 0;   // iniziale seguito da non continuazione
+    const unsigned char too_long = 1 << 1;    // ASCII seguito da continuazione
+    const unsigned char overlong_3 = 1 << 2;
+    const unsigned char too_large = 1 << 3;
+    const unsigned char surrogate = 1 << 4;
+    const unsigned char overlong_2 = 1 << 5;
+    const unsigned char overlong_4 = 1 << 6;  // condivide il bit con too_large_1000
+    const unsigned char too_large_1000 = 1 << 6;
+    const unsigned char two_conts = 1 << 7;
+    const unsigned char carry = too_short | too_long | two_conts;
+
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+        too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+        two_conts, two_conts, two_conts, two_conts,
+        too_short | overlong_2,
+        too_short,
+        too_short | overlong_3 | surrogate,
+        static_cast<char>(too_short | too_large | too_large_1000 | overlong_4));
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+        static_cast<char>(carry | overlong_3 | overlong_2 | overlong_4),
+        static_cast<char>(carry | overlong_2),
+        static_cast<char>(carry),
+        static_cast<char>(carry),
+        static_cast<char>(carry | too_large),
+        static_cast<char>(carry | too_large | too_large_1000),
+        static_cast<char>(carry | too_large | too_large_1000),
+        static_cast<char>(carry | too_large | too_large_1000),
+        static_cast<char>(carry | too_large | too_large_1000),
+        static_cast<char>(carry | too_large | too_large_1000),
+        static_cast<char>(carry | too_large | too_large_1000),
+        static_cast<char>(carry | too_large | too_large_1000),
+        static_cast<char>(carry | too_large | too_large_1000),
+        static_cast<char>(carry | too_large | too_large_1000 | surrogate),
+        static_cast<char>(carry | too_large | too_large_1000),
+        static_cast<char>(carry | too_large | too_large_1000));
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+        too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+        static_cast<char>(too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4),
+        static_cast<char>(too_long | overlong_2 | two_conts | overlong_3 | too_large),
+        static_cast<char>(too_long | overlong_2 | two_conts | surrogate | too_large),
+        static_cast<char>(too_long | overlong_2 | two_conts | surrogate | too_large),
+        too_short, too_short, too_short, too_short);
+
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+    __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, nibble));
+    __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+    // Dopo un iniziale da 3 o 4 byte, anche il terzo (e il quarto) byte devono essere continuazioni
+    __m128i prev2 = _mm_alignr_epi8(input, prev, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, prev, 13);
+    __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80));
+    __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80));
+    __m128i must_continue = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(static_cast<char>(0x80)));
+    return _mm_xor_si128(must_continue, special);
+}
+#endif
+
+// true se [first, last) è UTF-8 valido e non termina a metà di una sequenza
+static bool utf8_valid(const char* first, const char* last) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(first);
+    const unsigned char* e = reinterpret_cast<const unsigned char*>(last);
+#if defined(__SSSE3__)
+    __m128i prev = _mm_setzero_si128();
+    __m128i errors = _mm_setzero_si128();
+    for (; e - p >= 16; p += 16) {
+        __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        errors = _mm_or_si128(errors, utf8_block_errors(input, prev));
+        prev = input;
+    }
+    // L'ultimo blocco è completato con zeri: una sequenza troncata alla fine risulta errata
+    alignas(16) unsigned char tail[16] = {};
+    std::memcpy(tail, p, static_cast<std::size_t>(e - p));
+    errors = _mm_or_si128(errors, utf8_block_errors(_mm_load_si128(reinterpret_cast<const __m128i*>(tail)), prev));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(errors, _mm_setzero_si128())) == 0xFFFF;
+#else
+    while (p != e) {
+        if (*p < 0x80) {
+            ++p;
+            continue;
+        }
+        std::size_t len = utf8_sequence_length(p, static_cast<std::size_t>(e - p));
+        if (!len) {
+            return false;
+        }
+        p += len;
+    }
+    return true;
+#endif
+}
+
+/*
+ * Parser JSON (RFC 8259) che lavora su un buffer in memoria invece che su
+ * uno stream. Costruisce direttamente i json::impl, spostando i valori nei
+ * contenitori invece di copiarli, e può saltare un intero valore con una
+ * scansione che tiene conto solo di parentesi e virgolette, senza allocare.
+ * Gli errori non lanciano eccezioni: ogni funzione restituisce false dopo
+ * aver registrato il primo errore e la sua posizione, e chi chiama si limita
+ * a propagarlo. raise() lo trasforma in json_exception per le API che lanciano.
+ */
+struct json::impl::parser {
+    const char* begin;
+    const char* pos;
+    const char* end;
+    std::size_t depth = 0;
+    std::size_t max_depth;
+    bool check_utf8;
+    json_parse_error error = json_parse_error::None;
+    const char* error_pos = nullptr;
+    // Se presente, ogni valore completato viene deduplicato (json::parse_deduplicated)
+    interner* shared = nullptr;
+    // Se diverso da zero, ogni valore ricorda il proprio tratto di testo (json_source_document)
+    std::uint32_t source = 0;
+
+    parser(const char* first, const char* last, std::size_t depth_limit = 512, bool utf8 = true)
+        : begin(first), pos(first), end(last), max_depth(depth_limit), check_utf8(utf8) {}
+
+    bool fail(json_parse_error code) {
+        if (error == json_parse_error::None) {
+            error = code;
+            error_pos = pos;
+        }
+        return false;
+    }
+
+    // Posizione dell'errore (o della fine del valore) con riga e colonna contate da 1
+    json_parse_result result() const {
+        const char* at = error == json_parse_error::None ? pos : error_pos;
+        json_parse_result r{error, static_cast<std::size_t>(at - begin), 1, 1};
+        const char* line_start = begin;
+        for (const char* p = begin; p != at; ++p) {
+            if (*p == '\n') {
+                ++r.line;
+                line_start = p + 1;
+            }
+        }
+        r.column = static_cast<std::size_t>(at - line_start) + 1;
+        return r;
+    }
+
+    [[noreturn]] void raise() const {
+        json_parse_result r = result();
+        throw json_exception{std::string("Errore di parsing: ") + r.message() +
+                             " (riga " + std::to_string(r.line) + ", colonna " + std::to_string(r.column) + ")"};
+    }
+
+    void skip_whitespace() {
+        while (pos != end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t')) {
+            ++pos;
+        }
+    }
+
+    bool expect(char c, json_parse_error code) {
+        skip_whitespace();
+        if (pos == end || *pos != c) {
+            return fail(pos == end ? json_parse_error::UnexpectedEnd : code);
+        }
+        ++pos;
+        return true;
+    }
+
+    bool parse_literal(const char* word, std::size_t len) {
+        if (static_cast<std::size_t>(end - pos) < len || std::memcmp(pos, word, len) != 0) {
+            return fail(json_parse_error::InvalidLiteral);
+        }
+        pos += len;
+        return true;
+    }
+
+    static int hex_digit(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    bool parse_hex4(unsigned& value) {
+        if (end - pos < 4) {
+            return fail(json_parse_error::InvalidUnicodeEscape);
+        }
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            int d = hex_digit(pos[i]);
+            if (d < 0) {
+                return fail(json_parse_error::InvalidUnicodeEscape);
+            }
+            value = (value << 4) | static_cast<unsigned>(d);
+        }
+        pos += 4;
+        return true;
+    }
+
+    // pos è dopo "\\u": legge il code point, unendo le coppie di surrogati UTF-16
+    bool parse_unicode_escape(unsigned& cp) {
+        if (!parse_hex4(cp)) {
+            return false;
+        }
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+            if (end - pos < 2 || pos[0] != '\\' || pos[1] != 'u') {
+                return fail(json_parse_error::UnpairedSurrogate);
+            }
+            pos += 2;
+            unsigned low;
+            if (!parse_hex4(low)) {
+                return false;
+            }
+            if (low < 0xDC00 || low > 0xDFFF) {
+                return fail(json_parse_error::UnpairedSurrogate);
+            }
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+            return fail(json_parse_error::UnpairedSurrogate);
+        }
+        return true;
+    }
+
+    static void append_utf8(std::string& out, unsigned cp) {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+
+    /*
+     * pos è sulla virgoletta di apertura. La validazione UTF-8 è fatta sullo
+     * stesso tratto appena scandito, prima di copiarlo, solo se contiene
+     * byte non ASCII; con check_utf8 == false i byte sono copiati così come sono.
+     */
+    bool parse_string(std::string& out) {
+        ++pos;
+        for (;;) {
+            const char* run = pos;
+            bool ascii = true;
+            pos = scan_text(pos, end, ascii);
+            if (!ascii && check_utf8 && !utf8_valid(run, pos)) {
+                return fail_utf8(run, pos);
+            }
+            out.append(run, pos);
+            if (pos == end) {
+                return fail(json_parse_error::UnterminatedString);
+            }
+            char c = *pos;
+            if (c == '"') {
+                ++pos;
+                return true;
+            }
+            if (c != '\\') {
+                return fail(json_parse_error::ControlCharacter);
+            }
+            if (++pos == end) {
+                return fail(json_parse_error::UnterminatedString);
+            }
+            switch (*pos++) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    unsigned cp;
+                    if (!parse_unicode_escape(cp)) {
+                        return false;
+                    }
+                    append_utf8(out, cp);
+                    break;
+                }
+                default:
+                    --pos;
+                    return fail(json_parse_error::InvalidEscape);
+            }
+        }
+    }
+
+    static bool is_digit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    // Controlla la grammatica di un numero e porta pos alla sua fine
+    bool scan_number() {
+        if (pos != end && *pos == '-') {
+            ++pos;
+        }
+        if (pos == end || !is_digit(*pos)) {
+            return fail(json_parse_error::InvalidNumber);
+        }
+        if (*pos == '0') {
+            ++pos;
+        } else {
+            while (pos != end && is_digit(*pos)) ++pos;
+        }
+        if (pos != end && *pos == '.') {
+            ++pos;
+            if (pos == end || !is_digit(*pos)) {
+                return fail(json_parse_error::InvalidNumber);
+            }
+            while (pos != end && is_digit(*pos)) ++pos;
+        }
+        if (pos != end && (*pos == 'e' || *pos == 'E')) {
+            ++pos;
+            if (pos != end && (*pos == '+' || *pos == '-')) {
+                ++pos;
+            }
+            if (pos == end || !is_digit(*pos)) {
+                return fail(json_parse_error::InvalidNumber);
+            }
+            while (pos != end && is_digit(*pos)) ++pos;
+        }
+        return true;
+    }
+
+    bool parse_number(double& value) {
+        const char* start = pos;
+        if (!scan_number()) {
+            return false;
+        }
+        auto result = std::from_chars(start, pos, value);
+        if (result.ec != std::errc() || result.ptr != pos) {
+            pos = start;
+            return fail(json_parse_error::NumberOutOfRange);
+        }
+        return true;
+    }
+
+    // Analizza il valore che inizia in pos (spazi iniziali già saltati)
+    bool parse_value(json& out) {
+        const char* start = pos;
+        if (!parse_content(out)) {
+            return false;
+        }
+        if (source) {
+            out.pimpl->set_source(source, static_cast<std::size_t>(start - begin), static_cast<std::size_t>(pos - begin));
+        }
+        return true;
+    }
+
+    bool parse_content(json& out) {
+        impl& node = *out.pimpl;
+        if (pos == end) {
+            return fail(json_parse_error::UnexpectedEnd);
+        }
+        switch (*pos) {
+            case 'n':
+                node.type = JsonType::Null;
+                return parse_literal("null", 4);
+            case 't':
+                node.type = JsonType::Bool;
+                node.boolValue = true;
+                return parse_literal("true", 4);
+            case 'f':
+                node.type = JsonType::Bool;
+                node.boolValue = false;
+                return parse_literal("false", 5);
+            case '"':
+                node.type = JsonType::String;
+                return parse_string(node.stringValue);
+            case '[':
+                return parse_list(node);
+            case '{':
+                return parse_dictionary(node);
+            default:
+                if (*pos == '-' || is_digit(*pos)) {
+                    node.type = JsonType::Number;
+                    return parse_number(node.numberValue);
+                }
+                return fail(json_parse_error::InvalidCharacter);
+        }
+    }
+
+    bool enter() {
+        return ++depth <= max_depth || fail(json_parse_error::TooDeep);
+    }
+
+    // Dopo un elemento di un contenitore: ',' continua, close chiude
+    bool next_item(char close, json_parse_error code, bool& done) {
+        skip_whitespace();
+        if (pos == end) {
+            return fail(json_parse_error::UnexpectedEnd);
+        }
+        if (*pos == ',') {
+            ++pos;
+            return true;
+        }
+        if (*pos == close) {
+            ++pos;
+            --depth;
+            done = true;
+            return true;
+        }
+        return fail(code);
+    }
+
+    /*
+     * Una lista compatta che riceve un valore di altro tipo viene espansa:
+     * gli elementi materializzati non hanno un tratto di testo, che si
+     * ricava rileggendo i valori già letti (solo numeri e booleani, separati
+     * da virgole) a partire da open, la posizione della '['.
+     */
+    void restore_sources(impl& node, const char* open) {
+        const char* p = open + 1;
+        auto skip = [&p] {
+            while (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t') {
+                ++p;
+            }
+        };
+        for (std::size_t i = 0; i + 1 < node.box()->listValue.size(); ++i) {
+            skip();
+            const char* first = p;
+            while (*p != ',' && *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t') {
+                ++p;
+            }
+            impl& item = *node.box()->listValue[i].pimpl;
+            item.set_source(source, static_cast<std::size_t>(first - begin), static_cast<std::size_t>(p - begin));
+            skip();
+            ++p;  // ','
+        }
+    }
+
+    bool parse_list(impl& node) {
+        node.set_type(JsonType::List);
+        if (!enter()) {
+            return false;
+        }
+        const char* open = pos;
+        ++pos;
+        skip_whitespace();
+        if (pos != end && *pos == ']') {
+            ++pos;
+            --depth;
+            return true;
+        }
+        for (bool done = false; !done;) {
+            skip_whitespace();
+            json item(node.resource);
+            if (!parse_value(item)) {
+                return false;
+            }
+            // Numeri e booleani di una lista finiscono quasi sempre nella forma compatta
+            if (shared && item.pimpl->type != JsonType::Number && item.pimpl->type != JsonType::Bool) {
+                shared->intern(item, node);
+            }
+            bool packed = node.box()->packing != Packing::None;
+            node.append(std::move(item));
+            if (source && packed && node.box()->packing == Packing::None) {
+                restore_sources(node, open);
+            }
+            if (!next_item(']', json_parse_error::InvalidList, done)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool parse_dictionary(impl& node) {
+        node.set_type(JsonType::Dict);
+        if (!enter()) {
+            return false;
+        }
+        ++pos;
+        skip_whitespace();
+        if (pos != end && *pos == '}') {
+            ++pos;
+            --depth;
+            return true;
+        }
+        for (bool done = false; !done;) {
+            skip_whitespace();
+            if (pos == end || *pos != '"') {
+                return fail(pos == end ? json_parse_error::UnexpectedEnd : json_parse_error::InvalidDictionary);
+            }
+            std::pair<std::string, json> entry(std::string(), json(node.resource));
+            if (!parse_string(entry.first) || !expect(':', json_parse_error::InvalidDictionary)) {
+                return false;
+            }
+            skip_whitespace();
+            if (!parse_value(entry.second)) {
+                return false;
+            }
+            node.add_entry(std::move(entry));
+            if (!next_item('}', json_parse_error::InvalidDictionary, done)) {
+                return false;
+            }
+        }
+        // I valori delle chiavi ripetute vengono scartati, quindi si condividono solo dopo
+        node.merge_duplicate_keys();
+        if (shared) {
+            for (auto entry = node.box()->dictValue.get_head(); entry; entry = entry->next) {
+                shared->intern(entry->data.second, node);
+            }
+        }
+        return true;
+    }
+
+    /*
+     * Avanza fino alla prima virgoletta, barra rovesciata o carattere di
+     * controllo; ascii diventa false se il tratto percorso contiene byte
+     * >= 0x80. Con SSE2 esamina 16 byte per iterazione.
+     */
+    static const char* scan_text(const char* p, const char* e, bool& ascii) {
+#if defined(__SSE2__)
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1F);
+        while (e - p >= 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            // max(c, 0x1F) == 0x1F solo per i caratteri di controllo (confronto senza segno)
+            __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+                                           _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+            unsigned high = static_cast<unsigned>(_mm_movemask_epi8(chunk));
+            if (mask) {
+                unsigned n = static_cast<unsigned>(__builtin_ctz(mask));
+                if (high & ((1u << n) - 1)) {
+                    ascii = false;
+                }
+                return p + n;
+            }
+            if (high) {
+                ascii = false;
+            }
+            p += 16;
+        }
+#endif
+        for (; p != e; ++p) {
+            unsigned char c = static_cast<unsigned char>(*p);
+            if (c == '"' || c == '\\' || c < 0x20) {
+                break;
+            }
+            if (c >= 0x80) {
+                ascii = false;
+            }
+        }
+        return p;
+    }
+
+    // Il tratto [run, stop) non è UTF-8 valido: individua la prima sequenza errata
+    bool fail_utf8(const char* run, const char* stop) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(run);
+        const unsigned char* e = reinterpret_cast<const unsigned char*>(stop);
+        while (p != e) {
+            std::size_t len = *p < 0x80 ? 1 : utf8_sequence_length(p, static_cast<std::size_t>(e - p));
+            if (!len) {
+                break;
+            }
+            p += len;
+        }
+        pos = reinterpret_cast<const char*>(p);
+        return fail(json_parse_error::InvalidUtf8);
+    }
+
+    // Come parse_string, ma senza produrre la stringa (pos sulla virgoletta di apertura)
+    bool validate_string() {
+        ++pos;
+        for (;;) {
+            const char* run = pos;
+            bool ascii = true;
+            pos = scan_text(pos, end, ascii);
+            if (!ascii && !utf8_valid(run, pos)) {
+                return fail_utf8(run, pos);
+            }
+            if (pos == end) {
+                return fail(json_parse_error::UnterminatedString);
+            }
+            char c = *pos;
+            if (c == '"') {
+                ++pos;
+                return true;
+            }
+            if (c != '\\') {
+                return fail(json_parse_error::ControlCharacter);
+            }
+            if (++pos == end) {
+                return fail(json_parse_error::UnterminatedString);
+            }
+            switch (*pos++) {
+                case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                    break;
+                case 'u': {
+                    unsigned cp;
+                    if (!parse_unicode_escape(cp)) {
+                        return false;
+                    }
+                    break;
+                }
+                default:
+                    --pos;
+                    return fail(json_parse_error::InvalidEscape);
+            }
+        }
+    }
+
+    // Come parse_value, ma senza costruire né allocare nulla
+    bool validate_value() {
+        if (pos == end) {
+            return fail(json_parse_error::UnexpectedEnd);
+        }
+        switch (*pos) {
+            case 'n':
+                return parse_literal("null", 4);
+            case 't':
+                return parse_literal("true", 4);
+            case 'f':
+                return parse_literal("false", 5);
+            case '"':
+                return validate_string();
+            case '[':
+                return validate_list();
+            case '{':
+                return validate_dictionary();
+            default:
+                if (*pos == '-' || is_digit(*pos)) {
+                    return scan_number();
+                }
+                return fail(json_parse_error::InvalidCharacter);
+        }
+    }
+
+    bool validate_list() {
+        if (!enter()) {
+            return false;
+        }
+        ++pos;
+        skip_whitespace();
+        if (pos != end && *pos == ']') {
+            ++pos;
+            --depth;
+            return true;
+        }
+        for (bool done = false; !done;) {
+            skip_whitespace();
+            if (!validate_value() || !next_item(']', json_parse_error::InvalidList, done)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool validate_dictionary() {
+        if (!enter()) {
+            return false;
+        }
+        ++pos;
+        skip_whitespace();
+        if (pos != end && *pos == '}') {
+            ++pos;
+            --depth;
+            return true;
+        }
+        for (bool done = false; !done;) {
+            skip_whitespace();
+            if (pos == end || *pos != '"') {
+                return fail(pos == end ? json_parse_error::UnexpectedEnd : json_parse_error::InvalidDictionary);
+            }
+            if (!validate_string() || !expect(':', json_parse_error::InvalidDictionary)) {
+                return false;
+            }
+            skip_whitespace();
+            if (!validate_value() || !next_item('}', json_parse_error::InvalidDictionary, done)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Salta una stringa senza decodificarla (pos sulla virgoletta di apertura)
+    bool skip_string() {
+        ++pos;
+        while (pos != end) {
+            char c = *pos++;
+            if (c == '"') {
+                return true;
+            }
+            if (c == '\\') {
+                if (pos == end) {
+                    break;
+                }
+                ++pos;
+            }
+        }
+        return fail(json_parse_error::UnterminatedString);
+    }
+
+    /*
+     * Salta il valore che inizia in pos contando solo parentesi e virgolette:
+     * il contenuto saltato non viene validato né allocato.
+     */
+    bool skip_value() {
+        if (pos == end) {
+            return fail(json_parse_error::UnexpectedEnd);
+        }
+        if (*pos == '"') {
+            return skip_string();
+        }
+        if (*pos != '[' && *pos != '{') {
+            while (pos != end && *pos != ',' && *pos != ']' && *pos != '}' &&
+                   *pos != ' ' && *pos != '\n' && *pos != '\r' && *pos != '\t') {
+                ++pos;
+            }
+            return true;
+        }
+        std::size_t nesting = 0;
+        while (pos != end) {
+            char c = *pos;
+            if (c == '"') {
+                if (!skip_string()) {
+                    return false;
+                }
+                continue;
+            }
+            ++pos;
+            if (c == '[' || c == '{') {
+                ++nesting;
+            } else if ((c == ']' || c == '}') && --nesting == 0) {
+                return true;
+            }
+        }
+        return fail(json_parse_error::UnterminatedContainer);
+    }
+
+    // Dopo il valore principale sono ammessi solo spazi
+    bool finish() {
+        skip_whitespace();
+        return pos == end || fail(json_parse_error::TrailingCharacters);
+    }
+};
+
+const char* json_parse_result::message() const {
+    switch (error) {
+        case json_parse_error::None: return "nessun errore";
+        case json_parse_error::UnexpectedEnd: return "fine dell'input inattesa";
+        case json_parse_error::InvalidCharacter: return "carattere non valido";
+        case json_parse_error::InvalidLiteral: return "valore letterale non valido";
+        case json_parse_error::InvalidNumber: return "valore numerico non valido";
+        case json_parse_error::NumberOutOfRange: return "valore numerico fuori intervallo";
+        case json_parse_error::UnterminatedString: return "stringa non terminata";
+        case json_parse_error::ControlCharacter: return "carattere di controllo non ammesso in una stringa";
+        case json_parse_error::InvalidEscape: return "sequenza di escape non valida";
+        case json_parse_error::InvalidUnicodeEscape: return "sequenza \\u non valida";
+        case json_parse_error::UnpairedSurrogate: return "surrogato UTF-16 senza coppia";
+        case json_parse_error::InvalidList: return "lista non valida";
+        case json_parse_error::InvalidDictionary: return "dizionario non valido";
+        case json_parse_error::UnterminatedContainer: return "contenitore non terminato";
+        case json_parse_error::TrailingCharacters: return "caratteri inattesi dopo il valore json";
+        case json_parse_error::TooDeep: return "annidamento troppo profondo";
+        case json_parse_error::InvalidUtf8: return "sequenza UTF-8 non valida";
+    }
+    return "errore sconosciuto";
+}
+
+json_parse_result json::parse(std::string_view text, json& out, std::size_t max_depth, bool check_utf8) {
+    impl::parser p(text.data(), text.data() + text.size(), max_depth, check_utf8);
+    json result(out.pimpl->resource);
+    p.skip_whitespace();
+    if (p.parse_value(result) && p.finish()) {
+        out = std::move(result); // In caso di errore out resta invariato
+    }
+    return p.result();
+}
+
+json_parse_result json::validate(std::string_view text, std::size_t max_depth) {
+    impl::parser p(text.data(), text.data() + text.size(), max_depth);
+    p.skip_whitespace();
+    if (p.validate_value()) {
+        p.finish();
+    }
+    return p.result();
+}
+
+json_parse_result json::parse_deduplicated(std::string_view text, json& out, std::size_t* bytes_saved) {
+    impl::interner shared;
+    impl::parser p(text.data(), text.data() + text.size());
+    p.shared = &shared;
+    json result(out.pimpl->resource);
+    p.skip_whitespace();
+    if (p.parse_value(result) && p.finish()) {
+        out = std::move(result);
+        if (bytes_saved) {
+            *bytes_saved = shared.saved;
+        }
+    }
+    return p.result();
+}
+
+json json::parse(std::string_view text) {
+    json out;
+    impl::parser p(text.data(), text.data() + text.size());
+    p.skip_whitespace();
+    if (!p.parse_value(out) || !p.finish()) {
+        p.raise();
+    }
+    return out;
+}
+
+/*
+ * Scrittura CBOR (RFC 8949) con lunghezze sempre definite. I numeri interi
+ * rappresentabili esattamente diventano interi CBOR, gli altri double a 64 bit.
+ * Le liste compatte di numeri sono scritte come typed array (RFC 8746,
+ * tag 86/82 a seconda dell'endianness) con un'unica copia di memoria.
+ */
+struct json::impl::cbor_writer {
+    std::streambuf* out;
+    char buffer[4096];
+    std::size_t used = 0;
+
+    explicit cbor_writer(std::ostream& os) : out(os.rdbuf()) {}
+
+    void flush() {
+        if (used && out->sputn(buffer, used) != static_cast<std::streamsize>(used)) {
+            throw json_exception{"Errore CBOR: scrittura sullo stream fallita"};
+        }
+        used = 0;
+    }
+
+    void put(const void* data, std::size_t n) {
+        if (n > sizeof(buffer) - used) {
+            flush();
+            if (n > sizeof(buffer)) {
+                if (out->sputn(static_cast<const char*>(data), n) != static_cast<std::streamsize>(n)) {
+                    throw json_exception{"Errore CBOR: scrittura sullo stream fallita"};
+                }
+                return;
+            }
+        }
+        std::memcpy(buffer + used, data, n);
+        used += n;
+    }
+
+    void put_byte(unsigned char b) {
+        put(&b, 1);
+    }
+
+    void put_head(unsigned major, std::uint64_t value) {
+        unsigned char head[9];
+        std::size_t n;
+        if (value < 24) {
+            head[0] = static_cast<unsigned char>((major << 5) | value);
+            n = 1;
+        } else if (value <= 0xFF) {
+            head[0] = static_cast<unsigned char>((major << 5) | 24);
+            n = 2;
+        } else if (value <= 0xFFFF) {
+            head[0] = static_cast<unsigned char>((major << 5) | 25);
+            n = 3;
+        } else if (value <= 0xFFFFFFFFull) {
+            head[0] = static_cast<unsigned char>((major << 5) | 26);
+            n = 5;
+        } else {
+            head[0] = static_cast<unsigned char>((major << 5) | 27);
+            n = 9;
+        }
+        for (std::size_t i = 1; i < n; ++i) {
+            head[i] = static_cast<unsigned char>(value >> (8 * (n - 1 - i)));
+        }
+        put(head, n);
+    }
+
+    void put_double(double value) {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        unsigned char b[9];
+        b[0] = 0xFB;
+        for (int i = 0; i < 8; ++i) {
+            b[1 + i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+        }
+        put(b, 9);
+    }
+
+    void put_number(double value) {
+        // 2^63: oltre non è garantita la conversione esatta in intero a 64 bit
+        if (value == std::trunc(value) && std::fabs(value) < 9223372036854775808.0 &&
+            !(value == 0 && std::signbit(value))) {
+            if (value >= 0) {
+                put_head(0, static_cast<std::uint64_t>(value));
+            } else {
+                put_head(1, static_cast<std::uint64_t>(-(value + 1)));
+            }
+        } else {
+            put_double(value);
+        }
+    }
+
+    void put_string(const std::string& str) {
+        put_head(3, str.size());
+        put(str.data(), str.size());
+    }
+
+    static bool little_endian() {
+        const std::uint16_t probe = 1;
+        unsigned char first;
+        std::memcpy(&first, &probe, 1);
+        return first == 1;
+    }
+
+    void write(const json& value) {
+        const impl& node = *value.pimpl;
+        switch (node.type) {
+            case JsonType::Null:
+                put_byte(0xF6);
+                break;
+            case JsonType::Bool:
+                put_byte(node.boolValue ? 0xF5 : 0xF4);
+                break;
+            case JsonType::Number:
+                put_number(node.numberValue);
+                break;
+            case JsonType::String:
+                put_string(node.stringValue);
+                break;
+            case JsonType::List:
+                if (node.box()->packing == Packing::Numbers) {
+                    put_head(6, little_endian() ? 86 : 82);
+                    put_head(2, node.box()->packedNumbers.size() * sizeof(double));
+                    put(node.box()->packedNumbers.begin(), node.box()->packedNumbers.size() * sizeof(double));
+                } else if (node.box()->packing == Packing::Bools) {
+                    put_head(4, node.box()->packedBools.size());
+                    for (std::size_t i = 0; i < node.box()->packedBools.size(); ++i) {
+                        put_byte(node.box()->packedBools.get(i) ? 0xF5 : 0xF4);
+                    }
+                } else {
+                    put_head(4, node.box()->listValue.size());
+                    for (const json& item : node.box()->listValue) {
+                        write(item);
+                    }
+                }
+                break;
+            case JsonType::Dict:
+                put_head(5, node.dict_size());
+                node.for_each_entry([this](const std::pair<std::string, json>& entry) {
+                    put_string(entry.first);
+                    write(entry.second);
+                });
+                break;
+        }
+    }
+};
+
+/*
+ * Lettura CBOR. Le lunghezze dichiarate nell'input non sono affidabili:
+ * i contenitori vengono dimensionati al più per max_reserve elementi e le
+ * stringhe lette a blocchi, quindi una lunghezza falsa fa fallire la
+ * lettura per fine dello stream invece di allocare memoria a vuoto.
+ * Anche la profondità di annidamento è limitata.
+ */
+struct json::impl::cbor_reader {
+    static const std::size_t max_reserve = 4096;
+    static const std::size_t max_depth = 512;
+
+    std::streambuf* in;
+
+    explicit cbor_reader(std::istream& is) : in(is.rdbuf()) {}
+
+    [[noreturn]] static void fail(const char* message) {
+        throw json_exception{std::string("Errore CBOR: ") + message};
+    }
+
+    void get(void* data, std::size_t n) {
+        if (in->sgetn(static_cast<char*>(data), n) != static_cast<std::streamsize>(n)) {
+            fail("fine dell'input inattesa");
+        }
+    }
+
+    unsigned char get_byte() {
+        int c = in->sbumpc();
+        if (c == std::char_traits<char>::eof()) {
+            fail("fine dell'input inattesa");
+        }
+        return static_cast<unsigned char>(c);
+    }
+
+    std::uint64_t get_uint(unsigned info) {
+        if (info < 24) {
+            return info;
+        }
+        std::size_t n;
+        switch (info) {
+            case 24: n = 1; break;
+            case 25: n = 2; break;
+            case 26: n = 4; break;
+            case 27: n = 8; break;
+            case 31: fail("lunghezze indefinite non supportate");
+            default: fail("codifica non valida");
+        }
+        unsigned char b[8];
+        get(b, n);
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            value = (value << 8) | b[i];
+        }
+        return value;
+    }
+
+    void get_string(std::string& out, std::uint64_t length) {
+        out.clear();
+        char chunk[4096];
+        while (length) {
+            std::size_t n = length < sizeof(chunk) ? static_cast<std::size_t>(length) : sizeof(chunk);
+            get(chunk, n);
+            out.append(chunk, n);
+            length -= n;
+        }
+    }
+
+    static double half_to_double(std::uint16_t h) {
+        int exponent = (h >> 10) & 0x1F;
+        int mantissa = h & 0x3FF;
+        double value;
+        if (exponent == 0) {
+            value = std::ldexp(mantissa, -24);
+        } else if (exponent != 31) {
+            value = std::ldexp(mantissa + 1024, exponent - 25);
+        } else {
+            value = mantissa == 0 ? INFINITY : NAN;
+        }
+        return (h & 0x8000) ? -value : value;
+    }
+
+    void read_typed_array(json& out, std::uint64_t tag) {
+        unsigned char head = get_byte();
+        if ((head >> 5) != 2) {
+            fail("typed array senza byte string");
+        }
+        std::uint64_t length = get_uint(head & 0x1F);
+        if (length % sizeof(double) != 0) {
+            fail("lunghezza del typed array non valida");
+        }
+        impl& node = *out.pimpl;
+        node.set_type(JsonType::List);
+        node.box()->packing = Packing::Numbers;
+        bool swap = (tag == 86) != cbor_writer::little_endian();
+        std::uint64_t count = length / sizeof(double);
+        node.box()->packedNumbers.reserve(count < max_reserve ? count : max_reserve);
+        double block[512];
+        while (count) {
+            std::size_t n = count < 512 ? static_cast<std::size_t>(count) : 512;
+            get(block, n * sizeof(double));
+            for (std::size_t i = 0; i < n; ++i) {
+                if (swap) {
+                    unsigned char* b = reinterpret_cast<unsigned char*>(block + i);
+                    std::reverse(b, b + sizeof(double));
+                }
+                node.box()->packedNumbers.push_back(block[i]);
+            }
+            count -= n;
+        }
+    }
+
+    void read(json& out, std::size_t depth) {
+        if (depth > max_depth) {
+            fail("annidamento troppo profondo");
+        }
+        impl& node = *out.pimpl;
+        unsigned char head = get_byte();
+        unsigned major = head >> 5;
+        unsigned info = head & 0x1F;
+        switch (major) {
+            case 0:
+                node.type = JsonType::Number;
+                node.numberValue = static_cast<double>(get_uint(info));
+                break;
+            case 1:
+                node.type = JsonType::Number;
+                node.numberValue = -1.0 - static_cast<double>(get_uint(info));
+                break;
+            case 2:
+                fail("byte string non rappresentabile in json");
+            case 3:
+                node.type = JsonType::String;
+                get_string(node.stringValue, get_uint(info));
+                break;
+            case 4: {
+                std::uint64_t count = get_uint(info);
+                node.set_type(JsonType::List);
+                node.box()->listValue.reserve(count < max_reserve ? count : max_reserve);
+                for (std::uint64_t i = 0; i < count; ++i) {
+                    json item(node.resource);
+                    read(item, depth + 1);
+                    node.append(std::move(item));
+                }
+                break;
+            }
+            case 5: {
+                std::uint64_t count = get_uint(info);
+                node.set_type(JsonType::Dict);
+                for (std::uint64_t i = 0; i < count; ++i) {
+                    unsigned char key_head = get_byte();
+                    if ((key_head >> 5) != 3) {
+                        fail("le chiavi dei dizionari devono essere stringhe");
+                    }
+                    std::pair<std::string, json> entry(std::string(), json(node.resource));
+                    get_string(entry.first, get_uint(key_head & 0x1F));
+                    read(entry.second, depth + 1);
+                    node.add_entry(std::move(entry));
+                }
+                node.merge_duplicate_keys();
+                break;
+            }
+            case 6: {
+                std::uint64_t tag = get_uint(info);
+                if (tag == 82 || tag == 86) {
+                    read_typed_array(out, tag);
+                } else {
+                    read(out, depth + 1); // Tag non gestito: si usa il valore contenuto
+                }
+                break;
+            }
+            default:
+                switch (info) {
+                    case 20:
+                    case 21:
+                        node.type = JsonType::Bool;
+                        node.boolValue = info == 21;
+                        break;
+                    case 22:
+                    case 23:
+                        node.type = JsonType::Null;
+                        break;
+                    case 25: {
+                        unsigned char b[2];
+                        get(b, 2);
+                        node.type = JsonType::Number;
+                        node.numberValue = half_to_double(static_cast<std::uint16_t>((b[0] << 8) | b[1]));
+                        break;
+                    }
+                    case 26: {
+                        std::uint32_t bits = static_cast<std::uint32_t>(get_uint(26));
+                        float f;
+                        std::memcpy(&f, &bits, sizeof(f));
+                        node.type = JsonType::Number;
+                        node.numberValue = f;
+                        break;
+                    }
+                    case 27: {
+                        std::uint64_t bits = get_uint(27);
+                        node.type = JsonType::Number;
+                        std::memcpy(&node.numberValue, &bits, sizeof(bits));
+                        break;
+                    }
+                    default:
+                        fail("valore semplice non supportato");
+                }
+        }
+    }
+};
+
+void json::to_cbor(std::ostream& os) const {
+    impl::cbor_writer writer(os);
+    writer.write(*this);
+    writer.flush();
+}
+
+void json::from_cbor(std::istream& is) {
+    json result(pimpl->resource);
+    impl::cbor_reader reader(is);
+    reader.read(result, 0);
+    *this = std::move(result);
+}
+
+/*
+ * Formato a nastro: un unico blocco senza puntatori, leggibile in place.
+ * Ogni valore è descritto da uno slot di 64 bit: i 3 bit bassi sono il tipo,
+ * il resto è l'offset (multiplo di 8) del contenuto dall'inizio del file.
+ *
+ *   intestazione  "JSONTAPE", u32 versione, u32 riservato, u64 slot radice, u64 dimensione
+ *   numero        double
+ *   stringa       u64 lunghezza, byte (allineati a 8)
+ *   lista         u64 n, n slot
+ *   lista compatta u64 n, n double
+ *   dizionario    u64 n, n coppie (slot chiave, slot valore) in ordine di
+ *                 inserimento, poi n indici u32 ordinati per chiave
+ *
+ * Tutti gli interi sono little-endian; il formato è pensato per essere
+ * scritto e letto su macchine con la stessa endianness.
+ */
+namespace tape {
+    const char magic[8] = {'J', 'S', 'O', 'N', 'T', 'A', 'P', 'E'};
+    const std::uint32_t version = 1;
+    const std::size_t header_size = 32;
+    const std::size_t max_depth = 512;
+
+    enum Kind : std::uint64_t {
+        Null = 0, False = 1, True = 2, Number = 3, String = 4, List = 5, Dict = 6, Numbers = 7
+    };
+
+    inline std::uint64_t load_u64(const char* p) {
+        std::uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+}
+
+struct json::impl::tape_writer {
+    std::string out;
+
+    std::size_t reserve_bytes(std::size_t n) {
+        std::size_t at = out.size();
+        out.append((n + 7) & ~std::size_t(7), '\0');
+        return at;
+    }
+
+    void store_u64(std::size_t at, std::uint64_t v) {
+        std::memcpy(&out[at], &v, sizeof(v));
+    }
+
+    std::uint64_t write_string(const std::string& str) {
+        std::size_t at = reserve_bytes(8 + str.size());
+        store_u64(at, str.size());
+        if (!str.empty()) {
+            std::memcpy(&out[at + 8], str.data(), str.size());
+        }
+        return at | tape::String;
+    }
+
+    std::uint64_t write(const json& value) {
+        const impl& node = *value.pimpl;
+        switch (node.type) {
+            case JsonType::Null:
+                return tape::Null;
+            case JsonType::Bool:
+                return node.boolValue ? tape::True : tape::False;
+            case JsonType::Number: {
+                std::size_t at = reserve_bytes(8);
+                std::memcpy(&out[at], &node.numberValue, sizeof(double));
+                return at | tape::Number;
+            }
+            case JsonType::String:
+                return write_string(node.stringValue);
+            case JsonType::List: {
+                if (node.box()->packing == Packing::Numbers) {
+                    std::size_t n = node.box()->packedNumbers.size();
+                    std::size_t at = reserve_bytes(8 + n * sizeof(double));
+                    store_u64(at, n);
+                    if (n) {
+                        std::memcpy(&out[at + 8], node.box()->packedNumbers.begin(), n * sizeof(double));
+                    }
+                    return at | tape::Numbers;
+                }
+                std::size_t n = node.list_size();
+                std::size_t at = reserve_bytes(8 + n * 8);
+                store_u64(at, n);
+                for (std::size_t i = 0; i < n; ++i) {
+                    std::uint64_t slot;
+                    if (node.box()->packing == Packing::Bools) {
+                        slot = node.box()->packedBools.get(i) ? tape::True : tape::False;
+                    } else {
+                        slot = write(node.box()->listValue[i]);
+                    }
+                    store_u64(at + 8 + i * 8, slot);
+                }
+                return at | tape::List;
+            }
+            case JsonType::Dict: {
+                std::size_t n = node.dict_size();
+                std::size_t at = reserve_bytes(8 + n * 16 + n * 4);
+                store_u64(at, n);
+                ArrayList<const std::pair<std::string, json>*> entries;
+                entries.reserve(n);
+                node.for_each_entry([&entries](const std::pair<std::string, json>& entry) {
+                    entries.push_back(&entry);
+                });
+                for (std::size_t i = 0; i < n; ++i) {
+                    std::uint64_t key = write_string(entries[i]->first);
+                    std::uint64_t val = write(entries[i]->second);
+                    store_u64(at + 8 + i * 16, key);
+                    store_u64(at + 16 + i * 16, val);
+                }
+                ArrayList<std::uint32_t> order;
+                order.reserve(n);
+                for (std::size_t i = 0; i < n; ++i) {
+                    order.push_back(static_cast<std::uint32_t>(i));
+                }
+                std::stable_sort(order.begin(), order.end(), [&entries](std::uint32_t a, std::uint32_t b) {
+                    return entries[a]->first < entries[b]->first;
+                });
+                if (n) {
+                    std::memcpy(&out[at + 8 + n * 16], order.begin(), n * sizeof(std::uint32_t));
+                }
+                return at | tape::Dict;
+            }
+        }
+        return tape::Null;
+    }
+};
+
+void json::to_tape(std::ostream& os) const {
+    impl::tape_writer writer;
+    writer.reserve_bytes(tape::header_size);
+    std::uint64_t root = writer.write(*this);
+    std::memcpy(&writer.out[0], tape::magic, sizeof(tape::magic));
+    std::memcpy(&writer.out[8], &tape::version, sizeof(tape::version));
+    writer.store_u64(16, root);
+    writer.store_u64(24, writer.out.size());
+    if (!os.write(writer.out.data(), writer.out.size())) {
+        throw json_exception{"Errore nella scrittura del nastro json"};
+    }
+}
+
+json_view::json_view() : base(nullptr), length(0), slot(tape::Null) {}
+
+json_view::json_view(const char* data, std::size_t size, std::uint64_t value)
+    : base(data), length(size), slot(value) {}
+
+const char* json_view::content(std::size_t bytes) const {
+    std::uint64_t offset = slot & ~std::uint64_t(7);
+    if (offset < tape::header_size || offset > length || length - offset < bytes) {
+        throw json_exception{"Nastro json corrotto: offset fuori dal file"};
+    }
+    return base + offset;
+}
+
+// Il writer scrive ogni contenitore prima dei suoi figli: un figlio che non
+// sta più avanti nel nastro è corrotto e potrebbe riferirsi a un antenato
+json_view json_view::child(std::uint64_t value) const {
+    std::uint64_t kind = value & 7;
+    if (kind != tape::Null && kind != tape::False && kind != tape::True &&
+        (value & ~std::uint64_t(7)) <= (slot & ~std::uint64_t(7))) {
+        throw json_exception{"Nastro json corrotto: figlio non successivo al contenitore"};
+    }
+    return json_view(base, length, value);
+}
+
+// Contenuto di 8 + count * stride byte; count viene dal nastro e va controllato prima di moltiplicare
+const char* json_view::content(std::uint64_t count, std::size_t stride) const {
+    const char* p = content(8);
+    if (count > (length - (p - base) - 8) / stride) {
+        throw json_exception{"Nastro json corrotto: offset fuori dal file"};
+    }
+    return p;
+}
+
+bool json_view::is_null() const {
+    return (slot & 7) == tape::Null;
+}
+
+bool json_view::is_bool() const {
+    return (slot & 7) == tape::True || (slot & 7) == tape::False;
+}
+
+bool json_view::is_number() const {
+    return (slot & 7) == tape::Number;
+}
+
+bool json_view::is_string() const {
+    return (slot & 7) == tape::String;
+}
+
+bool json_view::is_list() const {
+    return (slot & 7) == tape::List || (slot & 7) == tape::Numbers;
+}
+
+bool json_view::is_dictionary() const {
+    return (slot & 7) == tape::Dict;
+}
+
+double json_view::get_number() const {
+    if (!is_number()) {
+        throw json_exception{"The JSON object is not a number."};
+    }
+    double value;
+    std::memcpy(&value, content(8), sizeof(value));
+    return value;
+}
+
+bool json_view::get_bool() const {
+    if (!is_bool()) {
+        throw json_exception{"The JSON object is not a boolean."};
+    }
+    return (slot & 7) == tape::True;
+}
+
+std::string_view json_view::get_string() const {
+    if (!is_string()) {
+        throw json_exception{"The JSON object is not a string."};
+    }
+    const char* p = content(8);
+    std::uint64_t n = tape::load_u64(p);
+    content(n, 1);
+    return std::string_view(p + 8, n);
+}
+
+std::size_t json_view::size() const {
+    if (is_list() || is_dictionary()) {
+        // Il numero di elementi deve stare nel file insieme alle loro voci
+        std::uint64_t n = tape::load_u64(content(8));
+        content(n, is_dictionary() ? 20 : 8);
+        return n;
+    }
+    return is_null() ? 0 : 1;
+}
+
+json_view json_view::operator[](std::size_t index) const {
+    if (!is_list()) {
+        throw json_exception{"ERRORE: L'oggetto json non è una lista"};
+    }
+    std::size_t n = size();
+    if (index >= n) {
+        throw json_exception{"Indice fuori dalla lista"};
+    }
+    const char* p = content(n, 8);
+    std::uint64_t offset = p - base + 8 + index * 8;
+    if ((slot & 7) == tape::Numbers) {
+        return json_view(base, length, offset | tape::Number);
+    }
+    return child(tape::load_u64(base + offset));
+}
+
+std::string_view json_view::key_at(std::size_t index) const {
+    std::size_t n = size();
+    if (index >= n) {
+        throw json_exception{"Nastro json corrotto: indice fuori dal dizionario"};
+    }
+    const char* p = content(n, 16);
+    return child(tape::load_u64(p + 8 + index * 16)).get_string();
+}
+
+json_view json_view::value_at(std::size_t index) const {
+    std::size_t n = size();
+    if (index >= n) {
+        throw json_exception{"Nastro json corrotto: indice fuori dal dizionario"};
+    }
+    const char* p = content(n, 16);
+    return child(tape::load_u64(p + 16 + index * 16));
+}
+
+const json_view* json_view::find(std::string_view key, json_view& out) const {
+    if (!is_dictionary()) {
+        throw json_exception{"json object is not a dictionary"};
+    }
+    std::size_t n = size();
+    const char* p = content(n, 20);
+    const char* order = p + 8 + n * 16;
+    // Ricerca binaria sull'indice ordinato delle chiavi
+    std::size_t lo = 0, hi = n;
+    while (lo < hi) {
+        std::size_t mid = lo + (hi - lo) / 2;
+        std::uint32_t entry;
+        std::memcpy(&entry, order + mid * 4, sizeof(entry));
+        if (key_at(entry) < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == n) {
+        return nullptr;
+    }
+    std::uint32_t entry;
+    std::memcpy(&entry, order + lo * 4, sizeof(entry));
+    if (key_at(entry) != key) {
+        return nullptr;
+    }
+    out = value_at(entry);
+    return &out;
+}
+
+json_view json_view::operator[](std::string const& key) const {
+    json_view result;
+    if (!find(key, result)) {
+        throw json_exception{"Key not found in json dictionary"};
+    }
+    return result;
+}
+
+json json_view::materialize() const {
+    return materialize(0);
+}
+
+json json_view::materialize(std::size_t depth) const {
+    if (depth > tape::max_depth) {
+        throw json_exception{"Nastro json corrotto: annidamento troppo profondo"};
+    }
+    json result;
+    if (is_number()) {
+        result.set_number(get_number());
+    } else if (is_bool()) {
+        result.set_bool(get_bool());
+    } else if (is_string()) {
+        result.set_string(std::string(get_string()));
+    } else if (is_list()) {
+        result.set_list();
+        result.reserve(size());
+        for (std::size_t i = 0; i < size(); ++i) {
+            result.push_back((*this)[i].materialize(depth + 1));
+        }
+    } else if (is_dictionary()) {
+        result.set_dictionary();
+        for (std::size_t i = 0; i < size(); ++i) {
+            result.insert(std::make_pair(std::string(key_at(i)), value_at(i).materialize(depth + 1)));
+        }
+    }
+    return result;
+}
+
+json_tape::json_tape(const char* data, std::size_t size)
+    : bytes(data), length(size), mapped(false), owned(false) {
+    check();
+}
+
+json_tape::json_tape(std::string const& path) : bytes(nullptr), length(0), mapped(false), owned(false) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw json_exception{"Impossibile aprire il nastro json: " + path};
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size <= 0) {
+        ::close(fd);
+        throw json_exception{"Impossibile aprire il nastro json: " + path};
+    }
+    void* region = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (region == MAP_FAILED) {
+        throw json_exception{"Impossibile mappare il nastro json: " + path};
+    }
+    bytes = static_cast<const char*>(region);
+    length = info.st_size;
+    mapped = true;
+#else
+    // Senza mmap il file viene letto in memoria una volta sola
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        throw json_exception{"Impossibile aprire il nastro json: " + path};
+    }
+    length = static_cast<std::size_t>(in.tellg());
+    char* copy = new char[length];
+    in.seekg(0);
+    in.read(copy, length);
+    bytes = copy;
+    owned = true;
+#endif
+    try {
+        check();
+    } catch (...) {
+        release();
+        throw;
+    }
+}
+
+json_tape::json_tape(json_tape&& other) noexcept
+    : bytes(other.bytes), length(other.length), mapped(other.mapped), owned(other.owned) {
+    other.bytes = nullptr;
+    other.length = 0;
+    other.mapped = false;
+    other.owned = false;
+}
+
+json_tape& json_tape::operator=(json_tape&& other) noexcept {
+    if (this != &other) {
+        release();
+        bytes = other.bytes;
+        length = other.length;
+        mapped = other.mapped;
+        owned = other.owned;
+        other.bytes = nullptr;
+        other.length = 0;
+        other.mapped = false;
+        other.owned = false;
+    }
+    return *this;
+}
+
+json_tape::~json_tape() {
+    release();
+}
+
+void json_tape::release() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (mapped) {
+        ::munmap(const_cast<char*>(bytes), length);
+    }
+#endif
+    if (owned) {
+        delete[] bytes;
+    }
+    bytes = nullptr;
+    mapped = false;
+    owned = false;
+}
+
+// Controlla solo l'intestazione: l'apertura resta O(1) rispetto alla dimensione del documento
+void json_tape::check() const {
+    std::uint32_t version;
+    if (length < tape::header_size || std::memcmp(bytes, tape::magic, sizeof(tape::magic)) != 0) {
+        throw json_exception{"Nastro json non valido"};
+    }
+    std::memcpy(&version, bytes + 8, sizeof(version));
+    if (version != tape::version || tape::load_u64(bytes + 24) != length) {
+        throw json_exception{"Nastro json non valido o troncato"};
+    }
+}
+
+json_view json_tape::root() const {
+    return json_view(bytes, length, tape::load_u64(bytes + 16));
+}
+
+/*
+ * Stato del parser incrementale. Ogni byte viene esaminato una volta sola:
+ * i token lasciati a metà alla fine di un blocco (stringhe, numeri,
+ * letterali, sequenze di escape) restano in questo stato fino al blocco
+ * successivo, insieme alla pila dei contenitori aperti.
+ */
+struct json_push_parser::state {
+    enum class Token { None, String, Number, Literal };
+    enum class Expect { Value, ValueOrEnd, CommaOrEnd, Key, KeyOrEnd, Colon };
+
+    struct frame {
+        json value;
+        std::string key;
+        Expect expect;
+    };
+
+    std::size_t max_depth;
+    std::size_t max_token;
+    std::pmr::memory_resource* resource;
+
+    ArrayList<frame> stack;
+    ArrayList<json> ready;
+    std::size_t next_ready = 0;
+
+    Token token = Token::None;
+    bool string_is_key = false;
+    std::string text;           // stringa o numero in costruzione
+    bool escape = false;
+    int hex_left = 0;           // cifre mancanti di una sequenza \u
+    unsigned hex_value = 0;
+    unsigned high_surrogate = 0;
+    const char* literal = nullptr;
+    std::size_t literal_len = 0;
+    std::size_t literal_pos = 0;
+    std::size_t values = 0;
+
+    state(std::size_t depth, std::size_t token_limit, std::pmr::memory_resource* r)
+        : max_depth(depth), max_token(token_limit), resource(r) {}
+
+    [[noreturn]] static void fail(const char* message) {
+        throw json_exception{std::string("Errore di parsing: ") + message};
+    }
+
+    Expect top_expect() const {
+        return stack.isEmpty() ? Expect::Value : stack.back().expect;
+    }
+
+    void complete(json&& value) {
+        if (stack.isEmpty()) {
+            ready.push_back(std::move(value));
+            ++values;
+            return;
+        }
+        frame& top = stack.back();
+        json::impl& node = *top.value.pimpl;
+        if (node.type == JsonType::List) {
+            node.append(std::move(value));
+        } else {
+            node.add_entry(std::make_pair(std::move(top.key), std::move(value)));
+            top.key.clear();
+        }
+        top.expect = Expect::CommaOrEnd;
+    }
+
+    void open(JsonType type) {
+        if (stack.size() >= max_depth) {
+            fail("annidamento troppo profondo");
+        }
+        frame f{json(resource), std::string(), Expect::Value};
+        f.value.pimpl->set_type(type);
+        f.expect = type == JsonType::List ? Expect::ValueOrEnd : Expect::KeyOrEnd;
+        stack.push_back(std::move(f));
+    }
+
+    void close() {
+        json value(std::move(stack.back().value));
+        stack.pop_back();
+        if (value.pimpl->type == JsonType::Dict) {
+            value.pimpl->merge_duplicate_keys();
+        }
+        complete(std::move(value));
+    }
+
+    void append_code_point(unsigned cp) {
+        json::impl::parser::append_utf8(text, cp);
+    }
+
+    void end_string() {
+        token = Token::None;
+        if (high_surrogate) {
+            fail("surrogato UTF-16 senza coppia");
+        }
+        if (!utf8_valid(text.data(), text.data() + text.size())) {
+            fail("sequenza UTF-8 non valida");
+        }
+        if (string_is_key) {
+            stack.back().key = std::move(text);
+            stack.back().expect = Expect::Colon;
+        } else {
+            json value(resource);
+            value.pimpl->type = JsonType::String;
+            value.pimpl->stringValue = std::move(text);
+            complete(std::move(value));
+        }
+        text.clear();
+    }
+
+    void end_number() {
+        token = Token::None;
+        json::impl::parser p(text.data(), text.data() + text.size());
+        double number;
+        if (!p.parse_number(number) || p.pos != p.end) {
+            fail(p.error == json_parse_error::NumberOutOfRange ? "valore numerico fuori intervallo"
+                                                              : "valore numerico non valido");
+        }
+        text.clear();
+        json value(resource);
+        value.pimpl->type = JsonType::Number;
+        value.pimpl->numberValue = number;
+        complete(std::move(value));
+    }
+
+    void end_literal() {
+        token = Token::None;
+        json value(resource);
+        if (literal[0] == 't' || literal[0] == 'f') {
+            value.pimpl->type = JsonType::Bool;
+            value.pimpl->boolValue = literal[0] == 't';
+        }
+        complete(std::move(value));
+    }
+
+    // Consuma i byte di una stringa; restituisce la posizione dopo quelli usati
+    const char* feed_string(const char* p, const char* e) {
+        while (p != e) {
+            if (hex_left) {
+                int d = json::impl::parser::hex_digit(*p++);
+                if (d < 0) {
+                    fail("sequenza \\u non valida");
+                }
+                hex_value = (hex_value << 4) | static_cast<unsigned>(d);
+                if (--hex_left == 0) {
+                    if (hex_value >= 0xD800 && hex_value <= 0xDBFF && !high_surrogate) {
+                        high_surrogate = hex_value;
+                    } else if (hex_value >= 0xDC00 && hex_value <= 0xDFFF && high_surrogate) {
+                        append_code_point(0x10000 + ((high_surrogate - 0xD800) << 10) + (hex_value - 0xDC00));
+                        high_surrogate = 0;
+                    } else if (high_surrogate || (hex_value >= 0xD800 && hex_value <= 0xDFFF)) {
+                        fail("surrogato UTF-16 senza coppia");
+                    } else {
+                        append_code_point(hex_value);
+                    }
+                }
+                continue;
+            }
+            if (escape) {
+                escape = false;
+                char c = *p++;
+                if (high_surrogate && c != 'u') {
+                    fail("surrogato UTF-16 senza coppia");
+                }
+                switch (c) {
+                    case '"': text += '"'; break;
+                    case '\\': text += '\\'; break;
+                    case '/': text += '/'; break;
+                    case 'b': text += '\b'; break;
+                    case 'f': text += '\f'; break;
+                    case 'n': text += '\n'; break;
+                    case 'r': text += '\r'; break;
+                    case 't': text += '\t'; break;
+                    case 'u': hex_left = 4; hex_value = 0; break;
+                    default: fail("sequenza di escape non valida");
+                }
+                continue;
+            }
+            const char* run = p;
+            while (p != e && *p != '"' && *p != '\\' && static_cast<unsigned char>(*p) >= 0x20) {
+                ++p;
+            }
+            if (p != run && high_surrogate) {
+                fail("surrogato UTF-16 senza coppia");
+            }
+            text.append(run, p);
+            if (text.size() > max_token) {
+                fail("stringa troppo lunga");
+            }
+            if (p == e) {
+                break;
+            }
+            char c = *p++;
+            if (c == '"') {
+                end_string();
+                return p;
+            }
+            if (c == '\\') {
+                escape = true;
+            } else {
+                fail("carattere di controllo non ammesso in una stringa");
+            }
+        }
+        return p;
+    }
+
+    void begin_value(char c) {
+        switch (c) {
+            case '{':
+                open(JsonType::Dict);
+                break;
+            case '[':
+                open(JsonType::List);
+                break;
+            case '"':
+                token = Token::String;
+                string_is_key = false;
+                break;
+            case 't':
+                token = Token::Literal;
+                literal = "true";
+                literal_len = 4;
+                literal_pos = 1;
+                break;
+            case 'f':
+                token = Token::Literal;
+                literal = "false";
+                literal_len = 5;
+                literal_pos = 1;
+                break;
+            case 'n':
+                token = Token::Literal;
+                literal = "null";
+                literal_len = 4;
+                literal_pos = 1;
+                break;
+            default:
+                if (c == '-' || (c >= '0' && c <= '9')) {
+                    token = Token::Number;
+                    text += c;
+                } else {
+                    fail("carattere non valido");
+                }
+        }
+    }
+
+    void feed(const char* p, const char* e) {
+        while (p != e) {
+            switch (token) {
+                case Token::String:
+                    p = feed_string(p, e);
+                    continue;
+                case Token::Number: {
+                    char c = *p;
+                    if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+                        text += c;
+                        ++p;
+                        if (text.size() > max_token) {
+                            fail("numero troppo lungo");
+                        }
+                    } else {
+                        end_number();
+                    }
+                    continue;
+                }
+                case Token::Literal:
+                    if (*p++ != literal[literal_pos++]) {
+                        fail("valore letterale non valido");
+                    }
+                    if (literal_pos == literal_len) {
+                        end_literal();
+                    }
+                    continue;
+                case Token::None:
+                    break;
+            }
+
+            char c = *p++;
+            if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+                continue;
+            }
+            switch (top_expect()) {
+                case Expect::ValueOrEnd:
+                    if (c == ']') {
+                        close();
+                        break;
+                    }
+                    begin_value(c);
+                    break;
+                case Expect::Value:
+                    begin_value(c);
+                    break;
+                case Expect::KeyOrEnd:
+                case Expect::Key:
+                    if (c == '}' && top_expect() == Expect::KeyOrEnd) {
+                        close();
+                    } else if (c == '"') {
+                        token = Token::String;
+                        string_is_key = true;
+                    } else {
+                        fail("dizionario non valido");
+                    }
+                    break;
+                case Expect::Colon:
+                    if (c != ':') {
+                        fail("dizionario non valido");
+                    }
+                    stack.back().expect = Expect::Value;
+                    break;
+                case Expect::CommaOrEnd: {
+                    bool is_list = stack.back().value.pimpl->type == JsonType::List;
+                    if (c == ',') {
+                        stack.back().expect = is_list ? Expect::Value : Expect::Key;
+                    } else if (c == (is_list ? ']' : '}')) {
+                        close();
+                    } else {
+                        fail(is_list ? "lista non valida" : "dizionario non valido");
+                    }
+                    break;
+                }
+            }
+        }
+    }
+};
+
+json_push_parser::json_push_parser(std::size_t max_depth, std::size_t max_token,
+                                   std::pmr::memory_resource* resource)
+    : st(new state(max_depth, max_token, resource ? resource : std::pmr::get_default_resource())) {}
+
+json_push_parser::~json_push_parser() {
+    delete st;
+}
+
+std::size_t json_push_parser::feed(const char* data, std::size_t size) {
+    std::size_t before = st->values;
+    st->feed(data, data + size);
+    return st->values - before;
+}
+
+std::size_t json_push_parser::feed(std::string const& chunk) {
+    return feed(chunk.data(), chunk.size());
+}
+
+std::size_t json_push_parser::finish() {
+    std::size_t before = st->values;
+    // Un numero alla fine dell'input è terminato solo dalla fine dell'input stessa
+    if (st->token == state::Token::Number && st->stack.isEmpty()) {
+        st->end_number();
+    }
+    if (st->token != state::Token::None || !st->stack.isEmpty()) {
+        throw json_exception{"Errore di parsing: valore json incompleto alla fine dell'input"};
+    }
+    return st->values - before;
+}
+
+bool json_push_parser::has_value() const {
+    return st->next_ready < st->ready.size();
+}
+
+json json_push_parser::next() {
+    if (!has_value()) {
+        throw json_exception{"Nessun valore json completo disponibile"};
+    }
+    json value(std::move(st->ready[st->next_ready++]));
+    if (st->next_ready == st->ready.size()) {
+        st->ready.clear();
+        st->next_ready = 0;
+    }
+    return value;
+}
+
+void json_push_parser::reset() {
+    state* fresh = new state(st->max_depth, st->max_token, st->resource);
+    delete st;
+    st = fresh;
+}
+
+// Byte allocati sullo heap da una stringa (0 se il contenuto sta nel buffer interno)
+static std::size_t heap_bytes(const std::string& str) {
+    static const std::size_t inline_capacity = std::string().capacity();
+    return str.capacity() > inline_capacity ? str.capacity() + 1 : 0;
+}
+
+void json::impl::account(json_memory_usage& usage, node_table* seen) const {
+    // Il json che punta a questo nodo è contato da chi lo contiene
+    usage.overhead += sizeof(impl) + (storage ? sizeof(containers) : 0);
+    auto child = [&usage, seen](const json& item) {
+        const impl& node = *item.pimpl;
+        if (node.refs > 1 && (!seen || !seen->insert_pointer(&node))) {
+            return;
+        }
+        node.account(usage, seen);
+    };
+    switch (type) {
+        case JsonType::Null:
+            ++usage.nulls;
+            break;
+        case JsonType::Number:
+            ++usage.numbers;
+            break;
+        case JsonType::Bool:
+            ++usage.bools;
+            break;
+        case JsonType::String:
+            ++usage.strings;
+            usage.string_bytes += heap_bytes(stringValue);
+            break;
+        case JsonType::List:
+            ++usage.lists;
+            // Gli slot occupati sono overhead dei figli, qui solo la parte inutilizzata
+            usage.overhead += box()->listValue.size() * sizeof(json);
+            usage.container_bytes += (box()->listValue.capacity() - box()->listValue.size()) * sizeof(json);
+            usage.container_bytes += box()->packedNumbers.capacity() * sizeof(double);
+            usage.container_bytes += box()->packedBools.words.capacity() * sizeof(std::uint64_t);
+            usage.numbers += box()->packing == Packing::Numbers ? box()->packedNumbers.size() : 0;
+            usage.bools += box()->packing == Packing::Bools ? box()->packedBools.size() : 0;
+            for (const json& item : box()->listValue) {
+                child(item);
+            }
+            break;
+        case JsonType::Dict:
+            ++usage.dicts;
+            if (box()->frozen) {
+                usage.container_bytes += box()->flatEntries.capacity() * sizeof(std::pair<std::string, json>);
+                usage.container_bytes += box()->flatIndex.capacity() * sizeof(FlatKey);
+            } else {
+                usage.container_bytes += box()->dictValue.size() * sizeof(LinkedList<std::pair<std::string, json>>::Node);
+            }
+            // Il json dei valori è già dentro il nodo o la coppia
+            for_each_entry([&usage, &child](const std::pair<std::string, json>& entry) {
+                ++usage.keys;
+                usage.key_bytes += heap_bytes(entry.first);
+                child(entry.second);
+            });
+            break;
+    }
+}
+
+std::size_t json::impl::released_bytes() const {
+    json_memory_usage usage{};
+    account(usage, nullptr);
+    return usage.overhead + usage.key_bytes + usage.string_bytes + usage.container_bytes;
+}
+
+json_memory_usage json::memory_usage() const {
+    json_memory_usage usage{};
+    impl::node_table seen;
+    usage.overhead += sizeof(json);
+    pimpl->account(usage, &seen);
+    usage.total = usage.overhead + usage.key_bytes + usage.string_bytes + usage.container_bytes;
+    return usage;
+}
+
+#ifdef JSON_MEMORY_STATS
+json_allocation_stats json_allocation_counters() {
+    json_allocation_stats stats;
+    stats.node_allocations = memory_stats::allocations[memory_stats::Node].load();
+    stats.node_bytes = memory_stats::bytes[memory_stats::Node].load();
+    stats.array_allocations = memory_stats::allocations[memory_stats::Array].load();
+    stats.array_bytes = memory_stats::bytes[memory_stats::Array].load();
+    stats.dict_node_allocations = memory_stats::allocations[memory_stats::DictNode].load();
+    stats.dict_node_bytes = memory_stats::bytes[memory_stats::DictNode].load();
+    stats.live_bytes = memory_stats::live_bytes.load();
+    stats.peak_bytes = memory_stats::peak_bytes.load();
+    return stats;
+}
+
+void json_reset_allocation_counters() {
+    for (int kind = 0; kind < memory_stats::Kinds; ++kind) {
+        memory_stats::allocations[kind] = 0;
+        memory_stats::bytes[kind] = 0;
+    }
+    memory_stats::peak_bytes = memory_stats::live_bytes.load();
+}
+#endif
+
+void json::impl::unpack() {
+    if (box()->packing == Packing::None) {
+        return;
+    }
+    ArrayList<json> items(resource);
+    items.reserve(list_size());
+    for (std::size_t i = 0; i < list_size(); ++i) {
+        json item(resource);
+        if (box()->packing == Packing::Numbers) {
+            item.pimpl->type = JsonType::Number;
+            item.pimpl->numberValue = box()->packedNumbers[i];
+        } else {
+            item.pimpl->type = JsonType::Bool;
+            item.pimpl->boolValue = box()->packedBools.get(i);
+        }
+        items.push_back(std::move(item));
+    }
+    box()->listValue = std::move(items);
+    adopt_children();
+    box()->packedNumbers = ArrayList<double>(resource);
+    box()->packedBools = BitArray(resource);
+    box()->packing = Packing::None;
+    /*
+     * Gli elementi nuovi non hanno hash né tratto di testo: invalidare
+     * anche questo nodo e i suoi genitori mantiene la regola su cui si
+     * basa touch(), altrimenti la modifica di un elemento non risalirebbe.
+     */
+    touch();
+}
+
+void json::impl::own(json& slot) {
+    impl* node = slot.pimpl;
+    if (node->refs > 1) {
+        // Copia superficiale: i nipoti restano condivisi tra la copia e l'originale
+        slot.pimpl = create(*node, node->resource, true);
+        if (node->box()) {
+            node->box()->sharedChildren = true;
+        }
+        --node->refs;
+    }
+    slot.pimpl->parent = this;
+}
+
+void json::impl::own_children() {
+    if (!storage || !storage->sharedChildren) {
+        return;
+    }
+    for (json& item : box()->listValue) {
+        own(item);
+    }
+    for (auto node = box()->dictValue.get_head(); node; node = node->next) {
+        own(node->data.second);
+    }
+    for (auto& entry : box()->flatEntries) {
+        own(entry.second);
+    }
+    box()->sharedChildren = false;
+}
+
+void json::push_front(json const& x) {
+    if (!is_list()) {
+        throw json_exception{"Il json non è di tipo lista."};
+    }
+    pimpl->unpack();
+    pimpl->box()->listValue.push_front(json(x, pimpl->resource));
+    pimpl->adopt_children();
+    pimpl->touch();
+}
+
+template <typename J>
+void json::impl::append(J&& x) {
+    const impl& item = *x.pimpl;
+
+    // Una lista vuota diventa compatta se il primo elemento è un numero o un booleano
+    if (box()->packing == Packing::None && box()->listValue.isEmpty()) {
+        if (item.type == JsonType::Number) {
+            box()->packing = Packing::Numbers;
+            box()->packedNumbers.reserve(box()->listValue.capacity());
+        } else if (item.type == JsonType::Bool) {
+            box()->packing = Packing::Bools;
+            box()->packedBools.reserve(box()->listValue.capacity());
+        }
+    }
+
+    if (box()->packing == Packing::Numbers && item.type == JsonType::Number) {
+        box()->packedNumbers.push_back(item.numberValue);
+    } else if (box()->packing == Packing::Bools && item.type == JsonType::Bool) {
+        box()->packedBools.push_back(item.boolValue);
+    } else {
+        unpack();
+        const json* before = box()->listValue.begin();
+        if constexpr (std::is_lvalue_reference<J>::value) {
+            box()->listValue.push_back(json(x, resource)); // La copia usa la risorsa della lista
+        } else {
+            box()->listValue.push_back(std::move(x));
+        }
+        // Se il blocco è stato riallocato gli elementi spostati vanno ricollegati
+        if (box()->listValue.begin() != before) {
+            adopt_children();
+        } else {
+            box()->listValue.back().pimpl->parent = this;
+        }
+    }
+    touch();
+}
+
+void json::push_back(json const& x) {
+    if (!is_list()) {
+        throw json_exception{"Il json non è di tipo lista."};
+    }
+    pimpl->append(x);
+}
+
+void json::insert(std::pair<std::string, json> const& x) {
+    if (!is_dictionary()) {
+        throw json_exception{"Il json non è di tipo dizionario."};
+    }
+    pimpl->thaw();
+    pimpl->add_entry(std::make_pair(x.first, json(x.second, pimpl->resource)));
+}
+
+void json::impl::repack() {
+    if (box()->packing != Packing::None || box()->listValue.isEmpty()) {
+        return;
+    }
+    JsonType kind = box()->listValue[0].pimpl->type;
+    if (kind != JsonType::Number && kind != JsonType::Bool) {
+        return;
+    }
+    for (const json& item : box()->listValue) {
+        if (item.pimpl->type != kind) {
+            return;
+        }
+    }
+    if (kind == JsonType::Number) {
+        box()->packedNumbers.reserve(box()->listValue.size());
+        for (const json& item : box()->listValue) {
+            box()->packedNumbers.push_back(item.pimpl->numberValue);
+        }
+        box()->packing = Packing::Numbers;
+    } else {
+        box()->packedBools.reserve(box()->listValue.size());
+        for (const json& item : box()->listValue) {
+            box()->packedBools.push_back(item.pimpl->boolValue);
+        }
+        box()->packing = Packing::Bools;
+    }
+    // Stesso valore: hash e tratto di testo restano validi
+    box()->listValue = ArrayList<json>(resource);
+}
+
+void json::impl::freeze() {
+    if (type == JsonType::List) {
+        repack();
+        for (json& item : box()->listValue) {
+            item.pimpl->freeze();
+        }
+        return;
+    }
+    if (type != JsonType::Dict) {
+        return;
+    }
+    compact();
+    for (auto& entry : box()->flatEntries) {
+        entry.second.pimpl->freeze();
+    }
+}
+
+void json::impl::compact() {
+    if (!box()->frozen) {
+        box()->flatEntries.reserve(box()->dictValue.size());
+        for (auto it = box()->dictValue.begin(); it != box()->dictValue.end(); ++it) {
+            box()->flatEntries.push_back(std::move(*it));
+        }
+        box()->dictValue.clear();
+        adopt_children();
+
+        box()->flatIndex.reserve(box()->flatEntries.size());
+        for (std::size_t i = 0; i < box()->flatEntries.size(); ++i) {
+            box()->flatIndex.push_back(FlatKey{key_prefix(box()->flatEntries[i].first), static_cast<std::uint32_t>(i)});
+        }
+        // A parità di chiave vince l'inserimento più vecchio, come nella ricerca lineare
+        std::sort(box()->flatIndex.begin(), box()->flatIndex.end(), [this](const FlatKey& a, const FlatKey& b) {
+            return flat_less(a, b);
+        });
+        box()->frozen = true;
+    }
+}
+
+void json::impl::seal() {
+    if (type == JsonType::List) {
+        // Le liste compatte restano tali (le letture const non le espandono) e le espanse tornano compatte
+        repack();
+        for (json& item : box()->listValue) {
+            item.pimpl->seal();
+        }
+    } else if (type == JsonType::Dict) {
+        compact();
+        for (auto& entry : box()->flatEntries) {
+            entry.second.pimpl->seal();
+        }
+    }
+}
+
+void json::impl::thaw() {
+    if (!box()->frozen) {
+        return;
+    }
+    for (auto& entry : box()->flatEntries) {
+        box()->dictValue.push_back(std::move(entry));
+    }
+    box()->flatEntries = ArrayList<std::pair<std::string, json>>(resource);
+    box()->flatIndex = ArrayList<FlatKey>(resource);
+    box()->frozen = false;
+    adopt_children();
+}
+
+json* json::impl::flat_find(const std::string& key, std::uint64_t prefix) const {
+    std::size_t pos = flat_position(key, prefix);
+    return pos == std::string::npos ? nullptr : const_cast<json*>(&box()->flatEntries[pos].second);
+}
+
+std::size_t json::impl::flat_position(const std::string& key, std::uint64_t prefix) const {
+    std::size_t n = box()->flatIndex.size();
+    if (n == 0) {
+        return std::string::npos;
+    }
+    const FlatKey* base = box()->flatIndex.begin();
+    // lower_bound senza salti condizionali nel ciclo: la scelta è una selezione
+    while (n > 1) {
+        std::size_t half = n / 2;
+        const FlatKey& probe = base[half - 1];
+        bool less = probe.prefix < prefix ||
+                    (probe.prefix == prefix && box()->flatEntries[probe.index].first < key);
+        base = less ? base + half : base;
+        n -= half;
+    }
+    if (base->prefix < prefix || (base->prefix == prefix && box()->flatEntries[base->index].first < key)) {
+        ++base;
+    }
+    if (base == box()->flatIndex.end() || base->prefix != prefix || box()->flatEntries[base->index].first != key) {
+        return std::string::npos;
+    }
+    return base->index;
+}
+
+/*
+ * L'indice resta ordinato come in compact() (prefisso, chiave, posizione):
+ * la voce nuova viene inserita al suo posto e le posizioni successive a pos
+ * scalano di uno. Il costo è lineare ma fatto solo di spostamenti di memoria,
+ * senza riportare il dizionario alla lista collegata.
+ */
+void json::impl::flat_insert(std::size_t pos, std::pair<std::string, json>&& entry) {
+    FlatKey key{key_prefix(entry.first), static_cast<std::uint32_t>(pos)};
+    const std::pair<std::string, json>* before = box()->flatEntries.begin();
+    bool last = pos == box()->flatEntries.size();
+    if (!last) {
+        for (FlatKey& k : box()->flatIndex) {
+            k.index += k.index >= pos;
+        }
+    }
+    box()->flatEntries.insert(pos, std::move(entry));
+    if (!last || box()->flatEntries.begin() != before) {
+        adopt_children();
+    } else {
+        box()->flatEntries.back().second.pimpl->parent = this;
+    }
+    const FlatKey* at = std::lower_bound(box()->flatIndex.begin(), box()->flatIndex.end(), key, [this](const FlatKey& a, const FlatKey& b) {
+        return flat_less(a, b);
+    });
+    box()->flatIndex.insert(static_cast<std::size_t>(at - box()->flatIndex.begin()), key);
+    touch();
+}
+
+std::pair<std::string, json> json::impl::flat_erase(std::size_t pos) {
+    FlatKey key{key_prefix(box()->flatEntries[pos].first), static_cast<std::uint32_t>(pos)};
+    const FlatKey* at = std::lower_bound(box()->flatIndex.begin(), box()->flatIndex.end(), key, [this](const FlatKey& a, const FlatKey& b) {
+        return flat_less(a, b);
+    });
+    box()->flatIndex.erase(static_cast<std::size_t>(at - box()->flatIndex.begin()));
+    bool last = pos + 1 == box()->flatEntries.size();
+    if (!last) {
+        for (FlatKey& k : box()->flatIndex) {
+            k.index -= k.index > pos;
+        }
+    }
+    std::pair<std::string, json> entry(std::move(box()->flatEntries[pos]));
+    box()->flatEntries.erase(pos);
+    if (!last) {
+        adopt_children();
+    }
+    touch();
+    return entry;
+}
+
+json* json::impl::find_key(const std::string& key, std::uint64_t prefix) const {
+    if (box()->frozen) {
+        return flat_find(key, prefix);
+    }
+    for (auto node = box()->dictValue.get_head(); node; node = node->next) {
+        if (node->data.first == key) {
+            return &node->data.second;
+        }
+    }
+    return nullptr;
+}
+
+void json::freeze() {
+    pimpl->freeze();
+}
+
+std::size_t json::size() const {
+    switch (pimpl->type) {
+        case JsonType::List:
+            return pimpl->list_size();
+        case JsonType::Dict:
+            return pimpl->dict_size();
+        case JsonType::Null:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+bool json::empty() const {
+    return size() == 0;
+}
+
+std::size_t json::capacity() const {
+    if (is_list()) {
+        switch (pimpl->box()->packing) {
+            case impl::Packing::Numbers:
+                return pimpl->box()->packedNumbers.capacity();
+            case impl::Packing::Bools:
+                return pimpl->box()->packedBools.capacity();
+            default:
+                return pimpl->box()->listValue.capacity();
+        }
+    }
+    if (is_dictionary()) {
+        if (pimpl->box()->frozen) {
+            return pimpl->box()->flatEntries.capacity();
+        }
+        // I nodi del dizionario sono allocati uno alla volta: la capacità coincide con la dimensione
+        return pimpl->box()->dictValue.size();
+    }
+    throw json_exception{"Il json non è un contenitore."};
+}
+
+void json::reserve(std::size_t n) {
+    if (is_list()) {
+        switch (pimpl->box()->packing) {
+            case impl::Packing::Numbers:
+                pimpl->box()->packedNumbers.reserve(n);
+                break;
+            case impl::Packing::Bools:
+                pimpl->box()->packedBools.reserve(n);
+                break;
+            default:
+                pimpl->box()->listValue.reserve(n);
+                pimpl->adopt_children();
+        }
+    } else if (!is_dictionary()) {
+        throw json_exception{"Il json non è un contenitore."};
+    }
+}
+
+void json::impl::check_numbers() const {
+    if (type != JsonType::List) {
+        throw json_exception{"Il json non è di tipo lista."};
+    }
+    if (box()->packing == Packing::Numbers) {
+        return;
+    }
+    if (box()->packing == Packing::Bools && box()->packedBools.size() > 0) {
+        throw json_exception{"La lista contiene valori non numerici."};
+    }
+    for (const json& item : box()->listValue) {
+        if (item.pimpl->type != JsonType::Number) {
+            throw json_exception{"La lista contiene valori non numerici."};
+        }
+    }
+}
+
+std::size_t json::copy_numbers(double* out, std::size_t n) const {
+    pimpl->check_numbers();
+    std::size_t count = pimpl->list_size();
+    if (n < count) {
+        throw json_exception{"Buffer di destinazione troppo piccolo."};
+    }
+    if (pimpl->box()->packing == impl::Packing::Numbers) {
+        if (count) {
+            std::memcpy(out, pimpl->box()->packedNumbers.begin(), count * sizeof(double));
+        }
+        return count;
+    }
+    const json* items = pimpl->box()->listValue.begin();
+    for (std::size_t i = 0; i < count; ++i) {
+        out[i] = items[i].pimpl->numberValue;
+    }
+    return count;
+}
+
+/*
+ * Applica un kernel di riduzione a blocchi di numeri copiati in un buffer
+ * locale, per poter usare le istruzioni vettoriali.
+ */
+template <typename Kernel, typename Combine>
+static double reduce_numbers(const json& list, std::size_t count, Kernel kernel, Combine combine) {
+    const std::size_t block = 256;
+    double buffer[block];
+    double result = 0.0;
+    auto it = list.begin_list();
+    for (std::size_t done = 0; done < count; ) {
+        std::size_t n = count - done < block ? count - done : block;
+        for (std::size_t i = 0; i < n; ++i, ++it) {
+            buffer[i] = it->get_number();
+        }
+        double partial = kernel(buffer, n);
+        result = done == 0 ? partial : combine(result, partial);
+        done += n;
+    }
+    return result;
+}
+
+double json::sum_numbers() const {
+    pimpl->check_numbers();
+    if (pimpl->box()->packing == impl::Packing::Numbers) {
+        return sum_doubles(pimpl->box()->packedNumbers.begin(), pimpl->box()->packedNumbers.size());
+    }
+    return reduce_numbers(*this, pimpl->box()->listValue.size(), sum_doubles,
+                          [](double a, double b) { return a + b; });
+}
+
+double json::min_number() const {
+    pimpl->check_numbers();
+    if (pimpl->list_size() == 0) {
+        throw json_exception{"La lista è vuota."};
+    }
+    if (pimpl->box()->packing == impl::Packing::Numbers) {
+        return min_doubles(pimpl->box()->packedNumbers.begin(), pimpl->box()->packedNumbers.size());
+    }
+    return reduce_numbers(*this, pimpl->box()->listValue.size(), min_doubles,
+                          [](double a, double b) { return b < a ? b : a; });
+}
+
+double json::max_number() const {
+    pimpl->check_numbers();
+    if (pimpl->list_size() == 0) {
+        throw json_exception{"La lista è vuota."};
+    }
+    if (pimpl->box()->packing == impl::Packing::Numbers) {
+        return max_doubles(pimpl->box()->packedNumbers.begin(), pimpl->box()->packedNumbers.size());
+    }
+    return reduce_numbers(*this, pimpl->box()->listValue.size(), max_doubles,
+                          [](double a, double b) { return b > a ? b : a; });
+}
+
+struct json_path::segment {
+    std::string key;        // Chiave già decodificata (~0 e ~1)
+    std::uint64_t prefix;   // Primi 8 byte della chiave, per l'indice dei dizionari compattati
+    std::size_t index;      // Indice di lista, valido se numeric è vero
+    bool numeric;
+};
+
+json_path::json_path(std::string const& pointer) : segments(nullptr), count(0) {
+    if (pointer.empty()) {
+        return; // Il puntatore vuoto indica l'intero documento
+    }
+    if (pointer[0] != '/') {
+        throw json_exception{"JSON Pointer non valido: deve iniziare con '/'"};
+    }
+    std::size_t n = 0;
+    for (char c : pointer) {
+        if (c == '/') {
+            ++n;
+        }
+    }
+    segments = new segment[n];
+
+    std::size_t pos = 1;
+    while (count < n) {
+        std::size_t end = pointer.find('/', pos);
+        if (end == std::string::npos) {
+            end = pointer.size();
+        }
+        segment& seg = segments[count++];
+        for (std::size_t i = pos; i < end; ++i) {
+            if (pointer[i] != '~') {
+                seg.key += pointer[i];
+            } else if (i + 1 < end && (pointer[i + 1] == '0' || pointer[i + 1] == '1')) {
+                seg.key += pointer[++i] == '0' ? '~' : '/';
+            } else {
+                delete[] segments;
+                throw json_exception{"JSON Pointer non valido: sequenza di escape errata"};
+            }
+        }
+        seg.prefix = json::impl::key_prefix(seg.key);
+
+        // Un indice di lista è "0" oppure una sequenza di cifre senza zeri iniziali
+        seg.numeric = !seg.key.empty() && seg.key.size() <= 18 && (seg.key == "0" || seg.key[0] != '0');
+        seg.index = 0;
+        for (std::size_t i = 0; seg.numeric && i < seg.key.size(); ++i) {
+            if (seg.key[i] < '0' || seg.key[i] > '9') {
+                seg.numeric = false;
+            } else {
+                seg.index = seg.index * 10 + (seg.key[i] - '0');
+            }
+        }
+        pos = end + 1;
+    }
+}
+
+json_path::json_path(json_path const& other) : segments(nullptr), count(other.count) {
+    if (count) {
+        segments = new segment[count];
+        for (std::size_t i = 0; i < count; ++i) {
+            segments[i] = other.segments[i];
+        }
+    }
+}
+
+json_path::json_path(json_path&& other) noexcept : segments(other.segments), count(other.count) {
+    other.segments = nullptr;
+    other.count = 0;
+}
+
+json_path& json_path::operator=(json_path const& other) {
+    if (this != &other) {
+        json_path tmp(other);
+        *this = std::move(tmp);
+    }
+    return *this;
+}
+
+json_path& json_path::operator=(json_path&& other) noexcept {
+    if (this != &other) {
+        delete[] segments;
+        segments = other.segments;
+        count = other.count;
+        other.segments = nullptr;
+        other.count = 0;
+    }
+    return *this;
+}
+
+json_path::~json_path() {
+    delete[] segments;
+}
+
+std::size_t json_path::depth() const {
+    return count;
+}
+
+json_ref json_path::find(json const& doc) const {
+    const json* current = &doc;
+    for (std::size_t i = 0; i < count; ++i) {
+        const segment& seg = segments[i];
+        const json::impl& node = *current->pimpl;
+        if (node.type == JsonType::Dict) {
+            current = node.find_key(seg.key, seg.prefix);
+        } else if (node.type == JsonType::List && seg.numeric && seg.index < node.list_size()) {
+            if (node.box()->packing != json::impl::Packing::None) {
+                // Un elemento compatto è uno scalare: il percorso può solo finire qui
+                return i + 1 == count ? current->packed_item(seg.index) : json_ref();
+            }
+            current = &node.box()->listValue[seg.index];
+        } else {
+            current = nullptr;
+        }
+        if (!current) {
+            return json_ref();
+        }
+    }
+    return *current;
+}
+
+// Come la versione const, ma rende esclusivi i valori condivisi lungo il percorso
+json* json_path::find(json& doc) const {
+    json* found = find(doc, count);
+    if (found) {
+        found->pimpl->touch(); // Il valore trovato può essere modificato dal chiamante
+    }
+    return found;
+}
+
+json* json_path::find(json& doc, std::size_t n) const {
+    json* current = &doc;
+    for (std::size_t i = 0; i < n; ++i) {
+        const segment& seg = segments[i];
+        json::impl& node = *current->pimpl;
+        if (node.type == JsonType::Dict) {
+            current = node.find_key(seg.key, seg.prefix);
+        } else if (node.type == JsonType::List && seg.numeric && seg.index < node.list_size()) {
+            node.unpack();
+            current = &node.box()->listValue[seg.index];
+        } else {
+            current = nullptr;
+        }
+        if (!current) {
+            return nullptr;
+        }
+        node.own(*current);
+    }
+    return current;
+}
+
+json_ref json_path::evaluate(json const& doc) const {
+    if (json_ref found = find(doc)) {
+        return found;
+    }
+    throw json_exception{"JSON Pointer: percorso non presente nel documento"};
+}
+
+json& json_path::evaluate(json& doc) const {
+    if (json* found = find(doc)) {
+        return *found;
+    }
+    throw json_exception{"JSON Pointer: percorso non presente nel documento"};
+}
+
+std::size_t json_path::evaluate_all(json const& records, json_ref* out, std::size_t n) const {
+    if (!records.is_list()) {
+        throw json_exception{"Il json non è di tipo lista."};
+    }
+    const json::impl& list = *records.pimpl;
+    std::size_t done = 0;
+    for (; done < n && done < list.list_size(); ++done) {
+        if (list.box()->packing == json::impl::Packing::None) {
+            out[done] = find(list.box()->listValue[done]);
+        } else {
+            out[done] = count == 0 ? records.packed_item(done) : json_ref();
+        }
+    }
+    return done;
+}
+
+json_ref json::at_pointer(std::string const& pointer) const {
+    return json_path(pointer).evaluate(*this);
+}
+
+json& json::at_pointer(std::string const& pointer) {
+    return json_path(pointer).evaluate(*this);
+}
+
+/*
+ * JSON Patch (RFC 6902) e JSON Merge Patch (RFC 7396). Ogni modifica si
+ * riduce a tre operazioni elementari su un contenitore: inserire, rimuovere
+ * o sostituire il figlio in una posizione (indice della lista o ordine di
+ * inserimento nel dizionario). Con il log attivo ognuna registra l'inversa
+ * insieme al valore rimosso o sostituito, e rollback() ripercorre il log
+ * all'indietro riportando al loro posto gli stessi nodi.
+ */
+struct json::impl::patcher {
+    enum class Undo { Insert, Erase, Replace };
+    struct step {
+        Undo kind;
+        impl* container;        // nullptr per l'intero documento
+        std::size_t position;
+        std::string key;
+        json value;             // vuoto se il valore è passato al passo successivo (move)
+    };
+
+    // Posizione a cui si riferisce un percorso, o l'intero documento se container è nullptr
+    struct target {
+        impl* container;
+        std::size_t position;   // per le liste può valere size() ("-")
+        bool exists;
+        std::string key;
+    };
+
+    json& root;
+    bool steal;                 // i valori della patch possono essere spostati
+    bool logging;
+    ArrayList<step> log;
+    std::size_t current = 0;    // operazione in corso, per i messaggi di errore
+
+    patcher(json& doc, bool move_values, bool undo) : root(doc), steal(move_values), logging(undo) {}
+
+    [[noreturn]] void fail(const char* message) const {
+        throw json_exception{"JSON Patch: operazione " + std::to_string(current) + ": " + message};
+    }
+
+    // Il valore della patch da inserire nel documento, nella risorsa di memoria del documento
+    json incoming(const json& value) const {
+        if (steal && value.pimpl->refs == 1) {
+            return std::move(const_cast<json&>(value));
+        }
+        return json(value, root.pimpl->resource);
+    }
+
+    // Posizione della chiave in ordine di inserimento (la prima, se ripetuta), npos se manca
+    static std::size_t position(const impl& node, const std::string& key, std::uint64_t prefix) {
+        if (node.box()->frozen) {
+            return node.flat_position(key, prefix);
+        }
+        std::size_t pos = 0;
+        for (auto entry = node.box()->dictValue.get_head(); entry; entry = entry->next, ++pos) {
+            if (entry->data.first == key) {
+                return pos;
+            }
+        }
+        return std::string::npos;
+    }
+
+    static LinkedList<std::pair<std::string, json>>::Node* dict_node(const impl& node, std::size_t pos) {
+        auto entry = node.box()->dictValue.get_head();
+        while (pos-- && entry) {
+            entry = entry->next;
+        }
+        return entry;
+    }
+
+    // Il figlio in posizione pos (le liste compatte vengono espanse)
+    static json& slot(impl& node, std::size_t pos) {
+        if (node.type == JsonType::List) {
+            node.unpack();
+            return node.box()->listValue[pos];
+        }
+        return node.box()->frozen ? node.box()->flatEntries[pos].second : dict_node(node, pos)->data.second;
+    }
+
+    void insert_at(impl* node, std::size_t pos, std::string&& key, json&& value) {
+        if (node->type == JsonType::List) {
+            if (pos == node->list_size()) {
+                node->append(std::move(value));
+                return;
+            }
+            if (node->box()->packing == Packing::Numbers && value.pimpl->type == JsonType::Number) {
+                node->box()->packedNumbers.insert(pos, value.pimpl->numberValue);
+            } else {
+                node->unpack();
+                node->box()->listValue.insert(pos, std::move(value));
+                node->adopt_children();
+            }
+        } else if (node->box()->frozen) {
+            node->flat_insert(pos, std::make_pair(std::move(key), std::move(value)));
+            return;
+        } else {
+            auto at = pos == node->box()->dictValue.size() ? nullptr : dict_node(*node, pos);
+            at = node->box()->dictValue.insert_before(at, std::make_pair(std::move(key), std::move(value)));
+            at->data.second.pimpl->parent = node;
+        }
+        node->touch();
+    }
+
+    std::pair<std::string, json> erase_at(impl* node, std::size_t pos) {
+        if (node->box()->frozen) {
+            return node->flat_erase(pos);
+        }
+        std::pair<std::string, json> entry(std::string(), json(static_cast<impl*>(nullptr)));
+        if (node->type == JsonType::List) {
+            if (node->box()->packing == Packing::Numbers) {
+                entry.second = json(node->resource);
+                entry.second.pimpl->type = JsonType::Number;
+                entry.second.pimpl->numberValue = node->box()->packedNumbers[pos];
+                node->box()->packedNumbers.erase(pos);
+            } else {
+                node->unpack();
+                entry.second = std::move(node->box()->listValue[pos]);
+                node->box()->listValue.erase(pos);
+                node->adopt_children();
+            }
+        } else {
+            auto at = dict_node(*node, pos);
+            entry = std::move(at->data);
+            node->box()->dictValue.erase(at);
+        }
+        node->touch();
+        return entry;
+    }
+
+    // Sostituisce il valore e restituisce quello precedente
+    json replace_at(impl* node, std::size_t pos, json&& value) {
+        if (!node) {
+            // Il documento può essere il figlio di un altro json: il nuovo valore ne prende il posto
+            impl* parent = root.pimpl->parent;
+            json old(std::move(root));
+            root = std::move(value);
+            root.pimpl->parent = parent;
+            if (parent) {
+                parent->touch();
+            }
+            return old;
+        }
+        if (node->type == JsonType::List && node->box()->packing == Packing::Numbers &&
+            value.pimpl->type == JsonType::Number) {
+            json old(node->resource);
+            old.pimpl->type = JsonType::Number;
+            old.pimpl->numberValue = node->box()->packedNumbers[pos];
+            node->box()->packedNumbers[pos] = value.pimpl->numberValue;
+            node->touch();
+            return old;
+        }
+        json& child = slot(*node, pos);
+        json old(std::move(child));
+        child = std::move(value);
+        child.pimpl->parent = node;
+        node->touch();
+        return old;
+    }
+
+    void record(Undo kind, impl* node, std::size_t pos, std::string&& key, json&& value) {
+        if (logging) {
+            log.push_back(step{kind, node, pos, std::move(key), std::move(value)});
+        }
+    }
+
+    void rollback() {
+        json carried(static_cast<impl*>(nullptr)); // valore restituito dall'inversa di un add che seguiva un move
+        while (!log.isEmpty()) {
+            step& s = log.back();
+            switch (s.kind) {
+                case Undo::Erase:
+                    carried = std::move(erase_at(s.container, s.position).second);
+                    break;
+                case Undo::Insert:
+                    insert_at(s.container, s.position, std::move(s.key),
+                              std::move(s.value.pimpl ? s.value : carried));
+                    break;
+                case Undo::Replace:
+                    carried = replace_at(s.container, s.position, std::move(s.value));
+                    break;
+            }
+            log.pop_back();
+        }
+    }
+
+    /*
+     * Il bersaglio di path: il contenitore viene raggiunto rendendo esclusivi
+     * i nodi condivisi lungo la strada, l'ultimo segmento dà la posizione.
+     * adding ammette per le liste anche l'indice size() e "-".
+     */
+    target locate(const json_path& path, bool adding) {
+        if (path.count == 0) {
+            return target{nullptr, 0, true, std::string()};
+        }
+        json* parent = path.find(root, path.count - 1);
+        if (!parent) {
+            fail("percorso non presente nel documento");
+        }
+        impl* node = parent->pimpl;
+        const json_path::segment& seg = path.segments[path.count - 1];
+        if (node->type == JsonType::Dict) {
+            std::size_t pos = position(*node, seg.key, seg.prefix);
+            bool exists = pos != std::string::npos;
+            return target{node, exists ? pos : node->dict_size(), exists, seg.key};
+        }
+        if (node->type != JsonType::List) {
+            fail("il percorso attraversa un valore che non è un contenitore");
+        }
+        std::size_t size = node->list_size();
+        if (adding && seg.key == "-") {
+            return target{node, size, false, std::string()};
+        }
+        if (!seg.numeric || seg.index > size || (seg.index == size && !adding)) {
+            fail("indice di lista non valido o fuori dall'intervallo");
+        }
+        return target{node, seg.index, seg.index < size, std::string()};
+    }
+
+    target locate_existing(const json_path& path) {
+        target t = locate(path, false);
+        if (!t.exists) {
+            fail("percorso non presente nel documento");
+        }
+        return t;
+    }
+
+    // Il valore nel bersaglio; per le liste compatte viene materializzato in scratch
+    const json& peek(const target& t, json& scratch) {
+        if (!t.container) {
+            return root;
+        }
+        impl& node = *t.container;
+        if (node.type == JsonType::List && node.box()->packing != Packing::None) {
+            scratch.pimpl->type = node.box()->packing == Packing::Numbers ? JsonType::Number : JsonType::Bool;
+            scratch.pimpl->numberValue = node.box()->packing == Packing::Numbers ? node.box()->packedNumbers[t.position] : 0.0;
+            scratch.pimpl->boolValue = node.box()->packing == Packing::Bools && node.box()->packedBools.get(t.position);
+            return scratch;
+        }
+        return slot(node, t.position);
+    }
+
+    void add(const target& t, json&& value) {
+        if (t.container && !(t.container->type == JsonType::Dict && t.exists)) {
+            insert_at(t.container, t.position, std::string(t.key), std::move(value));
+            record(Undo::Erase, t.container, t.position, std::string(), json(static_cast<impl*>(nullptr)));
+        } else {
+            json old = replace_at(t.container, t.position, std::move(value));
+            record(Undo::Replace, t.container, t.position, std::string(), std::move(old));
+        }
+    }
+
+    static const json* member(const impl& op, const char* name) {
+        std::string key(name);
+        return op.find_key(key, key_prefix(key));
+    }
+
+    const std::string& string_member(const impl& op, const char* name) const {
+        const json* value = member(op, name);
+        if (!value || value->pimpl->type != JsonType::String) {
+            fail(name[0] == 'o' ? "manca il nome dell'operazione" : "manca un JSON Pointer (path o from)");
+        }
+        return value->pimpl->stringValue;
+    }
+
+    const json& value_member(const impl& op) const {
+        const json* value = member(op, "value");
+        if (!value) {
+            fail("manca value");
+        }
+        return *value;
+    }
+
+    void run(const impl& op) {
+        if (op.type != JsonType::Dict) {
+            fail("l'operazione non è un dizionario");
+        }
+        const std::string& name = string_member(op, "op");
+        const std::string& pointer = string_member(op, "path");
+        json_path path(pointer);
+        if (name == "add") {
+            add(locate(path, true), incoming(value_member(op)));
+        } else if (name == "remove") {
+            target t = locate_existing(path);
+            if (!t.container) {
+                fail("non si può rimuovere l'intero documento");
+            }
+            auto entry = erase_at(t.container, t.position);
+            record(Undo::Insert, t.container, t.position, std::move(entry.first), std::move(entry.second));
+        } else if (name == "replace") {
+            target t = locate_existing(path);
+            json old = replace_at(t.container, t.position, incoming(value_member(op)));
+            record(Undo::Replace, t.container, t.position, std::string(), std::move(old));
+        } else if (name == "move") {
+            const std::string& from_pointer = string_member(op, "from");
+            json_path from(from_pointer);
+            target source = locate_existing(from);
+            if (from_pointer == pointer) {
+                return;
+            }
+            if (!source.container || pointer.compare(0, from_pointer.size() + 1, from_pointer + "/") == 0) {
+                fail("non si può spostare un valore dentro se stesso");
+            }
+            auto entry = erase_at(source.container, source.position);
+            /*
+             * Il bersaglio va risolto dopo la rimozione (RFC 6902). Fino ad
+             * allora il valore resta nel log, così se il percorso non esiste
+             * rollback lo rimette al suo posto; poi passa all'add, e in caso
+             * di rollback lo restituisce l'inversa dell'add.
+             */
+            record(Undo::Insert, source.container, source.position, std::move(entry.first), std::move(entry.second));
+            target t = locate(path, true);
+            json value(std::move(log.back().value));
+            add(t, std::move(value));
+        } else if (name == "copy") {
+            json scratch(root.pimpl->resource);
+            json value(peek(locate_existing(json_path(string_member(op, "from"))), scratch), root.pimpl->resource);
+            add(locate(path, true), std::move(value));
+        } else if (name == "test") {
+            json scratch(root.pimpl->resource);
+            if (!equal(*peek(locate_existing(path), scratch).pimpl, *value_member(op).pimpl)) {
+                fail("test non superato");
+            }
+        } else {
+            fail("operazione sconosciuta");
+        }
+    }
+
+    void apply(const json& patch) {
+        const impl& ops = *patch.pimpl;
+        if (ops.type != JsonType::List || ops.box()->packing != Packing::None) {
+            throw json_exception{"JSON Patch: la patch deve essere una lista di operazioni"};
+        }
+        try {
+            for (current = 0; current < ops.box()->listValue.size(); ++current) {
+                run(*ops.box()->listValue[current].pimpl);
+            }
+        } catch (...) {
+            rollback();
+            throw;
+        }
+    }
+
+    // RFC 7396: null rimuove la chiave, un dizionario si fonde ricorsivamente, il resto sostituisce
+    void merge(json& target, const json& patch) {
+        const impl& changes = *patch.pimpl;
+        if (changes.type != JsonType::Dict) {
+            target = incoming(patch);
+            return;
+        }
+        if (target.pimpl->type != JsonType::Dict) {
+            target.set_dictionary();
+        }
+        impl& node = *target.pimpl;
+        changes.for_each_entry([this, &node](const std::pair<std::string, json>& entry) {
+            std::size_t pos = position(node, entry.first, key_prefix(entry.first));
+            const impl& value = *entry.second.pimpl;
+            if (value.type == JsonType::Null) {
+                if (pos != std::string::npos) {
+                    erase_at(&node, pos);
+                }
+            } else if (pos != std::string::npos) {
+                json& child = slot(node, pos);
+                node.own(child);
+                merge(child, entry.second);
+            } else {
+                // Un dizionario va fuso in uno vuoto per togliere i suoi null
+                json child = value.type == JsonType::Dict ? json(node.resource) : incoming(entry.second);
+                if (value.type == JsonType::Dict) {
+                    merge(child, entry.second);
+                }
+                insert_at(&node, node.dict_size(), std::string(entry.first), std::move(child));
+            }
+        });
+    }
+};
+
+void json::apply_patch(json const& patch) {
+    if (&patch == this) {
+        apply_patch(json(patch));
+        return;
+    }
+    impl::patcher(*this, false, true).apply(patch);
+}
+
+void json::apply_patch(json&& patch) {
+    impl::patcher(*this, true, true).apply(patch);
+}
+
+void json::apply_merge_patch(json const& patch) {
+    if (&patch == this) {
+        apply_merge_patch(json(patch));
+        return;
+    }
+    impl::patcher(*this, false, false).merge(*this, patch);
+}
+
+void json::apply_merge_patch(json&& patch) {
+    impl::patcher(*this, true, false).merge(*this, patch);
+}
+
+/*
+ * Albero delle chiavi richieste: ogni nodo corrisponde a un segmento di
+ * JSON Pointer; terminal indica che il sottoalbero va materializzato per intero.
+ */
+struct json_projection::node {
+    std::string key;
+    bool terminal = false;
+    ArrayList<node> children;
+
+    const node* child(const std::string& name) const {
+        const node* wildcard = nullptr;
+        for (const node& c : children) {
+            if (c.key == name) {
+                return &c;
+            }
+            if (c.key == "*") {
+                wildcard = &c;
+            }
+        }
+        return wildcard;
+    }
+
+    const node* child(std::size_t index) const {
+        const node* wildcard = nullptr;
+        for (const node& c : children) {
+            if (c.key == "*") {
+                wildcard = &c;
+            } else if (!c.key.empty() && c.key.size() <= 18 && (c.key == "0" || c.key[0] != '0') &&
+                       c.key.find_first_not_of("0123456789") == std::string::npos &&
+                       std::stoull(c.key) == index) {
+                return &c;
+            }
+        }
+        return wildcard;
+    }
+
+    // Analizza il valore in p.pos materializzando solo le parti richieste
+    bool parse(json::impl::parser& p, json& out) const {
+        if (terminal) {
+            return p.parse_value(out);
+        }
+        if (p.pos == p.end) {
+            return p.fail(json_parse_error::UnexpectedEnd);
+        }
+        json::impl& target = *out.pimpl;
+        if (*p.pos == '{') {
+            target.set_type(JsonType::Dict);
+            if (!p.enter()) {
+                return false;
+            }
+            ++p.pos;
+            p.skip_whitespace();
+            if (p.pos != p.end && *p.pos == '}') {
+                ++p.pos;
+                --p.depth;
+                return true;
+            }
+            std::string key;
+            for (bool done = false; !done;) {
+                p.skip_whitespace();
+                if (p.pos == p.end || *p.pos != '"') {
+                    return p.fail(p.pos == p.end ? json_parse_error::UnexpectedEnd
+                                                 : json_parse_error::InvalidDictionary);
+                }
+                key.clear();
+                if (!p.parse_string(key) || !p.expect(':', json_parse_error::InvalidDictionary)) {
+                    return false;
+                }
+                p.skip_whitespace();
+                if (const node* next = child(key)) {
+                    std::pair<std::string, json> entry(key, json(target.resource));
+                    if (!next->parse(p, entry.second)) {
+                        return false;
+                    }
+                    target.add_entry(std::move(entry));
+                } else if (!p.skip_value()) {
+                    return false;
+                }
+                if (!p.next_item('}', json_parse_error::InvalidDictionary, done)) {
+                    return false;
+                }
+            }
+            target.merge_duplicate_keys();
+            return true;
+        }
+        if (*p.pos == '[') {
+            target.set_type(JsonType::List);
+            if (!p.enter()) {
+                return false;
+            }
+            ++p.pos;
+            p.skip_whitespace();
+            if (p.pos != p.end && *p.pos == ']') {
+                ++p.pos;
+                --p.depth;
+                return true;
+            }
+            bool done = false;
+            for (std::size_t index = 0; !done; ++index) {
+                p.skip_whitespace();
+                // Gli elementi saltati restano come null, così gli indici non cambiano
+                json item(target.resource);
+                if (const node* next = child(index)) {
+                    if (!next->parse(p, item)) {
+                        return false;
+                    }
+                } else if (!p.skip_value()) {
+                    return false;
+                }
+                target.append(std::move(item));
+                if (!p.next_item(']', json_parse_error::InvalidList, done)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        // Un valore scalare dove si attendeva un contenitore non contiene nulla di richiesto
+        return p.skip_value();
+    }
+};
+
+json_projection::json_projection() : root(new node()) {}
+
+json_projection::json_projection(json_projection const& other) : root(new node(*other.root)) {}
+
+json_projection::json_projection(json_projection&& other) noexcept : root(other.root) {
+    other.root = nullptr;
+}
+
+json_projection& json_projection::operator=(json_projection const& other) {
+    if (this != &other) {
+        node* tmp = new node(*other.root);
+        delete root;
+        root = tmp;
+    }
+    return *this;
+}
+
+json_projection& json_projection::operator=(json_projection&& other) noexcept {
+    if (this != &other) {
+        delete root;
+        root = other.root;
+        other.root = nullptr;
+    }
+    return *this;
+}
+
+json_projection::~json_projection() {
+    delete root;
+}
+
+/*
+ * Inserisce i segmenti [i, n) sotto at. Un segmento "*" vale anche per le
+ * chiavi esatte già presenti, e una chiave esatta nuova eredita quanto già
+ * richiesto tramite "*", così a ogni passo basta seguire un solo figlio.
+ */
+void json_projection::insert(node& at, const std::string* segs, std::size_t n) {
+    if (n == 0) {
+        at.terminal = true;
+        return;
+    }
+    const std::string& key = segs[0];
+    node* wildcard = nullptr;
+    node* exact = nullptr;
+    for (node& c : at.children) {
+        if (c.key == "*") {
+            wildcard = &c;
+        }
+        if (c.key == key) {
+            exact = &c;
+        }
+    }
+    if (key == "*") {
+        for (node& c : at.children) {
+            if (c.key != "*") {
+                insert(c, segs + 1, n - 1);
+            }
+        }
+    }
+    if (!exact) {
+        node created = wildcard ? *wildcard : node();
+        created.key = key;
+        at.children.push_back(std::move(created));
+        exact = &at.children.back();
+    }
+    insert(*exact, segs + 1, n - 1);
+}
+
+void json_projection::add(std::string const& pointer) {
+    if (!pointer.empty() && pointer[0] != '/') {
+        throw json_exception{"JSON Pointer non valido: deve iniziare con '/'"};
+    }
+    ArrayList<std::string> segs;
+    std::size_t pos = 1;
+    while (pos <= pointer.size() && !pointer.empty()) {
+        std::size_t end = pointer.find('/', pos);
+        if (end == std::string::npos) {
+            end = pointer.size();
+        }
+        std::string key;
+        for (std::size_t i = pos; i < end; ++i) {
+            if (pointer[i] != '~') {
+                key += pointer[i];
+            } else if (i + 1 < end && (pointer[i + 1] == '0' || pointer[i + 1] == '1')) {
+                key += pointer[++i] == '0' ? '~' : '/';
+            } else {
+                throw json_exception{"JSON Pointer non valido: sequenza di escape errata"};
+            }
+        }
+        segs.push_back(std::move(key));
+        pos = end + 1;
+    }
+    insert(*root, segs.begin(), segs.size());
+}
+
+void json_projection::parse(std::string const& text, json& out) const {
+    json result(out.pimpl->resource);
+    json::impl::parser p(text.data(), text.data() + text.size());
+    p.skip_whitespace();
+    if (!root->parse(p, result) || !p.finish()) {
+        p.raise();
+    }
+    out = std::move(result);
+}
+
+// Passi sui nodi della lista delle coppie, per gli iteratori di dizionario definiti in json.hpp
+using dict_list = LinkedList<std::pair<std::string, json>>;
+
+const void* json::dict_next(const void* node) {
+    return static_cast<const dict_list::Node*>(node)->next;
+}
+
+const void* json::dict_prev(const void* node, const void* list) {
+    return node ? static_cast<const dict_list::Node*>(node)->prev : static_cast<const dict_list*>(list)->get_tail();
+}
+
+std::pair<std::string, json>& json::dict_entry(const void* node) {
+    return const_cast<dict_list::Node*>(static_cast<const dict_list::Node*>(node))->data;
+}
+
+json::list_iterator json::begin_list() {
+    if (!is_list()) {
+        throw json_exception{"ERRORE: L'oggetto json non è una lista"};
+    }
+    pimpl->unpack();
+    pimpl->touch(); // Gli iteratori permettono di modificare e spostare gli elementi
+    pimpl->own_children();
+    return list_iterator(pimpl->box()->listValue.begin());
+}
+
+json::const_list_iterator json::begin_list() const {
+    if (!is_list()) {
+        throw json_exception{"ERRORE: L'oggetto json non è una lista"};
+    }
+    if (pimpl->box()->packing != impl::Packing::None) {
+        return const_list_iterator(this, 0);
+    }
+    return const_list_iterator(pimpl->box()->listValue.begin());
+}
+
+json::list_iterator json::end_list() {
+    if (!is_list()) {
+        throw json_exception{"ERRORE: L'oggetto json non è una lista"};
+    }
+    pimpl->unpack();
+    pimpl->touch();
+    pimpl->own_children();
+    return list_iterator(pimpl->box()->listValue.end());
+}
+
+json::const_list_iterator json::end_list() const {
+    if (!is_list()) {
+        throw json_exception{"ERRORE: L'oggetto json non è una lista"};
+    }
+    if (pimpl->box()->packing != impl::Packing::None) {
+        return const_list_iterator(this, static_cast<std::ptrdiff_t>(pimpl->list_size()));
+    }
+    return const_list_iterator(pimpl->box()->listValue.end());
+}
+
+json_ref json::packed_item(std::size_t i) const {
+    if (pimpl->box()->packing == impl::Packing::Numbers) {
+        return json_ref(pimpl->box()->packedNumbers[i], json_ref::Kind::Number);
+    }
+    return json_ref(pimpl->box()->packedBools.get(i) ? 1.0 : 0.0, json_ref::Kind::Bool);
+}
+
+json_ref::json_ref() : node(nullptr), number(0.0), kind(Kind::Node) {}
+
+json_ref::json_ref(json const& value) : node(&value), number(0.0), kind(Kind::Node) {}
+
+json_ref::json_ref(double n, Kind k) : node(nullptr), number(n), kind(k) {}
+
+json_ref::operator bool() const {
+    return node || kind != Kind::Node;
+}
+
+json const* json_ref::get() const {
+    return node;
+}
+
+json const& json_ref::node_or_throw(const char* message) const {
+    if (kind != Kind::Node) {
+        throw json_exception{message};
+    }
+    if (!node) {
+        throw json_exception{"ERRORE: Riferimento json vuoto"};
+    }
+    return *node;
+}
+
+bool json_ref::is_list() const {
+    return node && node->is_list();
+}
+
+bool json_ref::is_dictionary() const {
+    return node && node->is_dictionary();
+}
+
+bool json_ref::is_string() const {
+    return node && node->is_string();
+}
+
+bool json_ref::is_number() const {
+    return kind == Kind::Number || (node && node->is_number());
+}
+
+bool json_ref::is_bool() const {
+    return kind == Kind::Bool || (node && node->is_bool());
+}
+
+bool json_ref::is_null() const {
+    return node && node->is_null();
+}
+
+double json_ref::get_number() const {
+    if (kind == Kind::Number) {
+        return number;
+    }
+    return node_or_throw("The JSON object is not a number.").get_number();
+}
+
+bool json_ref::get_bool() const {
+    if (kind == Kind::Bool) {
+        return number != 0.0;
+    }
+    return node_or_throw("The JSON object is not a boolean.").get_bool();
+}
+
+std::string const& json_ref::get_string() const {
+    return node_or_throw("The JSON object is not a string.").get_string();
+}
+
+std::size_t json_ref::size() const {
+    return kind != Kind::Node ? 1 : node_or_throw("").size();
+}
+
+bool json_ref::empty() const {
+    return size() == 0;
+}
+
+json const& json_ref::operator[](std::string const& key) const {
+    return node_or_throw("json object is not a dictionary")[key];
+}
+
+json::const_list_iterator json_ref::begin_list() const {
+    return node_or_throw("ERRORE: L'oggetto json non è una lista").begin_list();
+}
+
+json::const_list_iterator json_ref::end_list() const {
+    return node_or_throw("ERRORE: L'oggetto json non è una lista").end_list();
+}
+
+json::const_dictionary_iterator json_ref::begin_dictionary() const {
+    return node_or_throw("ERRORE: L'oggetto json non è un dizionario").begin_dictionary();
+}
+
+json::const_dictionary_iterator json_ref::end_dictionary() const {
+    return node_or_throw("ERRORE: L'oggetto json non è un dizionario").end_dictionary();
+}
+
+json json_ref::materialize() const {
+    json out;
+    if (kind == Kind::Number) {
+        out.set_number(number);
+    } else if (kind == Kind::Bool) {
+        out.set_bool(number != 0.0);
+    } else {
+        out = node_or_throw("");
+    }
+    return out;
+}
+
+json::dictionary_iterator json::begin_dictionary() {
+    if (!is_dictionary()) {
+        throw json_exception{"ERRORE: L'oggetto json non è un dizionario"};
+    }
+    pimpl->touch(); // Gli iteratori permettono di modificare i valori
+    pimpl->own_children();
+    if (pimpl->box()->frozen) {
+        return dictionary_iterator(pimpl->box()->flatEntries.begin());
+    }
+    return dictionary_iterator(pimpl->box()->dictValue.get_head(), &pimpl->box()->dictValue);
+}
+
+json::const_dictionary_iterator json::begin_dictionary() const {
+    if (!is_dictionary()) {
+        throw json_exception{"ERRORE: L'oggetto json non è un dizionario"};
+    }
+    if (pimpl->box()->frozen) {
+        return const_dictionary_iterator(pimpl->box()->flatEntries.begin());
+    }
+    return const_dictionary_iterator(pimpl->box()->dictValue.get_head(), &pimpl->box()->dictValue);
+}
+
+json::dictionary_iterator json::end_dictionary() {
+    if (!is_dictionary()) {
+        throw json_exception{"ERRORE: L'oggetto json non è un dizionario"};
+    }
+    pimpl->touch();
+    pimpl->own_children();
+    if (pimpl->box()->frozen) {
+        return dictionary_iterator(pimpl->box()->flatEntries.end());
+    }
+    return dictionary_iterator(nullptr, &pimpl->box()->dictValue);  // L'iteratore "past-the-end" è rappresentato da nullptr.
+}
+
+json::const_dictionary_iterator json::end_dictionary() const {
+    if (!is_dictionary()) {
+        throw json_exception{"ERRORE: L'oggetto json non è un dizionario"};
+    }
+    if (pimpl->box()->frozen) {
+        return const_dictionary_iterator(pimpl->box()->flatEntries.end());
+    }
+    return const_dictionary_iterator(nullptr, &pimpl->box()->dictValue);  // L'iteratore "past-the-end" è rappresentato da nullptr.
+}
+
+/*
+ * Serializzatore testuale. Scrive in un buffer di capacity byte che viene
+ * passato al sink quando è pieno, così ogni valore costa qualche copia in
+ * memoria e non una chiamata allo stream. Il formato di operator<<
+ * (legacy) usa separatori ", " e ": " e la precisione dello stream per i
+ * numeri; gli altri formati seguono json_write_options.
+ *
+ * Con un testo di origine (json_source_document) i nodi invariati vengono
+ * copiati dal testo invece che serializzati. Nei contenitori modificati gli
+ * elementi invariati consecutivi formano un unico tratto da copiare quando
+ * nel testo li separa solo la punteggiatura attesa (per i dizionari anche
+ * la chiave, che deve coincidere): una modifica in una lista lunga costa
+ * così poche copie e non una per elemento.
+ */
+struct json::impl::writer {
+    static const std::size_t capacity = std::size_t(1) << 16;
+
+    json_sink& sink;
+    json_write_options options;
+    bool legacy = false;
+    int precision = 6;
+    char* buffer;
+    std::size_t used = 0;
+    std::size_t depth = 0;
+
+    const char* text = nullptr;
+    std::uint32_t source = 0;
+    // Tratto di testo in attesa di essere copiato (run = false se vuoto)
+    bool run = false;
+    std::size_t from = 0;
+    std::size_t to = 0;
+
+    writer(json_sink& sink, const json_write_options& o) : sink(sink), options(o), buffer(new char[capacity]) {
+        if (options.canonical) {
+            options.indent = 0;
+            options.sort_keys = true;
+            options.ascii = false;
+        }
+    }
+    writer(const writer&) = delete;
+    writer& operator=(const writer&) = delete;
+    ~writer() { delete[] buffer; }
+
+    void put(const char* data, std::size_t n) {
+        if (n > capacity - used) {
+            drain();
+            if (n >= capacity) {
+                sink.write(data, n);
+                return;
+            }
+        }
+        std::memcpy(buffer + used, data, n);
+        used += n;
+    }
+
+    void put(char c) {
+        if (used == capacity) {
+            drain();
+        }
+        buffer[used++] = c;
+    }
+
+    void put(const char* literal) {
+        put(literal, std::strlen(literal));
+    }
+
+    // Consegna al sink il contenuto del buffer
+    void drain() {
+        if (used) {
+            sink.write(buffer, used);
+            used = 0;
+        }
+    }
+
+    void newline() {
+        static const char spaces[] = "                                                                ";
+        put('\n');
+        for (std::size_t n = depth * options.indent; n;) {
+            std::size_t chunk = std::min(n, sizeof(spaces) - 1);
+            put(spaces, chunk);
+            n -= chunk;
+        }
+    }
+
+    void separator() {
+        put(legacy ? ", " : ",", legacy ? 2 : 1);
+        if (options.indent) {
+            newline();
+        }
+    }
+
+    void key(const std::string& name) {
+        string(name);
+        put(legacy || options.indent ? ": " : ":", legacy || options.indent ? 2 : 1);
+    }
+
+    void escape(unsigned cp) {
+        static const char hex[] = "0123456789abcdef";
+        char out[6] = {'\\', 'u', hex[(cp >> 12) & 0xF], hex[(cp >> 8) & 0xF], hex[(cp >> 4) & 0xF], hex[cp & 0xF]};
+        put(out, 6);
+    }
+
+    // Stringa tra virgolette: escape per '"', '\\' e i caratteri di controllo, e con ascii per i non ASCII
+    void string(const std::string& value) {
+        put('"');
+        const char* p = value.data();
+        const char* e = p + value.size();
+        const char* plain = p;
+        while (p != e) {
+            unsigned char c = static_cast<unsigned char>(*p);
+            if (c >= 0x20 && c != '"' && c != '\\' && (c < 0x80 || !options.ascii)) {
+                ++p;
+                continue;
+            }
+            put(plain, static_cast<std::size_t>(p - plain));
+            if (c >= 0x80) {
+                p = escape_utf8(p, e);
+            } else {
+                switch (c) {
+                    case '"': put("\\\"", 2); break;
+                    case '\\': put("\\\\", 2); break;
+                    case '\b': put("\\b", 2); break;
+                    case '\f': put("\\f", 2); break;
+                    case '\n': put("\\n", 2); break;
+                    case '\r': put("\\r", 2); break;
+                    case '\t': put("\\t", 2); break;
+                    default: escape(c); break;
+                }
+                ++p;
+            }
+            plain = p;
+        }
+        put(plain, static_cast<std::size_t>(p - plain));
+        put('"');
+    }
+
+    // Un carattere UTF-8 come \uXXXX (coppia di surrogati oltre U+FFFF); U+FFFD se la sequenza non è valida
+    const char* escape_utf8(const char* p, const char* e) {
+        unsigned char c = static_cast<unsigned char>(*p);
+        std::size_t length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        unsigned cp = length == 4 ? c & 0x07u : length == 3 ? c & 0x0Fu : c & 0x1Fu;
+        bool valid = length > 1 && c <= 0xF4 && static_cast<std::size_t>(e - p) >= length;
+        for (std::size_t i = 1; valid && i < length; ++i) {
+            unsigned char next = static_cast<unsigned char>(p[i]);
+            valid = (next & 0xC0) == 0x80;
+            cp = (cp << 6) | (next & 0x3Fu);
+        }
+        if (!valid || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF) ||
+            cp < (length == 2 ? 0x80u : length == 3 ? 0x800u : 0x10000u)) {
+            escape(0xFFFD);
+            return p + 1;
+        }
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            escape(0xD800 + (cp >> 10));
+            escape(0xDC00 + (cp & 0x3FF));
+        } else {
+            escape(cp);
+        }
+        return p + length;
+    }
+
+    void number(double value) {
+        char digits[64];
+        if (legacy) {
+            int n = std::snprintf(digits, sizeof(digits), "%.*g", precision, value);
+            put(digits, static_cast<std::size_t>(n));
+            return;
+        }
+        if (!std::isfinite(value)) {
+            throw json_exception{"Serializzazione: NaN e infiniti non sono rappresentabili in JSON"};
+        }
+        if (!options.canonical) {
+            put(digits, static_cast<std::size_t>(std::to_chars(digits, digits + sizeof(digits), value).ptr - digits));
+            return;
+        }
+        if (value == 0) {
+            put('0');  // anche -0
+            return;
+        }
+        // Forma di Number.prototype.toString (RFC 8785, 3.2.2.3): cifre più corte, poi posizione del punto
+        char* last = std::to_chars(digits, digits + sizeof(digits) - 1, value, std::chars_format::scientific).ptr;
+        *last = '\0';
+        char* mark = std::find(digits, last, 'e');
+        int exponent = std::atoi(mark + 1);
+        char* first = digits;
+        if (*first == '-') {
+            put('-');
+            ++first;
+        }
+        char significant[20];
+        int k = 0;
+        for (char* c = first; c != mark; ++c) {
+            if (*c != '.') {
+                significant[k++] = *c;
+            }
+        }
+        int n = exponent + 1;
+        if (k <= n && n <= 21) {
+            put(significant, static_cast<std::size_t>(k));
+            for (int i = k; i < n; ++i) {
+                put('0');
+            }
+        } else if (0 < n && n <= 21) {
+            put(significant, static_cast<std::size_t>(n));
+            put('.');
+            put(significant + n, static_cast<std::size_t>(k - n));
+        } else if (-6 < n && n <= 0) {
+            put("0.", 2);
+            for (int i = n; i < 0; ++i) {
+                put('0');
+            }
+            put(significant, static_cast<std::size_t>(k));
+        } else {
+            put(significant[0]);
+            if (k > 1) {
+                put('.');
+                put(significant + 1, static_cast<std::size_t>(k - 1));
+            }
+            int written = std::snprintf(digits, sizeof(digits), "e%c%d", n - 1 < 0 ? '-' : '+', std::abs(n - 1));
+            put(digits, static_cast<std::size_t>(written));
+        }
+    }
+
+    /*
+     * Ordine per unità UTF-16 (JCS). Differisce dall'ordine dei byte UTF-8
+     * solo tra U+E000..U+FFFF (primo byte EE o EF) e i caratteri oltre U+FFFF
+     * (primo byte F0..F4), che in UTF-16 iniziano con un surrogato minore.
+     */
+    static bool utf16_less(const std::string& a, const std::string& b) {
+        std::size_t n = std::min(a.size(), b.size());
+        for (std::size_t i = 0; i < n; ++i) {
+            unsigned char x = static_cast<unsigned char>(a[i]);
+            unsigned char y = static_cast<unsigned char>(b[i]);
+            if (x != y) {
+                if ((x == 0xEE || x == 0xEF) && y >= 0xF0) {
+                    return false;
+                }
+                if ((y == 0xEE || y == 0xEF) && x >= 0xF0) {
+                    return true;
+                }
+                return x < y;
+            }
+        }
+        return a.size() < b.size();
+    }
+
+    bool clean(const impl& node) const {
+        return source && node.sourceId == source;
+    }
+
+    void flush() {
+        if (run) {
+            put(text + from, to - from);
+            run = false;
+        }
+    }
+
+    // true se text[first, last) contiene solo la virgola tra due elementi (e la chiave attesa)
+    bool separator_only(std::size_t first, std::size_t last, const std::string* name) const {
+        const char* p = text + first;
+        const char* e = text + last;
+        auto skip = [&p, e] {
+            while (p != e && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+                ++p;
+            }
+        };
+        skip();
+        if (p == e || *p++ != ',') {
+            return false;
+        }
+        skip();
+        if (name) {
+            // Le chiavi con escape nel testo non si possono confrontare byte per byte
+            if (name->find_first_of("\"\\") != std::string::npos || e - p < static_cast<std::ptrdiff_t>(name->size()) + 2 ||
+                *p != '"' || std::memcmp(p + 1, name->data(), name->size()) != 0 || p[name->size() + 1] != '"') {
+                return false;
+            }
+            p += name->size() + 2;
+            skip();
+            if (p == e || *p++ != ':') {
+                return false;
+            }
+            skip();
+        }
+        return p == e;
+    }
+
+    void open(char c) {
+        put(c);
+        ++depth;
+    }
+
+    // Prima di un elemento di un contenitore: separatore, o a capo per il primo in modo indentato
+    void element(bool first) {
+        if (!first) {
+            separator();
+        } else if (options.indent) {
+            newline();
+        }
+    }
+
+    // Scrive un elemento di un contenitore, estendendo il tratto in attesa se possibile
+    void item(const impl& node, bool first, const std::string* name) {
+        if (run && clean(node) && node.sourceBegin >= to && separator_only(to, node.sourceBegin, name)) {
+            to = node.source_end();
+            return;
+        }
+        flush();
+        element(first);
+        if (name) {
+            key(*name);
+        }
+        if (clean(node)) {
+            run = true;
+            from = node.sourceBegin;
+            to = node.source_end();
+        } else {
+            write(node);
+        }
+    }
+
+    // Chiusura di un contenitore non vuoto
+    void close(char c) {
+        flush();
+        --depth;
+        if (options.indent) {
+            newline();
+        }
+        put(c);
+    }
+
+    using entry = std::pair<std::string, json>;
+
+    // Coppie di un dizionario nell'ordine in cui vanno scritte (serve solo con sort_keys)
+    ArrayList<const entry*> order(const impl& node) const {
+        ArrayList<const entry*> entries;
+        entries.reserve(node.dict_size());
+        if (node.box()->frozen && options.sort_keys && !options.canonical) {
+            // flatIndex ordina già le chiavi per byte (a parità di chiave, in ordine di inserimento)
+            for (const FlatKey& key : node.box()->flatIndex) {
+                entries.push_back(&node.box()->flatEntries[key.index]);
+            }
+            return entries;
+        }
+        node.for_each_entry([&entries](const entry& e) { entries.push_back(&e); });
+        if (options.sort_keys) {
+            bool canonical = options.canonical;
+            std::stable_sort(entries.begin(), entries.end(), [canonical](const entry* a, const entry* b) {
+                return canonical ? utf16_less(a->first, b->first) : a->first < b->first;
+            });
+        }
+        return entries;
+    }
+
+    // Elementi [first, last) di una lista, con i separatori che li precedono
+    void list_items(const impl& node, std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; ++i) {
+            if (node.box()->packing == Packing::None) {
+                item(*node.box()->listValue[i].pimpl, i == 0, nullptr);
+            } else if (node.box()->packing == Packing::Numbers) {
+                element(i == 0);
+                number(node.box()->packedNumbers[i]);
+            } else {
+                element(i == 0);
+                put(node.box()->packedBools.get(i) ? "true" : "false");
+            }
+        }
+    }
+
+    void dict_items(const entry* const* entries, std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; ++i) {
+            item(*entries[i]->second.pimpl, i == 0, &entries[i]->first);
+        }
+    }
+
+    void write(const impl& node) {
+        if (clean(node)) {
+            put(text + node.sourceBegin, node.sourceLength);
+            return;
+        }
+        switch (node.type) {
+            case JsonType::String:
+                string(node.stringValue);
+                break;
+            case JsonType::Bool:
+                put(node.boolValue ? "true" : "false");
+                break;
+            case JsonType::Number:
+                number(node.numberValue);
+                break;
+            case JsonType::Null:
+                put("null", 4);
+                break;
+            case JsonType::List:
+                if (node.list_size() == 0) {
+                    put("[]", 2);
+                    break;
+                }
+                open('[');
+                list_items(node, 0, node.list_size());
+                close(']');
+                break;
+            case JsonType::Dict:
+                if (node.dict_size() == 0) {
+                    put("{}", 2);
+                    break;
+                }
+                open('{');
+                if (options.sort_keys) {
+                    ArrayList<const entry*> entries = order(node);
+                    dict_items(entries.begin(), 0, entries.size());
+                } else {
+                    bool first = true;
+                    node.for_each_entry([this, &first](const entry& e) {
+                        item(*e.second.pimpl, first, &e.first);
+                        first = false;
+                    });
+                }
+                close('}');
+                break;
+        }
     }
 };
 
-struct json::dictionary_iterator
-{
-    friend class json;
+namespace {
 
-private:
-    LinkedList<std::pair<std::string, json>>::Node *current;
+struct ostream_sink : json_sink {
+    std::ostream& os;
 
-    dictionary_iterator(LinkedList<std::pair<std::string, json>>::Node *node) : current(node) {}
+    explicit ostream_sink(std::ostream& os) : os(os) {}
 
-public:
-    dictionary_iterator() : current(nullptr) {}
+    void write(const char* data, std::size_t size) override {
+        os.write(data, static_cast<std::streamsize>(size));
+    }
+};
 
-    dictionary_iterator &operator++()
-    {
-        if (current)
-        {
-            current = current->next;
+struct string_sink : json_sink {
+    std::string& out;
+
+    explicit string_sink(std::string& out) : out(out) {}
+
+    void write(const char* data, std::size_t size) override {
+        out.append(data, size);
+    }
+};
+
+}
+
+/*
+ * Serializzazione parallela di json::write. Il peso di un sottoalbero
+ * (un'unità per nodo, più una ogni 32 byte di stringa) viene stimato da un
+ * campione dei figli, perché una visita completa costerebbe quasi quanto
+ * la serializzazione; dal peso della radice si ricava la dimensione dei
+ * blocchi. Una stima sbagliata costa solo parallelismo, non correttezza.
+ * I contenitori pesanti vengono poi
+ * scomposti: parentesi, separatori e chiavi dei figli pesanti diventano
+ * pezzi di "colla" scritti subito, mentre i figli leggeri consecutivi sono
+ * raggruppati in intervalli di circa un blocco. Ogni intervallo viene
+ * scritto da un thread con un writer proprio, alla profondità che avrebbe
+ * nel documento, in una stringa separata; il thread chiamante consegna i
+ * pezzi al sink nell'ordine del documento e intanto aiuta il pool.
+ * I thread non prendono pezzi oltre window posizioni dall'ultimo
+ * consegnato, così la memoria in sospeso non cresce con il documento.
+ * I pezzi vengono distribuiti da un contatore comune invece che da code
+ * per thread con furto del lavoro: hanno peso simile e il contatore basta.
+ */
+struct json::impl::splitter {
+    using entry = writer::entry;
+
+    enum class Kind { Glue, Node, List, Dict };
+
+    struct piece {
+        Kind kind = Kind::Glue;
+        const impl* node = nullptr;
+        const entry* const* entries = nullptr;
+        std::size_t depth = 0;
+        std::size_t first = 0;
+        std::size_t last = 0;
+        std::string out;
+        bool done = false;
+    };
+
+    // Stringa in cui un writer del pool scrive il pezzo corrente
+    struct buffer_sink : json_sink {
+        std::string out;
+
+        void write(const char* data, std::size_t size) override {
+            out.append(data, size);
         }
-        return *this;
+    };
+
+    static const std::size_t none = static_cast<std::size_t>(-1);
+    static const std::size_t min_chunk = std::size_t(1) << 12;
+    static const std::size_t max_chunk = std::size_t(1) << 16;
+    static const std::size_t max_level = 16;
+    static const std::size_t samples = 8;
+    static const std::size_t sample_levels = 4;
+
+    json_sink& sink;
+    const json_write_options& options;
+    std::size_t threads;
+    std::size_t window;
+    std::size_t chunk = 0;
+
+    ArrayList<piece> pieces;
+    LinkedList<ArrayList<const entry*>> orders; // Chiavi dei dizionari scomposti, nell'ordine di scrittura
+    buffer_sink pending;
+    writer glue;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::size_t next = 0;     // Primo pezzo non ancora preso da un thread
+    std::size_t consumed = 0; // Pezzi già consegnati al sink
+    bool abort = false;
+    std::exception_ptr error;
+    ArrayList<std::thread> workers;
+
+    splitter(json_sink& sink, const json_write_options& options, std::size_t threads)
+        : sink(sink), options(options), threads(threads), window(threads * 4), glue(pending, options) {}
+
+    splitter(const splitter&) = delete;
+    splitter& operator=(const splitter&) = delete;
+
+    ~splitter() {
+        stop();
     }
 
-    dictionary_iterator operator++(int)
-    {
-        dictionary_iterator temp = *this;
-        ++(*this);
-        return temp;
+    // Peso stimato di node: dei contenitori con più di samples figli se ne
+    // pesano samples, e dopo levels livelli conta solo il numero di figli
+    static std::size_t weight(const impl& node, std::size_t levels = sample_levels) {
+        std::size_t n = 0;
+        std::size_t seen = 0;
+        std::size_t sum = 0;
+        switch (node.type) {
+            case JsonType::String:
+                return 1 + node.stringValue.size() / 32;
+            case JsonType::List:
+                n = node.list_size();
+                if (node.box()->packing != Packing::None || levels == 0) {
+                    return 1 + n;
+                }
+                for (; seen < n && seen < samples; ++seen) {
+                    std::size_t i = n <= samples ? seen : seen * n / samples;
+                    sum += weight(*node.box()->listValue[i].pimpl, levels - 1);
+                }
+                break;
+            case JsonType::Dict:
+                n = node.dict_size();
+                if (levels == 0) {
+                    return 1 + n;
+                }
+                if (node.box()->frozen) {
+                    for (; seen < n && seen < samples; ++seen) {
+                        const entry& e = node.box()->flatEntries[n <= samples ? seen : seen * n / samples];
+                        sum += e.first.size() / 32 + weight(*e.second.pimpl, levels - 1);
+                    }
+                } else {
+                    for (auto e = node.box()->dictValue.get_head(); e && seen < samples; e = e->next, ++seen) {
+                        sum += e->data.first.size() / 32 + weight(*e->data.second.pimpl, levels - 1);
+                    }
+                }
+                break;
+            default:
+                return 1;
+        }
+        return 1 + (seen ? sum * n / seen : 0);
     }
 
-    std::pair<std::string, json> &operator*() const
-    {
-        if (current)
+    static bool splittable(const impl& node) {
+        return (node.type == JsonType::List && node.list_size()) || (node.type == JsonType::Dict && node.dict_size());
+    }
+
+    // Chiude la colla in attesa in un pezzo già pronto
+    void seal() {
+        glue.drain();
+        if (!pending.out.empty()) {
+            piece p;
+            p.out = std::move(pending.out);
+            p.done = true;
+            pieces.push_back(std::move(p));
+            pending.out.clear();
+        }
+    }
+
+    void add(Kind kind, const impl& node, const entry* const* entries, std::size_t first, std::size_t last) {
+        seal();
+        piece p;
+        p.kind = kind;
+        p.node = &node;
+        p.entries = entries;
+        p.depth = glue.depth;
+        p.first = first;
+        p.last = last;
+        pieces.push_back(std::move(p));
+    }
+
+    void range(const impl& node, const entry* const* entries, std::size_t first, std::size_t last) {
+        if (first < last) {
+            add(entries ? Kind::Dict : Kind::List, node, entries, first, last);
+        }
+    }
+
+    static const impl* child(const impl& node, const entry* const* entries, std::size_t i) {
+        if (entries) {
+            return entries[i]->second.pimpl;
+        }
+        return node.box()->packing == Packing::None ? node.box()->listValue[i].pimpl : nullptr;
+    }
+
+    // Scompone un contenitore pesante nei pezzi che ne compongono l'uscita
+    void decompose(const impl& node, std::size_t level) {
+        const entry* const* entries = nullptr;
+        std::size_t n = node.list_size();
+        if (node.type == JsonType::Dict) {
+            orders.push_back(glue.order(node));
+            entries = orders.back().begin();
+            n = orders.back().size();
+        }
+        glue.open(entries ? '{' : '[');
+        // Con molti figli se ne pesa un campione: se nessuno è pesante i
+        // figli vengono raggruppati per numero, senza visitarli tutti
+        if (n > samples) {
+            std::size_t sum = 0;
+            std::size_t heaviest = 0;
+            for (std::size_t k = 0; k < samples; ++k) {
+                const impl* c = child(node, entries, k * n / samples);
+                std::size_t cw = c ? weight(*c) : 1;
+                sum += cw;
+                heaviest = std::max(heaviest, cw);
+            }
+            if (heaviest < chunk) {
+                std::size_t step = std::max<std::size_t>(1, chunk * samples / sum);
+                for (std::size_t first = 0; first < n; first += step) {
+                    range(node, entries, first, n - first > step ? first + step : n);
+                }
+                glue.close(entries ? '}' : ']');
+                return;
+            }
+        }
+        std::size_t first = 0;
+        std::size_t w = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            const impl* c = child(node, entries, i);
+            std::size_t cw = c ? weight(*c) : 1;
+            if (cw < chunk) {
+                w += cw;
+                if (w >= chunk) {
+                    range(node, entries, first, i + 1);
+                    first = i + 1;
+                    w = 0;
+                }
+                continue;
+            }
+            // Figlio pesante: la sua chiave va nella colla e il figlio viene scomposto a sua volta
+            range(node, entries, first, i);
+            glue.element(i == 0);
+            if (entries) {
+                glue.key(entries[i]->first);
+            }
+            if (splittable(*c) && level + 1 < max_level) {
+                decompose(*c, level + 1);
+            } else {
+                add(Kind::Node, *c, nullptr, 0, 0);
+            }
+            first = i + 1;
+            w = 0;
+        }
+        range(node, entries, first, n);
+        glue.close(entries ? '}' : ']');
+    }
+
+    // Prepara i pezzi; false se il documento è troppo piccolo per dividerlo
+    bool plan(const impl& root) {
+        std::size_t total = weight(root);
+        if (!splittable(root) || total < 2 * min_chunk) {
+            return false;
+        }
+        chunk = total / (threads * 8);
+        if (chunk < min_chunk) {
+            chunk = min_chunk;
+        } else if (chunk > max_chunk) {
+            chunk = max_chunk;
+        }
+        decompose(root, 0);
+        seal();
+        return true;
+    }
+
+    // Primo pezzo da scrivere che rientra nella finestra, o none (con il lock preso)
+    std::size_t claim() {
+        while (next < pieces.size() && pieces[next].kind == Kind::Glue) {
+            ++next;
+        }
+        if (next < pieces.size() && next < consumed + window) {
+            return next++;
+        }
+        return none;
+    }
+
+    // Scrive il pezzo j fuori dal lock, che viene ripreso prima di tornare
+    void execute(std::unique_lock<std::mutex>& lock, std::size_t j, writer& w, buffer_sink& target) {
+        lock.unlock();
+        piece& p = pieces[j];
+        std::exception_ptr failure;
+        try {
+            w.depth = p.depth;
+            if (p.kind == Kind::Node) {
+                w.write(*p.node);
+            } else if (p.kind == Kind::List) {
+                w.list_items(*p.node, p.first, p.last);
+            } else {
+                w.dict_items(p.entries, p.first, p.last);
+            }
+            w.drain();
+            p.out = std::move(target.out);
+            target.out.clear();
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        lock.lock();
+        if (failure) {
+            if (!error) {
+                error = failure;
+            }
+            abort = true;
+        } else {
+            p.done = true;
+        }
+        ready.notify_all();
+    }
+
+    void work() {
+        buffer_sink target;
+        writer w(target, options);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!abort) {
+            std::size_t j = claim();
+            if (j != none) {
+                execute(lock, j, w, target);
+            } else if (next == pieces.size()) {
+                return;
+            } else {
+                ready.wait(lock);
+            }
+        }
+    }
+
+    void stop() {
         {
-            return current->data;
+            std::lock_guard<std::mutex> lock(mutex);
+            abort = true;
+        }
+        ready.notify_all();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+        workers.clear();
+    }
+
+    void write() {
+        workers.reserve(threads - 1);
+        for (std::size_t i = 1; i < threads; ++i) {
+            workers.push_back(std::thread([this] { work(); }));
+        }
+        buffer_sink target;
+        writer w(target, options);
+        std::unique_lock<std::mutex> lock(mutex);
+        for (std::size_t i = 0; i < pieces.size() && !abort; ++i) {
+            while (!pieces[i].done && !abort) {
+                std::size_t j = claim();
+                if (j != none) {
+                    execute(lock, j, w, target);
+                } else {
+                    ready.wait(lock);
+                }
+            }
+            if (abort) {
+                break;
+            }
+            lock.unlock();
+            // Consegna a blocchi della stessa dimensione del caso sequenziale
+            std::string& text = pieces[i].out;
+            std::size_t block = writer::capacity;
+            for (std::size_t at = 0; at < text.size(); at += block) {
+                sink.write(text.data() + at, std::min(block, text.size() - at));
+            }
+            std::string().swap(text);
+            lock.lock();
+            consumed = i + 1;
+            ready.notify_all();
+        }
+        lock.unlock();
+        stop();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+std::ostream& operator<<(std::ostream& os, json const& rhs) {
+    ostream_sink sink(os);
+    json::impl::writer out(sink, json_write_options());
+    out.legacy = true;
+    out.precision = static_cast<int>(os.precision());
+    out.write(*rhs.pimpl);
+    out.drain();
+    return os;
+}
+
+void json::write(json_sink& sink, json_write_options const& options) const {
+    std::size_t threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    if (threads > 1) {
+        impl::splitter parallel(sink, options, threads);
+        if (parallel.plan(*pimpl)) {
+            parallel.write();
+            return;
+        }
+    }
+    impl::writer out(sink, options);
+    out.write(*pimpl);
+    out.drain();
+}
+
+void json::write(std::ostream& os, json_write_options const& options) const {
+    ostream_sink sink(os);
+    write(sink, options);
+}
+
+std::string json::to_string(json_write_options const& options) const {
+    std::string out;
+    string_sink sink(out);
+    write(sink, options);
+    return out;
+}
+
+/*
+ * Anello di buffer del json_file_sink: il serializzatore riempie
+ * buffers[filled % size], il thread di scrittura svuota quelli tra written
+ * e filled. Non c'è un percorso io_uring: servirebbe liburing o la
+ * gestione diretta delle code del kernel, e per un solo file scritto in
+ * sequenza un thread con writev basta a sovrapporre serializzazione e I/O.
+ */
+struct json_file_sink::state {
+    struct buffer {
+        char* data;
+        std::size_t used;
+    };
+
+    std::string path;
+    std::size_t capacity;
+    ArrayList<buffer> buffers;
+    std::size_t filled = 0;  // Buffer consegnati al thread (contatore crescente)
+    std::size_t written = 0; // Buffer scritti, o scartati dopo un errore
+    bool closing = false;
+    bool closed = false;
+    int error = 0; // errno della prima scrittura fallita
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::thread worker;
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = -1;
+    ArrayList<struct iovec> parts;
+#else
+    std::ofstream out;
+#endif
+
+    state(std::string const& path, std::size_t capacity, std::size_t count) : path(path), capacity(capacity) {
+#if defined(__unix__) || defined(__APPLE__)
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw json_exception{"Impossibile aprire il file json: " + path};
+        }
+        parts.reserve(count);
+#else
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw json_exception{"Impossibile aprire il file json: " + path};
+        }
+#endif
+        try {
+            buffers.reserve(count);
+            for (std::size_t i = 0; i < count; ++i) {
+                buffers.push_back(buffer{nullptr, 0});
+                buffers.back().data = new char[capacity];
+            }
+            worker = std::thread([this] { run(); });
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    state(const state&) = delete;
+    state& operator=(const state&) = delete;
+
+    ~state() {
+        release();
+    }
+
+    void release() {
+        for (buffer& b : buffers) {
+            delete[] b.data;
+        }
+        buffers.clear();
+#if defined(__unix__) || defined(__APPLE__)
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+#endif
+    }
+
+    buffer& current() {
+        return buffers[filled % buffers.size()];
+    }
+
+    // Scrive i buffer [from, to); restituisce 0 o l'errno dell'errore
+    int store(std::size_t from, std::size_t to) {
+#if defined(__unix__) || defined(__APPLE__)
+        parts.clear();
+        for (std::size_t i = from; i < to; ++i) {
+            buffer& b = buffers[i % buffers.size()];
+            parts.push_back(iovec{b.data, b.used});
+        }
+        std::size_t at = 0;
+        while (at < parts.size()) {
+            int count = static_cast<int>(std::min<std::size_t>(parts.size() - at, 64));
+            ssize_t done = ::writev(fd, &parts[at], count);
+            if (done < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno;
+            }
+            // Scrittura parziale: si riparte dal primo byte non scritto
+            std::size_t left = static_cast<std::size_t>(done);
+            while (at < parts.size() && left >= parts[at].iov_len) {
+                left -= parts[at].iov_len;
+                ++at;
+            }
+            if (left) {
+                parts[at].iov_base = static_cast<char*>(parts[at].iov_base) + left;
+                parts[at].iov_len -= left;
+            }
+        }
+        return 0;
+#else
+        for (std::size_t i = from; i < to; ++i) {
+            buffer& b = buffers[i % buffers.size()];
+            out.write(b.data, static_cast<std::streamsize>(b.used));
+        }
+        out.flush();
+        return out ? 0 : EIO;
+#endif
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            ready.wait(lock, [this] { return written < filled || closing; });
+            if (written == filled) {
+                return;
+            }
+            std::size_t from = written;
+            std::size_t to = filled;
+            bool failed = error != 0;
+            lock.unlock();
+            int result = failed ? 0 : store(from, to);
+            lock.lock();
+            if (result && !error) {
+                error = result;
+            }
+            written = to;
+            ready.notify_all();
         }
-        throw json_exception{"ERRORE: Tentativo di dereferenziare un iteratore vuoto"};
     }
 
-    std::pair<std::string, json> *operator->() const
-    {
-        return &operator*();
+    // Passa al thread il buffer corrente e attende che il successivo sia libero
+    void submit() {
+        std::unique_lock<std::mutex> lock(mutex);
+        ++filled;
+        ready.notify_all();
+        ready.wait(lock, [this] { return filled - written < buffers.size(); });
+        current().used = 0;
     }
 
-    bool operator==(const dictionary_iterator &other) const
-    {
-        return current == other.current;
+    void raise() const {
+        throw json_exception{"Errore di scrittura del file json " + path + ": " + std::strerror(error)};
     }
 
-    bool operator!=(const dictionary_iterator &other) const
-    {
-        return !(*this == other);
+    // Segnala un errore del thread di scrittura avvenuto dalla chiamata precedente
+    void check() {
+        if (closed) {
+            throw json_exception{"Scrittura su un json_file_sink chiuso: " + path};
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error) {
+            raise();
+        }
     }
 };
 
-struct json::const_list_iterator
-{
-    friend class json;
-
-private:
-    LinkedList<json>::Node *current;
+json_file_sink::json_file_sink(std::string const& path, std::size_t buffer_size, std::size_t buffers)
+    : st(new state(path, buffer_size ? buffer_size : 1, buffers < 2 ? 2 : buffers)) {}
 
-    const_list_iterator(LinkedList<json>::Node *node) : current(node) {}
-
-public:
-    const_list_iterator() : current(nullptr) {}
+json_file_sink::~json_file_sink() {
+    try {
+        close();
+    } catch (...) {
+    }
+    delete st;
+}
 
-    const_list_iterator &operator++()
-    {
-        if (current)
-        {
-            current = current->next;
+void json_file_sink::write(const char* data, std::size_t size) {
+    st->check();
+    while (size) {
+        state::buffer& b = st->current();
+        std::size_t n = std::min(size, st->capacity - b.used);
+        std::memcpy(b.data + b.used, data, n);
+        b.used += n;
+        data += n;
+        size -= n;
+        if (b.used == st->capacity) {
+            st->submit();
         }
-        return *this;
     }
+}
 
-    const_list_iterator operator++(int)
+void json_file_sink::close() {
+    if (st->closed) {
+        return;
+    }
+    st->closed = true;
     {
-        const_list_iterator temp = *this;
-        ++(*this);
-        return temp;
+        std::lock_guard<std::mutex> lock(st->mutex);
+        if (st->current().used) {
+            ++st->filled;
+        }
+        st->closing = true;
+    }
+    st->ready.notify_all();
+    st->worker.join();
+#if defined(__unix__) || defined(__APPLE__)
+    if (::close(st->fd) != 0 && !st->error) {
+        st->error = errno;
     }
+    st->fd = -1;
+#else
+    st->out.close();
+#endif
+    if (st->error) {
+        st->raise();
+    }
+}
 
-    const json &operator*() const
-    {
-        if (current)
-        {
-            return current->data;
+/*
+ * Legge da is i caratteri di un solo valore json, senza consumare nulla
+ * dopo la sua fine: contenitori e stringhe finiscono alla parentesi o alle
+ * virgolette di chiusura, numeri e letterali al primo carattere che non ne
+ * può far parte. La validazione vera resta al parser; qui basta trovare
+ * dove il valore finisce. Restituisce false se prima del valore lo stream
+ * contiene solo spazi.
+ */
+static bool read_value_text(std::istream& is, std::string& text) {
+    auto space = [](int c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+    auto scalar = [](int c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+               c == '+' || c == '-' || c == '.';
+    };
+    std::streambuf* in = is.rdbuf();
+    const int eof = std::char_traits<char>::eof();
+    int c = in->sgetc();
+    while (c != eof && space(c)) {
+        c = in->snextc();
+    }
+    if (c == eof) {
+        is.setstate(std::ios::eofbit | std::ios::failbit);
+        return false;
+    }
+    std::size_t depth = 0;
+    bool quoted = false;
+    bool escaped = false;
+    for (;; c = in->sgetc()) {
+        if (c == eof) {
+            is.setstate(std::ios::eofbit);
+            return true;
+        }
+        char ch = static_cast<char>(c);
+        if (quoted) {
+            in->sbumpc();
+            text += ch;
+            if (escaped) {
+                escaped = false;
+            } else if (ch == '\\') {
+                escaped = true;
+            } else if (ch == '"') {
+                quoted = false;
+                if (depth == 0) {
+                    return true;
+                }
+            }
+            continue;
+        }
+        if (depth == 0 && !text.empty() && !scalar(c)) {
+            return true; // Fine di un numero o di un letterale
+        }
+        in->sbumpc();
+        text += ch;
+        if (ch == '"') {
+            quoted = true;
+        } else if (ch == '[' || ch == '{') {
+            ++depth;
+        } else if (ch == ']' || ch == '}') {
+            if (depth <= 1) {
+                return true;
+            }
+            --depth;
+        } else if (depth == 0 && !scalar(c)) {
+            return true; // Carattere non valido: l'errore lo segnala il parser
         }
-        throw json_exception{"ERRORE: Tentativo di dereferenziare un iteratore vuoto"};
     }
+}
 
-    const json *operator->() const
-    {
-        return &operator*();
+std::istream& operator>>(std::istream& lhs, json& rhs) {
+    std::istream::sentry guard(lhs, true);
+    if (!guard) {
+        return lhs;
+    }
+    std::string text;
+    if (!read_value_text(lhs, text)) {
+        return lhs;
+    }
+    json::impl::parser p(text.data(), text.data() + text.size());
+    json result(rhs.pimpl->resource);
+    p.skip_whitespace();
+    if (!p.parse_value(result) || !p.finish()) {
+        p.raise();
     }
+    rhs = std::move(result);
+    return lhs;
+}
 
-    bool operator==(const const_list_iterator &other) const
-    {
-        return current == other.current;
+/*
+ * Hash strutturale. Ogni tipo parte da un seme diverso; le liste combinano
+ * gli elementi in ordine, i dizionari sommano il contributo di ogni coppia,
+ * così l'hash non dipende dall'ordine delle chiavi. Gli elementi delle liste
+ * compatte hanno lo stesso hash dei json scalari corrispondenti.
+ */
+static std::uint64_t hash_mix(std::uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+static std::uint64_t hash_bytes(const std::string& text) {
+    std::uint64_t h = 0x9E3779B97F4A7C15ull ^ text.size();
+    std::size_t i = 0;
+    for (; i + 8 <= text.size(); i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, text.data() + i, 8);
+        h = hash_mix(h ^ word);
     }
+    std::uint64_t last = 0;
+    std::memcpy(&last, text.data() + i, text.size() - i);
+    return hash_mix(h ^ last);
+}
 
-    bool operator!=(const const_list_iterator &other) const
-    {
-        return !(*this == other);
+static std::uint64_t hash_number(double value) {
+    if (value == 0.0) {
+        value = 0.0; // 0.0 == -0.0, quindi devono avere lo stesso hash
     }
-};
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return hash_mix(bits ^ 0x1000000000000001ull);
+}
 
-struct json::const_dictionary_iterator
-{
-    friend class json;
+static std::uint64_t hash_bool(bool value) {
+    return hash_mix(value ? 0x2000000000000003ull : 0x2000000000000002ull);
+}
 
-private:
-    LinkedList<std::pair<std::string, json>>::Node *current;
+/*
+ * Gli elementi scambiati tramite gli iteratori o i riferimenti (std::sort,
+ * std::swap) passano per json temporanei e possono perdere il genitore.
+ * Il contenitore è già stato invalidato dall'accesso modificabile, e la sua
+ * cache torna valida solo qui: ricollegare i figli esclusivi mentre se ne
+ * calcola l'hash garantisce che touch() su un figlio la raggiunga di nuovo.
+ */
+void json::impl::relink(const json& child) const {
+    if (child.pimpl->refs == 1) {
+        child.pimpl->parent = const_cast<impl*>(this);
+    }
+}
 
-    const_dictionary_iterator(LinkedList<std::pair<std::string, json>>::Node *node) : current(node) {}
+std::uint64_t json::impl::hash() const {
+    if (hashValid) {
+        return hashValue;
+    }
+    std::uint64_t h = 0;
+    switch (type) {
+        case JsonType::Null:
+            h = hash_mix(0x3000000000000001ull);
+            break;
+        case JsonType::Number:
+            h = hash_number(numberValue);
+            break;
+        case JsonType::Bool:
+            h = hash_bool(boolValue);
+            break;
+        case JsonType::String:
+            h = hash_bytes(stringValue) ^ 0x4000000000000001ull;
+            break;
+        case JsonType::List: {
+            std::size_t n = list_size();
+            h = 0x5000000000000001ull ^ n;
+            for (std::size_t i = 0; i < n; ++i) {
+                std::uint64_t item = box()->packing == Packing::Numbers ? hash_number(box()->packedNumbers[i])
+                                   : box()->packing == Packing::Bools ? hash_bool(box()->packedBools.get(i))
+                                   : box()->listValue[i].pimpl->hash();
+                if (box()->packing == Packing::None) {
+                    relink(box()->listValue[i]);
+                }
+                h = hash_mix(h + item);
+            }
+            break;
+        }
+        case JsonType::Dict: {
+            std::uint64_t sum = 0;
+            for_each_entry([this, &sum](const std::pair<std::string, json>& entry) {
+                sum += hash_mix(hash_bytes(entry.first) + 0x9E3779B97F4A7C15ull * entry.second.pimpl->hash());
+                relink(entry.second);
+            });
+            h = hash_mix(sum ^ 0x6000000000000001ull ^ dict_size());
+            break;
+        }
+    }
+    hashValue = h;
+    hashValid = true;
+    return h;
+}
 
-public:
-    const_dictionary_iterator() : current(nullptr) {}
+std::uint64_t json::hash() const {
+    return pimpl->hash();
+}
 
-    const_dictionary_iterator &operator++()
-    {
-        if (current)
-        {
-            current = current->next;
+bool json::impl::equal(const impl& a, const impl& b) {
+    if (&a == &b) {
+        return true;
+    }
+    if (a.type != b.type) {
+        return false;
+    }
+    // Con entrambi gli hash già calcolati, hash diversi escludono l'uguaglianza in O(1)
+    if (a.hashValid && b.hashValid && a.hashValue != b.hashValue) {
+        return false;
+    }
+    switch (a.type) {
+        case JsonType::Null:
+            return true;
+        case JsonType::Number:
+            return a.numberValue == b.numberValue;
+        case JsonType::Bool:
+            return a.boolValue == b.boolValue;
+        case JsonType::String:
+            return a.stringValue == b.stringValue;
+        case JsonType::List: {
+            std::size_t n = a.list_size();
+            if (n != b.list_size()) {
+                return false;
+            }
+            for (std::size_t i = 0; i < n; ++i) {
+                if (!list_item_equal(a, b, i)) {
+                    return false;
+                }
+            }
+            return true;
         }
-        return *this;
+        case JsonType::Dict:
+            return dict_equal(a, b);
     }
+    return false;
+}
 
-    const_dictionary_iterator operator++(int)
-    {
-        const_dictionary_iterator temp = *this;
-        ++(*this);
-        return temp;
+bool json::impl::list_item_equal(const impl& a, const impl& b, std::size_t i) {
+    if (a.box()->packing == Packing::None && b.box()->packing == Packing::None) {
+        return equal(*a.box()->listValue[i].pimpl, *b.box()->listValue[i].pimpl);
     }
-
-    const std::pair<std::string, json> &operator*() const
-    {
-        if (current)
-        {
-            return current->data;
+    // Almeno uno dei due è compatto: l'elemento è un numero o un booleano
+    const impl& packed = a.box()->packing != Packing::None ? a : b;
+    const impl& other = a.box()->packing != Packing::None ? b : a;
+    if (packed.box()->packing == Packing::Numbers) {
+        double value = packed.box()->packedNumbers[i];
+        if (other.box()->packing == Packing::Numbers) {
+            return other.box()->packedNumbers[i] == value;
         }
-        throw json_exception{"ERRORE: Tentativo di dereferenziare un iteratore vuoto"};
+        if (other.box()->packing == Packing::Bools) {
+            return false;
+        }
+        const impl& item = *other.box()->listValue[i].pimpl;
+        return item.type == JsonType::Number && item.numberValue == value;
     }
-
-    const std::pair<std::string, json> *operator->() const
-    {
-        return &operator*();
+    bool value = packed.box()->packedBools.get(i);
+    if (other.box()->packing == Packing::Bools) {
+        return other.box()->packedBools.get(i) == value;
     }
-
-    bool operator==(const const_dictionary_iterator &other) const
-    {
-        return current == other.current;
+    if (other.box()->packing == Packing::Numbers) {
+        return false;
     }
+    const impl& item = *other.box()->listValue[i].pimpl;
+    return item.type == JsonType::Bool && item.boolValue == value;
+}
 
-    bool operator!=(const const_dictionary_iterator &other) const
-    {
-        return !(*this == other);
+/*
+ * Uguaglianza dei dizionari indipendente dall'ordine: le coppie di b sono
+ * ordinate per chiave (per un dizionario compattato l'indice è già pronto) e
+ * ogni coppia di a deve trovare in b una coppia con la stessa chiave e lo
+ * stesso valore non ancora usata. Con chiavi ripetute il confronto è quindi
+ * tra multinsiemi di coppie, coerente con l'hash.
+ */
+bool json::impl::dict_equal(const impl& a, const impl& b) {
+    using entry_type = std::pair<std::string, json>;
+    std::size_t n = a.dict_size();
+    if (n != b.dict_size()) {
+        return false;
     }
-};
-
-json::list_iterator json::begin_list() {
-    if (!is_list()) {
-        throw json_exception{"ERRORE: L'oggetto json non è una lista"};
+    ArrayList<const entry_type*> sorted;
+    sorted.reserve(n);
+    if (b.box()->frozen) {
+        for (const FlatKey& key : b.box()->flatIndex) {
+            sorted.push_back(&b.box()->flatEntries[key.index]);
+        }
+    } else {
+        b.for_each_entry([&sorted](const entry_type& entry) {
+            sorted.push_back(&entry);
+        });
+        std::stable_sort(sorted.begin(), sorted.end(), [](const entry_type* x, const entry_type* y) {
+            return x->first < y->first;
+        });
+    }
+    // Nell'indice dei compattati l'ordine è per prefisso e poi per chiave, quindi si confronta allo stesso modo
+    auto less = [&b](const entry_type* x, const std::string& key) {
+        if (b.box()->frozen) {
+            std::uint64_t px = key_prefix(x->first), pk = key_prefix(key);
+            if (px != pk) {
+                return px < pk;
+            }
+        }
+        return x->first < key;
+    };
+    ArrayList<bool> used;
+    used.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        used.push_back(false);
     }
-    return list_iterator(pimpl->listValue.get_head());
+    bool result = true;
+    a.for_each_entry([&](const entry_type& entry) {
+        if (!result) {
+            return;
+        }
+        const entry_type** first = std::lower_bound(sorted.begin(), sorted.end(), entry.first, less);
+        for (const entry_type** it = first; it != sorted.end() && (*it)->first == entry.first; ++it) {
+            std::size_t index = static_cast<std::size_t>(it - sorted.begin());
+            if (!used[index] && equal(*entry.second.pimpl, *(*it)->second.pimpl)) {
+                used[index] = true;
+                return;
+            }
+        }
+        result = false;
+    });
+    return result;
 }
 
-json::const_list_iterator json::begin_list() const {
-    if (!is_list()) {
-        throw json_exception{"ERRORE: L'oggetto json non è una lista"};
-    }
-    return const_list_iterator(pimpl->listValue.get_head());
+bool operator==(json const& lhs, json const& rhs) {
+    return json::impl::equal(*lhs.pimpl, *rhs.pimpl);
 }
 
-json::list_iterator json::end_list() {
-    if (!is_list()) {
-        throw json_exception{"ERRORE: L'oggetto json non è una lista"};
-    }
-    return list_iterator(nullptr);  // L'iteratore "past-the-end" è rappresentato da nullptr.
+bool operator!=(json const& lhs, json const& rhs) {
+    return !(lhs == rhs);
 }
 
-json::const_list_iterator json::end_list() const {
-    if (!is_list()) {
-        throw json_exception{"ERRORE: L'oggetto json non è una lista"};
+std::uint64_t json_ref::hash() const {
+    if (kind == Kind::Number) {
+        return hash_number(number);
     }
-    return const_list_iterator(nullptr);  // L'iteratore "past-the-end" è rappresentato da nullptr.
+    if (kind == Kind::Bool) {
+        return hash_bool(number != 0.0);
+    }
+    return node_or_throw("").hash();
 }
 
-json::dictionary_iterator json::begin_dictionary() {
-    if (!is_dictionary()) {
-        throw json_exception{"ERRORE: L'oggetto json non è un dizionario"};
+bool operator==(json_ref lhs, json_ref rhs) {
+    if (!lhs || !rhs) {
+        return !lhs && !rhs;
     }
-    return dictionary_iterator(pimpl->dictValue.get_head());
+    if (lhs.get() && rhs.get()) {
+        return *lhs.get() == *rhs.get();
+    }
+    if (lhs.is_number() && rhs.is_number()) {
+        return lhs.get_number() == rhs.get_number();
+    }
+    if (lhs.is_bool() && rhs.is_bool()) {
+        return lhs.get_bool() == rhs.get_bool();
+    }
+    return false;
 }
 
-json::const_dictionary_iterator json::begin_dictionary() const {
-    if (!is_dictionary()) {
-        throw json_exception{"ERRORE: L'oggetto json non è un dizionario"};
+bool operator!=(json_ref lhs, json_ref rhs) {
+    return !(lhs == rhs);
+}
+
+std::ostream& operator<<(std::ostream& lhs, json_ref rhs) {
+    if (const json* node = rhs.get()) {
+        return lhs << *node;
     }
-    return const_dictionary_iterator(pimpl->dictValue.get_head());
+    return lhs << rhs.materialize();
 }
 
-json::dictionary_iterator json::end_dictionary() {
-    if (!is_dictionary()) {
-        throw json_exception{"ERRORE: L'oggetto json non è un dizionario"};
+// Uguaglianza bit a bit: 0 e -0 si serializzano in modo diverso
+static bool same_number(double a, double b) {
+    return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+bool json::impl::identical(const impl& a, const impl& b) {
+    if (&a == &b) {
+        return true;
+    }
+    if (a.type != b.type || a.hash() != b.hash()) {
+        return false;
+    }
+    switch (a.type) {
+        case JsonType::Null:
+            return true;
+        case JsonType::Number:
+            return same_number(a.numberValue, b.numberValue);
+        case JsonType::Bool:
+            return a.boolValue == b.boolValue;
+        case JsonType::String:
+            return a.stringValue == b.stringValue;
+        case JsonType::List: {
+            // Liste uguali in rappresentazioni diverse restano distinte: si perde solo un po' di condivisione
+            std::size_t n = a.list_size();
+            if (a.box()->packing != b.box()->packing || n != b.list_size()) {
+                return false;
+            }
+            for (std::size_t i = 0; i < n; ++i) {
+                bool same = a.box()->packing == Packing::Numbers ? same_number(a.box()->packedNumbers[i], b.box()->packedNumbers[i])
+                          : a.box()->packing == Packing::Bools ? a.box()->packedBools.get(i) == b.box()->packedBools.get(i)
+                          : identical(*a.box()->listValue[i].pimpl, *b.box()->listValue[i].pimpl);
+                if (!same) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case JsonType::Dict: {
+            if (a.dict_size() != b.dict_size()) {
+                return false;
+            }
+            // Confronto in ordine di inserimento, qualunque sia il layout dei due dizionari
+            auto node = b.box()->dictValue.get_head();
+            std::size_t i = 0;
+            bool same = true;
+            a.for_each_entry([&](const std::pair<std::string, json>& entry) {
+                const std::pair<std::string, json>& other = b.box()->frozen ? b.box()->flatEntries[i++] : node->data;
+                if (!b.box()->frozen) {
+                    node = node->next;
+                }
+                same = same && entry.first == other.first && identical(*entry.second.pimpl, *other.second.pimpl);
+            });
+            return same;
+        }
     }
-    return dictionary_iterator(nullptr);  // L'iteratore "past-the-end" è rappresentato da nullptr.
+    return false;
 }
 
-json::const_dictionary_iterator json::end_dictionary() const {
-    if (!is_dictionary()) {
-        throw json_exception{"ERRORE: L'oggetto json non è un dizionario"};
+void json::impl::interner::intern(json& slot, impl& owner) {
+    impl* node = slot.pimpl;
+    /*
+     * Un rappresentante può diventare condiviso in seguito, e parent non
+     * identifica tutti i suoi contenitori: si segnalano quindi tutti i
+     * contenitori dei nodi che entrano nella tabella.
+     */
+    owner.box()->sharedChildren = true;
+    impl* canon = table.insert(node->hash(), node, identical);
+    if (canon == node) {
+        return;
+    }
+    ++canon->refs;
+    if (node->refs == 1) {
+        saved += node->released_bytes();
     }
-    return const_dictionary_iterator(nullptr);  // L'iteratore "past-the-end" è rappresentato da nullptr.
+    slot.pimpl = canon;
+    release(node);
 }
 
-std::ostream& operator<<(std::ostream& os, json const& rhs) {
-    if (rhs.is_string()) {
-        os << "\"" << rhs.get_string() << "\"";
-    } else if (rhs.is_bool()) {
-        os << (rhs.get_bool() ? "true" : "false");
-    } else if (rhs.is_number()) {
-        os << rhs.get_number();
-    } else if (rhs.is_null()) {
-        os << "null";
-    } else if (rhs.is_list()) {
-        os << "[";
-        bool first = true;
-        for (auto it = rhs.begin_list(); it != rhs.end_list(); ++it) {
-            if (!first) {
-                os << ", ";
-            }
-            os << *it;
-            first = false;
-        }
-        os << "]";
-    } else if (rhs.is_dictionary()) {
-        os << "{";
-        bool first = true;
-        for (auto it = rhs.begin_dictionary(); it != rhs.end_dictionary(); ++it) {
-            if (!first) {
-                os << ", ";
-            }
-            os << "\"" << it->first << "\": " << it->second;
-            first = false;
-        }
-        os << "}";
+void json::impl::interner::walk(impl& node) {
+    auto visit = [this, &node](json& slot) {
+        // I nodi già condivisi sono già stati deduplicati: non si scende al loro interno
+        if (slot.pimpl->refs == 1) {
+            slot.pimpl->parent = &node;
+            walk(*slot.pimpl);
+        }
+        intern(slot, node);
+    };
+    if (!node.box()) {
+        return;
+    }
+    for (json& item : node.box()->listValue) {
+        visit(item);
+    }
+    for (auto entry = node.box()->dictValue.get_head(); entry; entry = entry->next) {
+        visit(entry->data.second);
+    }
+    for (auto& entry : node.box()->flatEntries) {
+        visit(entry.second);
     }
+}
 
-    return os;
+std::size_t json::deduplicate() {
+    impl::interner shared;
+    shared.walk(*pimpl);
+    return shared.saved;
 }
 
-std::istream& operator>>(std::istream& lhs, json& rhs) {
-    rhs = json();
+/*
+ * Differenza strutturale. I sottoalberi con lo stesso hash (in cache dopo
+ * il primo calcolo) sono saltati senza generare operazioni; gli altri
+ * vengono visitati in parallelo. Le chiavi dei dizionari si abbinano con
+ * una tabella indicizzata dall'hash della chiave, le liste con il diff di
+ * Myers sugli hash degli elementi, limitato a max_edits modifiche: oltre il
+ * limite gli elementi si abbinano per posizione. Gli hash degli elementi e
+ * le tracce del diff (al più max_edits^2 valori) sono liberati prima di
+ * scendere nei figli: resta solo lo script, un byte per elemento.
+ */
+struct json::impl::differ {
+    static const std::size_t max_edits = 1024;
+    // Confronti di elementi oltre i quali il diff di Myers riduce max_edits
+    static const std::size_t max_work = std::size_t(1) << 26;
+
+    using entry = std::pair<std::string, json>;
+
+    // Posizioni (in ordine di inserimento) delle chiavi di un dizionario
+    struct key_index {
+        ArrayList<const entry*> entries;
+        std::uint32_t* slots;  // posizione + 1, 0 = vuoto
+        std::size_t mask;
+        bool duplicates = false;  // qualche chiave compare più di una volta
+
+        explicit key_index(const impl& dict) {
+            entries.reserve(dict.dict_size());
+            dict.for_each_entry([this](const entry& e) { entries.push_back(&e); });
+            std::size_t capacity = 16;
+            while (capacity < entries.size() * 2) {
+                capacity <<= 1;
+            }
+            slots = new std::uint32_t[capacity]();
+            mask = capacity - 1;
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                std::size_t s = hash_bytes(entries[i]->first) & mask;
+                while (slots[s] && entries[slots[s] - 1]->first != entries[i]->first) {
+                    s = (s + 1) & mask;
+                }
+                if (!slots[s]) {  // a parità di chiave vale la prima occorrenza
+                    slots[s] = static_cast<std::uint32_t>(i + 1);
+                } else {
+                    duplicates = true;
+                }
+            }
+        }
+        key_index(const key_index&) = delete;
+        key_index& operator=(const key_index&) = delete;
+        ~key_index() { delete[] slots; }
+
+        // Posizione della chiave, o entries.size() se assente
+        std::size_t find(const std::string& key) const {
+            for (std::size_t s = hash_bytes(key) & mask; slots[s]; s = (s + 1) & mask) {
+                if (entries[slots[s] - 1]->first == key) {
+                    return slots[s] - 1;
+                }
+            }
+            return entries.size();
+        }
+    };
 
-    char ch;
-    while (lhs.get(ch) && std::isspace(ch)) {
-        // Ignora gli spazi bianchi
+    json& patch;
+    std::string path;  // JSON Pointer del nodo visitato, esteso e accorciato durante la visita
+
+    explicit differ(json& patch) : patch(patch) {}
+
+    void emit(const char* op, const json* value) {
+        json step;
+        step.set_dictionary();
+        json name, pointer;
+        name.set_string(op);
+        pointer.set_string(path);
+        step.pimpl->add_entry(std::make_pair(std::string("op"), std::move(name)));
+        step.pimpl->add_entry(std::make_pair(std::string("path"), std::move(pointer)));
+        if (value) {
+            step.pimpl->add_entry(std::make_pair(std::string("value"), json(*value)));
+        }
+        patch.pimpl->append(std::move(step));
     }
 
-    if (ch == 'n') { // Parsing di null
-        char buffer[4];
-        if (lhs.read(buffer, 4) && std::string(buffer, 4) == "null") {
-            while (lhs.get(ch) && std::isspace(ch)) {
-                // Ignora gli spazi bianchi
+    std::size_t push_key(const std::string& key) {
+        std::size_t mark = path.size();
+        path += '/';
+        for (char c : key) {
+            if (c == '~') {
+                path += "~0";
+            } else if (c == '/') {
+                path += "~1";
+            } else {
+                path += c;
             }
-            rhs.set_null();
+        }
+        return mark;
+    }
+
+    std::size_t push_index(std::size_t index) {
+        std::size_t mark = path.size();
+        path += '/';
+        path += std::to_string(index);
+        return mark;
+    }
+
+    // L'elemento i di una lista; per le liste compatte viene materializzato in scratch
+    static const json& item(const impl& list, std::size_t i, json& scratch) {
+        if (list.box()->packing == Packing::None) {
+            return list.box()->listValue[i];
+        }
+        scratch.pimpl->type = list.box()->packing == Packing::Numbers ? JsonType::Number : JsonType::Bool;
+        scratch.pimpl->numberValue = list.box()->packing == Packing::Numbers ? list.box()->packedNumbers[i] : 0.0;
+        scratch.pimpl->boolValue = list.box()->packing == Packing::Bools && list.box()->packedBools.get(i);
+        scratch.pimpl->hashValid = false;
+        return scratch;
+    }
+
+    static std::uint64_t item_hash(const impl& list, std::size_t i) {
+        return list.box()->packing == Packing::Numbers ? hash_number(list.box()->packedNumbers[i])
+             : list.box()->packing == Packing::Bools ? hash_bool(list.box()->packedBools.get(i))
+             : list.box()->listValue[i].pimpl->hash();
+    }
+
+    void compare(const json& from, const json& to) {
+        const impl& a = *from.pimpl;
+        const impl& b = *to.pimpl;
+        /*
+         * Per i contenitori l'hash uguale basta: confermarlo con equal
+         * costerebbe una visita completa delle parti non cambiate. Gli
+         * scalari si confrontano comunque, il costo è lo stesso.
+         */
+        if (&a == &b) {
+            return;
+        }
+        if (a.hash() == b.hash() && a.type == b.type &&
+            (a.type == JsonType::List || a.type == JsonType::Dict || equal(a, b))) {
+            return;
+        }
+        if (a.type != b.type || (a.type != JsonType::List && a.type != JsonType::Dict)) {
+            emit("replace", &to);
+        } else if (a.type == JsonType::Dict) {
+            compare_dicts(a, b, to);
         } else {
-            throw json_exception{"Errore di parsing: valore null non valido"};
+            compare_lists(a, b);
+        }
+    }
+
+    // true se il dizionario ripete una chiave (possibile con insert() o dopo freeze())
+    static bool has_duplicate_keys(const impl& dict) {
+        const containers& c = *dict.box();
+        if (!c.frozen) {
+            return key_index(dict).duplicates;
         }
-    } else if (ch == 't') { // Parsing di true
-        char buffer[4];
-        if (lhs.read(buffer, 4) && std::string(buffer, 4) == "true") {
-            while (lhs.get(ch) && std::isspace(ch)) {
-                // Ignora gli spazi bianchi
+        // L'indice è ordinato per prefisso e chiave: le ripetizioni sono adiacenti
+        for (std::size_t i = 1; i < c.flatIndex.size(); ++i) {
+            const FlatKey& x = c.flatIndex[i - 1];
+            const FlatKey& y = c.flatIndex[i];
+            if (x.prefix == y.prefix && c.flatEntries[x.index].first == c.flatEntries[y.index].first) {
+                return true;
             }
-            rhs.set_bool(true);
-        } else {
-            throw json_exception{"Errore di parsing: valore booleano true non valido"};
         }
-    } else if (ch == 'f') { // Parsing di false
-        char buffer[5];
-        if (lhs.read(buffer, 5) && std::string(buffer, 5) == "false") {
-            while (lhs.get(ch) && std::isspace(ch)) {
-                // Ignora gli spazi bianchi
+        return false;
+    }
+
+    /*
+     * Un JSON Pointer raggiunge solo la prima occorrenza di una chiave
+     * ripetuta, quindi se uno dei due dizionari ne ha si sostituisce
+     * l'intero dizionario: la patch resta corretta anche se non minima.
+     */
+    void compare_dicts(const impl& a, const impl& b, const json& to) {
+        // Caso comune tra versioni dello stesso documento: stesse chiavi nello stesso ordine
+        if (a.dict_size() == b.dict_size()) {
+            auto node = b.box()->dictValue.get_head();
+            std::size_t i = 0;
+            bool same = true;
+            a.for_each_entry([&](const entry& e) {
+                const entry& other = b.box()->frozen ? b.box()->flatEntries[i++] : node->data;
+                if (!b.box()->frozen) {
+                    node = node->next;
+                }
+                same = same && e.first == other.first;
+            });
+            // Con le stesse chiavi nello stesso ordine le ripetizioni sono le stesse nei due dizionari
+            if (same && has_duplicate_keys(a)) {
+                emit("replace", &to);
+                return;
+            }
+            if (same) {
+                node = b.box()->dictValue.get_head();
+                i = 0;
+                a.for_each_entry([&](const entry& e) {
+                    const entry& other = b.box()->frozen ? b.box()->flatEntries[i++] : node->data;
+                    if (!b.box()->frozen) {
+                        node = node->next;
+                    }
+                    std::size_t mark = push_key(e.first);
+                    compare(e.second, other.second);
+                    path.resize(mark);
+                });
+                return;
             }
-            rhs.set_bool(false);
-        } else {
-            throw json_exception{"Errore di parsing: valore booleano false non valido"};
         }
-    } else if (ch == '\"') { // Parsing di string
-        std::string str;
-        char c;
-        while (lhs.get(c) && c != '\"') {
-            str += c;
+        key_index index(b);
+        if (index.duplicates || has_duplicate_keys(a)) {
+            emit("replace", &to);
+            return;
         }
-        rhs.set_string(str);
-        
-        while (lhs.get(ch) && std::isspace(ch)) {
-            // Ignora gli spazi bianchi dopo la stringa
+        ArrayList<char> matched;
+        matched.reserve(index.entries.size());
+        for (std::size_t i = 0; i < index.entries.size(); ++i) {
+            matched.push_back(0);
         }
-    } else if (std::isdigit(ch) || ch == '-') { // Parsing di number
-        lhs.putback(ch);
-        double num;
-        lhs >> num;
-        if (lhs.fail()) {
-            throw json_exception{"Errore di parsing: valore numerico non valido"};
+        a.for_each_entry([&](const entry& e) {
+            std::size_t position = index.find(e.first);
+            std::size_t mark = push_key(e.first);
+            if (position == index.entries.size()) {
+                emit("remove", nullptr);
+            } else {
+                matched[position] = 1;
+                compare(e.second, index.entries[position]->second);
+            }
+            path.resize(mark);
+        });
+        for (std::size_t i = 0; i < index.entries.size(); ++i) {
+            if (!matched[i]) {
+                std::size_t mark = push_key(index.entries[i]->first);
+                emit("add", &index.entries[i]->second);
+                path.resize(mark);
+            }
         }
-        rhs.set_number(num);
-    } else if (ch == '[') { // Parsing di list
-         rhs.set_list();
-
-    while (lhs.get(ch) && std::isspace(ch)) {
-        // Ignora gli spazi bianchi
     }
 
-    if (ch != ']') {
-        lhs.putback(ch);
-        while (true) {
-            json item;
-            lhs >> item;
-            rhs.push_back(item);
-
-            while (lhs.get(ch) && std::isspace(ch)) {
-                // Ignora gli spazi bianchi tra gli elementi
+    /*
+     * Diff di Myers tra a[first, first + n) e b[first, first + m) sugli hash
+     * degli elementi. Restituisce lo script di modifiche ('=' elemento
+     * abbinato, '-' rimosso da a, '+' aggiunto da b) o uno script vuoto se
+     * servono più di limit modifiche.
+     */
+    static ArrayList<char> edit_script(const impl& a, const impl& b, std::size_t first,
+                                       std::size_t n, std::size_t m, std::size_t limit) {
+        ArrayList<std::uint64_t> ha, hb;
+        ha.reserve(n);
+        hb.reserve(m);
+        for (std::size_t i = 0; i < n; ++i) {
+            ha.push_back(item_hash(a, first + i));
+        }
+        for (std::size_t i = 0; i < m; ++i) {
+            hb.push_back(item_hash(b, first + i));
+        }
+        /*
+         * trace contiene, per ogni d, la x più avanzata raggiunta su ciascuna
+         * diagonale k in [-d, d] con d modifiche, a partire dall'indice d*d.
+         */
+        ArrayList<std::size_t> trace;
+        std::ptrdiff_t N = static_cast<std::ptrdiff_t>(n), M = static_cast<std::ptrdiff_t>(m);
+        std::ptrdiff_t found = -1;
+        auto at = [&trace](std::ptrdiff_t d, std::ptrdiff_t k) -> std::size_t& {
+            return trace[static_cast<std::size_t>(d * d + k + d)];
+        };
+        for (std::ptrdiff_t d = 0; d <= static_cast<std::ptrdiff_t>(limit) && found < 0; ++d) {
+            for (std::ptrdiff_t k = -d; k <= d; k += 2) {
+                trace.push_back(0);
+                trace.push_back(0);  // le diagonali di parità opposta restano inutilizzate
+            }
+            trace.pop_back();
+            for (std::ptrdiff_t k = -d; k <= d; k += 2) {
+                std::ptrdiff_t x;
+                if (d == 0) {
+                    x = 0;
+                } else if (k == -d || (k != d && at(d - 1, k - 1) < at(d - 1, k + 1))) {
+                    x = static_cast<std::ptrdiff_t>(at(d - 1, k + 1));
+                } else {
+                    x = static_cast<std::ptrdiff_t>(at(d - 1, k - 1)) + 1;
+                }
+                std::ptrdiff_t y = x - k;
+                while (x < N && y < M && ha[x] == hb[y]) {
+                    ++x;
+                    ++y;
+                }
+                at(d, k) = static_cast<std::size_t>(x);
+                if (x >= N && y >= M) {
+                    found = d;
+                    break;
+                }
+            }
+        }
+        ArrayList<char> script;
+        if (found < 0) {
+            return script;
+        }
+        // Ricostruzione all'indietro: lo script viene scritto dalla fine
+        std::size_t length = (n + m + static_cast<std::size_t>(found)) / 2;
+        for (std::size_t i = 0; i < length; ++i) {
+            script.push_back('=');
+        }
+        std::ptrdiff_t x = N, y = M;
+        std::size_t out = length;
+        for (std::ptrdiff_t d = found; d > 0; --d) {
+            std::ptrdiff_t k = x - y;
+            bool down = k == -d || (k != d && at(d - 1, k - 1) < at(d - 1, k + 1));
+            std::ptrdiff_t previous = down ? k + 1 : k - 1;
+            std::ptrdiff_t px = static_cast<std::ptrdiff_t>(at(d - 1, previous));
+            std::ptrdiff_t py = px - previous;
+            std::ptrdiff_t sx = down ? px : px + 1;  // inizio del tratto diagonale
+            for (; x > sx; --x, --y) {
+                script[--out] = '=';
             }
+            script[--out] = down ? '+' : '-';
+            x = px;
+            y = py;
+        }
+        return script;
+    }
 
-            if (ch == ',') {
-                // Ignora la virgola e gli spazi bianchi successivi
-                while (lhs.get(ch) && std::isspace(ch)) {
-                    // Ignora gli spazi bianchi dopo la virgola
+    void compare_lists(const impl& a, const impl& b) {
+        std::size_t n = a.list_size();
+        std::size_t m = b.list_size();
+        json scratch_a, scratch_b;
+        std::size_t k = 0;  // posizione corrente nella lista in corso di modifica
+        auto modify = [&](std::size_t i, std::size_t j) {
+            std::size_t mark = push_index(k++);
+            compare(item(a, i, scratch_a), item(b, j, scratch_b));
+            path.resize(mark);
+        };
+        auto remove = [&]() {
+            std::size_t mark = push_index(k);
+            emit("remove", nullptr);
+            path.resize(mark);
+        };
+        auto add = [&](std::size_t j) {
+            std::size_t mark = push_index(k++);
+            emit("add", &item(b, j, scratch_b));
+            path.resize(mark);
+        };
+        // Prefisso e suffisso comuni non entrano nel diff di Myers
+        std::size_t prefix = 0;
+        while (prefix < n && prefix < m && item_hash(a, prefix) == item_hash(b, prefix)) {
+            ++prefix;
+        }
+        std::size_t suffix = 0;
+        while (suffix < n - prefix && suffix < m - prefix &&
+               item_hash(a, n - 1 - suffix) == item_hash(b, m - 1 - suffix)) {
+            ++suffix;
+        }
+        std::size_t na = n - prefix - suffix, nb = m - prefix - suffix;
+        std::size_t limit = std::max<std::size_t>(16, max_work / (na + nb + 1));
+        if (limit > max_edits) {
+            limit = max_edits;
+        }
+        ArrayList<char> script;
+        if (na && nb) {
+            script = edit_script(a, b, prefix, na, nb, limit);
+        }
+        for (std::size_t i = 0; i < prefix; ++i) {
+            modify(i, i);
+        }
+        /*
+         * Ogni gruppo di rimozioni e aggiunte consecutive diventa prima una
+         * serie di modifiche sul posto, poi le rimozioni o aggiunte che
+         * avanzano: un elemento cambiato non viene riscritto per intero.
+         * Senza script (troppe modifiche) l'intero tratto centrale forma un
+         * solo gruppo, cioè gli elementi si abbinano per posizione.
+         */
+        std::size_t i = prefix, j = prefix;
+        std::size_t s = 0;
+        while (i < prefix + na || j < prefix + nb) {
+            if (s < script.size() && script[s] == '=') {
+                modify(i++, j++);
+                ++s;
+                continue;
+            }
+            std::size_t removed = 0, added = 0;
+            for (; s < script.size() && script[s] != '='; ++s) {
+                if (script[s] == '-') {
+                    ++removed;
+                } else {
+                    ++added;
                 }
-            } else if (ch == ']') {
-                // Fine della lista
-                break;
-            } else {
-                throw json_exception{"Errore di parsing: lista non valida"};
+            }
+            if (script.size() == 0) {
+                removed = na;
+                added = nb;
+            }
+            for (; removed && added; --removed, --added) {
+                modify(i++, j++);
+            }
+            for (; removed; --removed, ++i) {
+                remove();
+            }
+            for (; added; --added) {
+                add(j++);
             }
         }
+        for (std::size_t t = 0; t < suffix; ++t) {
+            modify(i++, j++);
+        }
     }
-    } else if (ch == '{') { // Parsing di dictionary
-        rhs.set_dictionary();
+};
+
+json json::diff(json const& from, json const& to) {
+    json patch;
+    patch.set_list();
+    impl::differ(patch).compare(from, to);
+    return patch;
+}
+
+const_json_document::const_json_document() {}
+
+const_json_document::const_json_document(json doc) : doc(std::move(doc)) {
+    this->doc.pimpl->seal();
+    // L'hash è calcolato subito: le chiamate successive a hash() leggono solo la cache
+    this->doc.pimpl->hash();
+}
+
+json const& const_json_document::root() const {
+    return doc;
+}
+
+json const& const_json_document::operator[](std::string const& key) const {
+    return doc[key];
+}
+
+json_ref const_json_document::at_pointer(std::string const& pointer) const {
+    return doc.at_pointer(pointer);
+}
+
+std::size_t const_json_document::size() const {
+    return doc.size();
+}
+
+json::const_list_iterator const_json_document::begin_list() const {
+    return doc.begin_list();
+}
+
+json::const_list_iterator const_json_document::end_list() const {
+    return doc.end_list();
+}
+
+json::const_dictionary_iterator const_json_document::begin_dictionary() const {
+    return doc.begin_dictionary();
+}
+
+json::const_dictionary_iterator const_json_document::end_dictionary() const {
+    return doc.end_dictionary();
+}
 
-    while (lhs.get(ch) && std::isspace(ch)) {
-        // Ignora gli spazi bianchi
+json_source_document::json_source_document(std::string text) : source(std::move(text)) {
+    // Identificativi distinti per ogni documento: i valori spostati da un altro documento non vengono copiati
+    static std::atomic<std::uint32_t> next_id{0};
+    do {
+        id = ++next_id;
+    } while (id == 0);
+    json::impl::parser p(source.data(), source.data() + source.size());
+    p.source = id;
+    p.skip_whitespace();
+    if (!p.parse_value(doc) || !p.finish()) {
+        p.raise();
     }
+}
 
-    if (ch != '}') {
-        lhs.putback(ch);
-        while (true) {
-            std::string key;
-            json value;
+json& json_source_document::root() {
+    return doc;
+}
 
-            // Parsing della chiave
-            lhs >> key;
+json const& json_source_document::root() const {
+    return doc;
+}
 
-            while (lhs.get(ch) && std::isspace(ch)) {
-                // Ignora gli spazi bianchi tra chiave e due punti
-            }
+std::string const& json_source_document::text() const {
+    return source;
+}
 
-            if (ch == ':') {
-                // Consuma i due punti
-                while (lhs.get(ch) && std::isspace(ch)) {
-                    // Ignora gli spazi bianchi dopo i due punti
-                }
-            } else {
-                throw json_exception{"Errore di parsing: dizionario non valido"};
-            }
+void json_source_document::write(std::ostream& os) const {
+    ostream_sink sink(os);
+    json::impl::writer out(sink, json_write_options());
+    out.legacy = true;
+    out.precision = static_cast<int>(os.precision());
+    out.text = source.data();
+    out.source = id;
+    out.write(*doc.pimpl);
+    out.drain();
+}
 
-            // Parsing del valore associato alla chiave
-            lhs >> value;
-            rhs[key] = value;
+/*
+ * I lettori si registrano nel contatore dell'epoca corrente prima di leggere
+ * il puntatore. Dopo lo scambio, publish() alterna due volte l'epoca e ogni
+ * volta attende che il contatore dell'epoca lasciata si azzeri: un lettore
+ * che ha letto l'epoca prima di uno scambio ma si è registrato dopo il
+ * controllo vede già il nuovo puntatore, e la seconda attesa copre chi si è
+ * registrato nell'epoca vecchia durante un publish() precedente.
+ */
+struct json_snapshot::state {
+    struct alignas(64) counter {
+        std::atomic<std::size_t> value{0};
+    };
 
-            while (lhs.get(ch) && std::isspace(ch)) {
-                // Ignora gli spazi bianchi tra elementi del dizionario
-            }
+    std::atomic<const_json_document const*> current;
+    std::atomic<unsigned> epoch{0};
+    counter readers[2];
+    std::mutex writer;
 
-            if (ch == ',') {
-                // Ignora la virgola e gli spazi bianchi successivi
-                while (lhs.get(ch) && std::isspace(ch)) {
-                    // Ignora gli spazi bianchi dopo la virgola
-                }
-            } else if (ch == '}') {
-                // Fine del dizionario
-                break;
-            } else {
-                throw json_exception{"Errore di parsing: dizionario non valido"};
+    explicit state(const_json_document const* doc) : current(doc) {}
+
+    void synchronize() {
+        for (int phase = 0; phase < 2; ++phase) {
+            unsigned old = epoch.load();
+            epoch.store(old ^ 1);
+            while (readers[old].value.load() != 0) {
+                std::this_thread::yield();
             }
         }
     }
-    } else {
-        throw json_exception{"Errore di parsing: carattere non valido"};
+};
+
+json_snapshot::reader::reader(state* owner, unsigned slot, const_json_document const* doc)
+    : owner(owner), slot(slot), doc(doc) {}
+
+json_snapshot::reader::reader(reader&& other) noexcept
+    : owner(other.owner), slot(other.slot), doc(other.doc) {
+    other.owner = nullptr;
+}
+
+json_snapshot::reader::~reader() {
+    if (owner) {
+        owner->readers[slot].value.fetch_sub(1);
     }
+}
 
-    return lhs;
+json_snapshot::json_snapshot() : st(new state(new const_json_document())) {}
+
+json_snapshot::json_snapshot(const_json_document doc)
+    : st(new state(new const_json_document(std::move(doc)))) {}
+
+json_snapshot::~json_snapshot() {
+    delete st->current.load();
+    delete st;
+}
+
+json_snapshot::reader json_snapshot::read() const {
+    unsigned slot = st->epoch.load();
+    st->readers[slot].value.fetch_add(1);
+    return reader(st, slot, st->current.load());
 }
 
+void json_snapshot::publish(const_json_document doc) {
+    const_json_document const* fresh = new const_json_document(std::move(doc));
+    std::lock_guard<std::mutex> lock(st->writer);
+    const_json_document const* old = st->current.exchange(fresh);
+    st->synchronize();
+    delete old;
+}
@@ -0,0 +1,1351 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <cstddef>
+#include <iterator>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <memory_resource>
+
+struct json_exception {
+    std::string msg;
+};
+
+/*
+ * Memoria occupata da un albero json, calcolata da json::memory_usage().
+ * I contatori per tipo contano i valori (anche quelli delle liste compatte);
+ * i byte sono divisi tra chiavi, contenuto delle stringhe, strutture dei
+ * contenitori e overhead fisso dei nodi (json + json::impl). Un sottoalbero
+ * condiviso da json::deduplicate() è contato una volta sola.
+ */
+struct json_memory_usage {
+    std::size_t nulls;
+    std::size_t numbers;
+    std::size_t bools;
+    std::size_t strings;
+    std::size_t lists;
+    std::size_t dicts;
+    std::size_t keys;
+
+    std::size_t key_bytes;
+    std::size_t string_bytes;
+    std::size_t container_bytes;
+    std::size_t overhead;
+    std::size_t total;
+};
+
+// Esito di json::parse: il primo errore trovato, nessuno se l'input è valido
+enum class json_parse_error {
+    None,
+    UnexpectedEnd,
+    InvalidCharacter,
+    InvalidLiteral,
+    InvalidNumber,
+    NumberOutOfRange,
+    UnterminatedString,
+    ControlCharacter,
+    InvalidEscape,
+    InvalidUnicodeEscape,
+    UnpairedSurrogate,
+    InvalidList,
+    InvalidDictionary,
+    UnterminatedContainer,
+    TrailingCharacters,
+    TooDeep,
+    InvalidUtf8
+};
+
+/*
+ * Risultato di json::parse. offset è il byte in cui è stato trovato
+ * l'errore (o la lunghezza dell'input se non ci sono errori); riga e colonna
+ * partono da 1 e la colonna è contata in byte.
+ */
+struct json_parse_result {
+    json_parse_error error;
+    std::size_t offset;
+    std::size_t line;
+    std::size_t column;
+
+    explicit operator bool() const { return error == json_parse_error::None; }
+    const char* message() const;
+};
+
+/*
+ * Opzioni di json::write. Con i valori predefiniti l'uscita è compatta,
+ * senza spazi. indent > 0 va a capo dopo ogni elemento e rientra di indent
+ * spazi per livello; sort_keys ordina le chiavi per byte (per i dizionari
+ * compattati da freeze() l'ordine è già pronto); ascii scrive i caratteri
+ * non ASCII come \uXXXX. canonical produce la forma canonica RFC 8785
+ * (JCS): nessuno spazio, chiavi ordinate per unità UTF-16, numeri nella
+ * forma più corta di ECMAScript; le altre opzioni vengono ignorate.
+ * I numeri sono scritti con le cifre necessarie a rileggerli identici;
+ * NaN e infiniti non sono JSON e fanno lanciare json_exception.
+ * threads > 1 (0 = tutti i core) divide i documenti grandi in blocchi
+ * serializzati in parallelo; l'uscita resta identica byte per byte.
+ */
+struct json_write_options {
+    std::size_t indent = 0;
+    bool sort_keys = false;
+    bool ascii = false;
+    bool canonical = false;
+    std::size_t threads = 1;
+};
+
+/*
+ * Destinazione dei byte prodotti da json::write. Il serializzatore riempie
+ * un buffer interno e chiama write a blocchi (di norma 64 KB, più piccolo
+ * l'ultimo); i dati valgono solo per la durata della chiamata.
+ */
+class json_sink {
+
+public:
+
+    virtual ~json_sink() = default;
+    virtual void write(const char* data, std::size_t size) = 0;
+
+};
+
+/*
+ * Sink su file che non blocca il serializzatore sull'I/O: i byte riempiono
+ * buffers buffer da buffer_size byte e ogni buffer pieno passa a un thread
+ * in background, che scrive insieme (con writev) tutti quelli in attesa
+ * mentre il serializzatore riempie il successivo; write aspetta solo se
+ * tutti i buffer sono in coda. close() scrive il resto, attende il thread
+ * e chiude il file; il distruttore la chiama se non è già stata chiamata,
+ * ignorando gli errori. Errori di apertura e di scrittura lanciano
+ * json_exception (quelli di scrittura alla write o close successiva).
+ */
+class json_file_sink : public json_sink {
+
+public:
+
+    explicit json_file_sink(std::string const& path, std::size_t buffer_size = std::size_t(1) << 20,
+                            std::size_t buffers = 2);
+    json_file_sink(json_file_sink const&) = delete;
+    json_file_sink& operator=(json_file_sink const&) = delete;
+    ~json_file_sink() override;
+
+    void write(const char* data, std::size_t size) override;
+    void close();
+
+private:
+
+    struct state;
+    state* st;
+
+};
+
+#ifdef JSON_MEMORY_STATS
+/*
+ * Contatori globali delle allocazioni fatte dalla libreria, disponibili solo
+ * compilando con -DJSON_MEMORY_STATS (altrimenti non hanno alcun costo).
+ */
+struct json_allocation_stats {
+    std::size_t node_allocations;       // json::impl, e lo stato dei contenitori per liste e dizionari
+    std::size_t node_bytes;
+    std::size_t array_allocations;      // blocchi contigui: liste, forme compatte, layout piatto
+    std::size_t array_bytes;
+    std::size_t dict_node_allocations;  // nodi dei dizionari
+    std::size_t dict_node_bytes;
+    std::size_t live_bytes;
+    std::size_t peak_bytes;
+};
+
+json_allocation_stats json_allocation_counters();
+void json_reset_allocation_counters();
+#endif
+
+class json_ref;
+
+class json {
+
+public:
+
+    struct list_iterator;
+    struct dictionary_iterator;
+    struct const_list_iterator;
+    struct const_dictionary_iterator;
+
+    json();
+    json(json const&);
+    json(json&&);
+    ~json();
+
+    json& operator=(json const&);
+    json& operator=(json&&);
+
+    /*
+     * Allocatori: i nodi, i blocchi delle liste e i nodi dei dizionari sono
+     * presi dalla memory_resource indicata (nullptr = risorsa di default) e
+     * i figli aggiunti in seguito la ereditano. Come per i contenitori pmr,
+     * il copy constructor usa la risorsa di default, l'assegnamento per copia
+     * mantiene quella di destinazione e lo spostamento porta con sé quella
+     * di origine. La risorsa deve sopravvivere al json.
+     * Il contenuto di stringhe e chiavi resta allocato con std::string.
+     */
+    explicit json(std::pmr::memory_resource*);
+    json(json const&, std::pmr::memory_resource*);
+    std::pmr::memory_resource* get_memory_resource() const;
+
+    bool is_list() const;
+    bool is_dictionary() const;
+    bool is_string() const;
+    bool is_number() const;
+    bool is_bool() const;
+    bool is_null() const;
+
+    json const& operator[](std::string const&) const;
+    json& operator[](std::string const&);
+
+    list_iterator begin_list();
+    const_list_iterator begin_list() const;
+    list_iterator end_list();
+    const_list_iterator end_list() const;
+
+    dictionary_iterator begin_dictionary();
+    const_dictionary_iterator begin_dictionary() const;
+    dictionary_iterator end_dictionary();
+    const_dictionary_iterator end_dictionary() const;
+
+    double& get_number();
+    double const& get_number() const;
+
+    bool& get_bool();
+    bool const& get_bool() const;
+
+    std::string& get_string();
+    std::string const& get_string() const;
+
+    void set_string(std::string const&);
+    void set_bool(bool);
+    void set_number(double);
+    void set_null();
+    void set_list();
+    void set_dictionary();
+    void push_front(json const&);
+    void push_back(json const&);
+    void insert(std::pair<std::string,json> const&);
+
+    /*
+     * Numero di elementi di una lista o di un dizionario (O(1)).
+     * null vale 0, gli altri valori scalari valgono 1.
+     */
+    std::size_t size() const;
+    bool empty() const;
+
+    /*
+     * Capacità della memoria già allocata per gli elementi del contenitore.
+     * reserve(n) è un suggerimento: dimensiona il contenitore una volta sola
+     * prima di n inserimenti. Lancia json_exception se il json non è un contenitore.
+     */
+    std::size_t capacity() const;
+    void reserve(std::size_t n);
+
+    /*
+     * Estrazione in blocco dei numeri di una lista. La lista deve contenere
+     * solo numeri (il controllo è fatto una volta sola per tutta la lista),
+     * altrimenti viene lanciata json_exception.
+     * copy_numbers scrive size() valori in out, che deve averne almeno n >= size().
+     */
+    std::size_t copy_numbers(double* out, std::size_t n) const;
+    double sum_numbers() const;
+    double min_number() const;
+    double max_number() const;
+
+    /*
+     * Compatta ricorsivamente tutti i dizionari in un layout piatto ordinato
+     * per chiave, pensato per documenti letti molte volte: operator[] diventa
+     * una ricerca binaria e l'iterazione mantiene l'ordine di inserimento.
+     * Inserire una chiave nuova riporta quel dizionario al layout normale.
+     * Le chiavi non vanno modificate tramite gli iteratori di un dizionario compattato.
+     * Anche le liste di soli numeri o soli booleani espanse da un accesso
+     * modificabile (iteratori non const, push_front, ...) tornano compatte.
+     */
+    void freeze();
+
+    /*
+     * Accesso tramite JSON Pointer (RFC 6901), es. "/payload/items/0/price".
+     * Non inserisce chiavi mancanti: se il percorso non esiste lancia
+     * json_exception. Per valutare lo stesso percorso molte volte usare json_path.
+     * La versione const restituisce json_ref perché il valore può essere
+     * un elemento di una lista compatta.
+     */
+    json_ref at_pointer(std::string const& pointer) const;
+    json& at_pointer(std::string const& pointer);
+
+    /*
+     * Parsing di un testo in memoria senza eccezioni: l'esito e la posizione
+     * del primo errore sono nel risultato e in caso di errore out non viene
+     * modificato. Annidamenti più profondi di max_depth sono rifiutati.
+     * Le stringhe sono controllate come UTF-8 durante la scansione;
+     * check_utf8 = false salta il controllo per input fidato.
+     * La seconda forma lancia json_exception con riga e colonna dell'errore;
+     * anche operator>> usa lo stesso parser, su un solo valore letto dallo
+     * stream: la posizione resta subito dopo il valore, quindi le estrazioni
+     * si possono concatenare. Se lo stream contiene solo spazi operator>>
+     * imposta failbit senza lanciare.
+     * Se un dizionario ripete una chiave resta una sola coppia, nella
+     * posizione della prima e con il valore dell'ultima (come dict[key] = value);
+     * lo stesso vale per json_push_parser, json_projection e from_cbor.
+     */
+    static json_parse_result parse(std::string_view text, json& out, std::size_t max_depth = 512,
+                                   bool check_utf8 = true);
+    static json parse(std::string_view text);
+
+    /*
+     * Controllo di conformità a RFC 8259 senza costruire il json e senza
+     * allocare: grammatica, escape, coppie di surrogati, UTF-8 delle stringhe,
+     * profondità e caratteri dopo il valore. I numeri sono controllati solo
+     * nella grammatica, quindi 1e999 è valido qui ma parse lo rifiuta
+     * perché non è rappresentabile come double.
+     */
+    static json_parse_result validate(std::string_view text, std::size_t max_depth = 512);
+
+    /*
+     * Serializzazione binaria in formato CBOR (RFC 8949), letta e scritta
+     * direttamente dallo stream. from_cbor sostituisce il contenuto del json
+     * e lancia json_exception se l'input non è valido o è troncato.
+     */
+    void to_cbor(std::ostream& os) const;
+    void from_cbor(std::istream& is);
+
+    /*
+     * Scrive il documento nel formato a nastro senza puntatori (chiavi dei
+     * dizionari ordinate, liste di numeri compatte) letto da json_tape.
+     */
+    void to_tape(std::ostream& os) const;
+
+    /*
+     * Serializzazione testuale configurabile (vedi json_write_options), in
+     * un solo passaggio su un buffer che viene scaricato nel sink o nello
+     * stream a blocchi. Le stringhe sono sempre scritte con gli escape
+     * necessari. operator<< mantiene il suo formato (separatori ", " e ": ",
+     * numeri con la precisione dello stream).
+     * Con options.threads > 1 i blocchi vengono scritti nel sink in ordine
+     * dal thread chiamante; il documento non va modificato durante la
+     * chiamata. Se viene lanciata un'eccezione il sink può aver ricevuto
+     * solo una parte dell'uscita, come nel caso sequenziale.
+     */
+    void write(json_sink& sink, json_write_options const& options = json_write_options()) const;
+    void write(std::ostream& os, json_write_options const& options = json_write_options()) const;
+    std::string to_string(json_write_options const& options = json_write_options()) const;
+
+    // Percorre l'albero e restituisce la memoria occupata, divisa per categoria
+    json_memory_usage memory_usage() const;
+
+    /*
+     * Hash strutturale del valore, coerente con operator== (i dizionari non
+     * dipendono dall'ordine delle chiavi). L'hash di ogni sottoalbero resta
+     * in cache finché il sottoalbero non viene modificato, quindi le chiamate
+     * successive costano O(1). I metodi non const che restituiscono
+     * riferimenti o iteratori modificabili contano come modifica al momento
+     * della chiamata. Come ogni metodo che aggiorna la cache, hash() non va
+     * chiamato da più thread sullo stesso albero (vedi const_json_document).
+     */
+    std::uint64_t hash() const;
+
+    /*
+     * Condivisione dei sottoalberi identici (hash-consing). deduplicate()
+     * sostituisce ogni sottoalbero uguale a uno già incontrato (stessi valori
+     * e stesso ordine delle chiavi) con un riferimento allo stesso nodo, con
+     * conteggio dei riferimenti, e restituisce i byte liberati.
+     * parse_deduplicated fa lo stesso durante il parsing, così le copie non
+     * restano in memoria tutte insieme; bytes_saved riceve i byte risparmiati.
+     * I nodi condivisi non vengono mai modificati: i metodi non const che
+     * restituiscono riferimenti o iteratori modificabili ai figli copiano
+     * prima il figlio condiviso (copy-on-write). Il copy constructor copia
+     * anche le parti condivise, quindi la copia non è deduplicata. Il
+     * conteggio non è atomico: un albero deduplicato segue le stesse regole
+     * di uso da più thread degli altri json.
+     */
+    std::size_t deduplicate();
+    static json_parse_result parse_deduplicated(std::string_view text, json& out,
+                                                std::size_t* bytes_saved = nullptr);
+
+    /*
+     * Modifica sul posto tramite patch. apply_patch esegue un JSON Patch
+     * (RFC 6902: lista di operazioni add, remove, replace, move, copy, test),
+     * apply_merge_patch un JSON Merge Patch (RFC 7396). I valori del
+     * documento vengono spostati e mai copiati (tranne che da copy); quelli
+     * della patch sono copiati, o spostati se la patch è un temporaneo.
+     * Ogni operazione visita solo i nodi lungo il proprio percorso: nei
+     * dizionari compattati da freeze() la ricerca resta binaria e le chiavi
+     * aggiunte o rimosse non li riportano al layout normale.
+     * Se un'operazione fallisce (percorso assente, test non superato,
+     * operazione malformata) apply_patch annulla quelle già eseguite e lancia
+     * json_exception: il documento resta com'era, ordine delle chiavi compreso.
+     * La patch non deve essere un sottoalbero del documento stesso.
+     */
+    void apply_patch(json const& patch);
+    void apply_patch(json&& patch);
+    void apply_merge_patch(json const& patch);
+    void apply_merge_patch(json&& patch);
+
+    /*
+     * JSON Patch (RFC 6902) che trasforma from in to: from.apply_patch(diff(from, to))
+     * produce un documento uguale a to secondo operator==. Liste e dizionari
+     * con lo stesso hash (vedi hash()) sono considerati uguali senza
+     * visitarli, quindi con gli hash in cache il costo dipende dalle parti
+     * cambiate e non dalla dimensione del documento; una collisione
+     * dell'hash a 64 bit, molto improbabile ma non impossibile, farebbe
+     * perdere le modifiche di quel sottoalbero. Le liste sono confrontate
+     * con un diff a minimo numero di modifiche, limitato a circa mille
+     * modifiche per lista: oltre, gli elementi vengono abbinati per
+     * posizione e la patch resta corretta ma non minima. Un dizionario con
+     * chiavi ripetute (possibili con insert()) viene sostituito per intero,
+     * perché un JSON Pointer ne raggiunge solo la prima occorrenza. Le
+     * operazioni generate sono solo add, remove e replace; i valori sono
+     * copiati da to.
+     */
+    static json diff(json const& from, json const& to);
+
+private:
+
+    struct impl;
+    impl* pimpl;
+
+    // Nuovo riferimento a un nodo esistente (usato per i figli condivisi)
+    explicit json(impl* node);
+
+    // Passi sui nodi della lista delle coppie di un dizionario (vedi dictionary_iterator)
+    static const void* dict_next(const void* node);
+    static const void* dict_prev(const void* node, const void* list);
+    static std::pair<std::string, json>& dict_entry(const void* node);
+
+    // Elemento i di una lista compatta, restituito per valore
+    json_ref packed_item(std::size_t i) const;
+
+    friend class json_path;
+    friend class json_projection;
+    friend class json_push_parser;
+    friend class const_json_document;
+    friend class json_source_document;
+
+    friend std::ostream& operator<<(std::ostream& lhs, json const& rhs);
+    friend std::istream& operator>>(std::istream& lhs, json& rhs);
+    friend bool operator==(json const& lhs, json const& rhs);
+
+};
+
+/*
+ * Riferimento in sola lettura a un valore json, restituito dagli iteratori
+ * const di lista. Gli elementi di una lista compatta di numeri o booleani
+ * non sono oggetti json: per questi il riferimento contiene il valore
+ * stesso e resta valido anche dopo che l'iteratore è stato spostato o
+ * distrutto. Gli altri valori sono riferiti per indirizzo e restano validi
+ * finché il json che li contiene non viene modificato.
+ * get() restituisce il json riferito (nullptr per un elemento compatto),
+ * materialize() ne costruisce una copia. Il riferimento vuoto (costruttore
+ * di default) vale false e lancia json_exception a ogni accesso.
+ */
+class json_ref {
+
+public:
+
+    json_ref();
+    json_ref(json const& value);
+
+    explicit operator bool() const;
+    json const* get() const;
+
+    bool is_list() const;
+    bool is_dictionary() const;
+    bool is_string() const;
+    bool is_number() const;
+    bool is_bool() const;
+    bool is_null() const;
+
+    double get_number() const;
+    bool get_bool() const;
+    std::string const& get_string() const;
+
+    std::size_t size() const;
+    bool empty() const;
+
+    json const& operator[](std::string const& key) const;
+
+    json::const_list_iterator begin_list() const;
+    json::const_list_iterator end_list() const;
+    json::const_dictionary_iterator begin_dictionary() const;
+    json::const_dictionary_iterator end_dictionary() const;
+
+    std::uint64_t hash() const;
+    json materialize() const;
+
+    // Per l'uso come pointer degli iteratori: it->get_number()
+    const json_ref* operator->() const { return this; }
+
+private:
+
+    friend class json;
+
+    enum class Kind : unsigned char { Node, Number, Bool };
+
+    json_ref(double number, Kind kind);
+
+    // Il json riferito, o json_exception se il riferimento è vuoto o compatto
+    json const& node_or_throw(const char* message) const;
+
+    const json* node;
+    double number;
+    Kind kind;
+
+};
+
+/*
+ * Stessa semantica di operator== tra json: un elemento compatto è uguale
+ * al json scalare con lo stesso valore.
+ */
+bool operator==(json_ref lhs, json_ref rhs);
+bool operator!=(json_ref lhs, json_ref rhs);
+std::ostream& operator<<(std::ostream& lhs, json_ref rhs);
+
+/*
+ * JSON Pointer (RFC 6901) già scomposto in segmenti: la stringa viene
+ * analizzata una volta sola e la valutazione su un documento non alloca
+ * memoria. find restituisce nullptr (o un json_ref vuoto) se il percorso
+ * non esiste, evaluate lancia json_exception. evaluate_all valuta il
+ * percorso su ogni elemento di una lista di record, scrivendo in out al più
+ * n risultati (vuoti per i record in cui il percorso manca) e restituendo
+ * quanti ne ha scritti.
+ * La valutazione const non modifica il documento e restituisce json_ref:
+ * un risultato che è un elemento di una lista compatta di numeri o
+ * booleani contiene il valore stesso, quindi ogni risultato resta valido
+ * finché il documento non viene modificato, indipendentemente dalle
+ * valutazioni successive e dal thread che le esegue.
+ */
+class json_path {
+
+public:
+
+    explicit json_path(std::string const& pointer);
+    json_path(json_path const&);
+    json_path(json_path&&) noexcept;
+    ~json_path();
+
+    json_path& operator=(json_path const&);
+    json_path& operator=(json_path&&) noexcept;
+
+    std::size_t depth() const;
+
+    json_ref find(json const& doc) const;
+    json* find(json& doc) const;
+
+    json_ref evaluate(json const& doc) const;
+    json& evaluate(json& doc) const;
+
+    std::size_t evaluate_all(json const& records, json_ref* out, std::size_t n) const;
+
+private:
+
+    struct segment;
+    segment* segments;
+    std::size_t count;
+
+    // Valuta solo i primi n segmenti (usato da json::apply_patch per il contenitore del bersaglio)
+    json* find(json& doc, std::size_t n) const;
+
+    friend class json;
+
+};
+
+/*
+ * Parsing con proiezione: si registrano in anticipo i JSON Pointer che
+ * interessano e parse() materializza solo i sottoalberi corrispondenti;
+ * il resto del testo viene saltato con una scansione di parentesi e
+ * virgolette che non alloca memoria. Il segmento "*" corrisponde a ogni
+ * elemento di una lista o chiave di un dizionario (se non c'è una chiave
+ * esatta). Gli elementi di lista non richiesti restano null, in modo che
+ * gli indici del risultato coincidano con quelli del testo.
+ */
+class json_projection {
+
+public:
+
+    json_projection();
+    json_projection(json_projection const&);
+    json_projection(json_projection&&) noexcept;
+    ~json_projection();
+
+    json_projection& operator=(json_projection const&);
+    json_projection& operator=(json_projection&&) noexcept;
+
+    void add(std::string const& pointer);
+    void parse(std::string const& text, json& out) const;
+
+private:
+
+    struct node;
+    node* root;
+
+    static void insert(node& at, std::string const* segs, std::size_t n);
+
+};
+
+/*
+ * Parser incrementale per input che arriva a blocchi (es. da socket).
+ * feed() accetta blocchi di qualsiasi dimensione, anche spezzati a metà di
+ * un token, e restituisce quanti valori di primo livello sono stati
+ * completati; next() li consegna in ordine. finish() segnala la fine
+ * dell'input (serve a chiudere un numero finale). La profondità di
+ * annidamento e la lunghezza di stringhe e numeri sono limitate; dopo un
+ * json_exception il parser va riportato allo stato iniziale con reset().
+ * I valori prodotti sono allocati dalla memory_resource indicata.
+ */
+class json_push_parser {
+
+public:
+
+    explicit json_push_parser(std::size_t max_depth = 512, std::size_t max_token = std::size_t(64) << 20,
+                              std::pmr::memory_resource* resource = nullptr);
+    json_push_parser(json_push_parser const&) = delete;
+    json_push_parser& operator=(json_push_parser const&) = delete;
+    ~json_push_parser();
+
+    std::size_t feed(const char* data, std::size_t size);
+    std::size_t feed(std::string const& chunk);
+    std::size_t finish();
+
+    bool has_value() const;
+    json next();
+
+    void reset();
+
+private:
+
+    struct state;
+    state* st;
+
+};
+
+/*
+ * Vista di sola lettura su un valore di un nastro json (vedi json::to_tape).
+ * Non possiede memoria: resta valida finché è aperto il json_tape da cui
+ * proviene. Gli accessi leggono direttamente i byte del nastro;
+ * materialize() costruisce un json ordinario. Un figlio deve stare dopo il
+ * proprio contenitore nel nastro e materialize() rifiuta annidamenti oltre
+ * 512 livelli, così un nastro corrotto non può creare cicli né esaurire lo stack.
+ */
+class json_view {
+
+public:
+
+    struct list_iterator;
+    struct dictionary_iterator;
+
+    json_view();
+
+    bool is_list() const;
+    bool is_dictionary() const;
+    bool is_string() const;
+    bool is_number() const;
+    bool is_bool() const;
+    bool is_null() const;
+
+    double get_number() const;
+    bool get_bool() const;
+    std::string_view get_string() const;
+
+    std::size_t size() const;
+
+    json_view operator[](std::string const& key) const;
+    json_view operator[](std::size_t index) const;
+
+    // Chiave e valore della coppia index-esima di un dizionario, in ordine di inserimento
+    std::string_view key_at(std::size_t index) const;
+    json_view value_at(std::size_t index) const;
+
+    list_iterator begin_list() const;
+    list_iterator end_list() const;
+    dictionary_iterator begin_dictionary() const;
+    dictionary_iterator end_dictionary() const;
+
+    json materialize() const;
+
+private:
+
+    friend class json_tape;
+
+    json_view(const char* data, std::size_t size, std::uint64_t value);
+
+    json_view child(std::uint64_t value) const;
+    json materialize(std::size_t depth) const;
+    const char* content(std::size_t bytes) const;
+    const char* content(std::uint64_t count, std::size_t stride) const;
+    const json_view* find(std::string_view key, json_view& out) const;
+
+    const char* base;
+    std::size_t length;
+    std::uint64_t slot;
+
+};
+
+/*
+ * Nastro json aperto da file con mmap (lettura in memoria dove mmap non
+ * c'è) oppure da un buffer esterno. L'apertura controlla solo
+ * l'intestazione, quindi costa O(1) indipendentemente dalla dimensione.
+ */
+class json_tape {
+
+public:
+
+    explicit json_tape(std::string const& path);
+    json_tape(const char* data, std::size_t size);
+    json_tape(json_tape&&) noexcept;
+    json_tape& operator=(json_tape&&) noexcept;
+    json_tape(json_tape const&) = delete;
+    json_tape& operator=(json_tape const&) = delete;
+    ~json_tape();
+
+    json_view root() const;
+
+private:
+
+    void check() const;
+    void release();
+
+    const char* bytes;
+    std::size_t length;
+    bool mapped;
+    bool owned;
+
+};
+
+/*
+ * Documento json immutabile, pensato per essere condiviso tra thread.
+ * Il costruttore prende possesso del json e compatta tutti i dizionari nel
+ * layout piatto (come freeze), lasciando (o riportando) in forma compatta
+ * le liste di numeri e booleani: da quel momento nessuna lettura modifica più l'albero, quindi un numero qualsiasi di
+ * thread può usare le operazioni esposte contemporaneamente senza
+ * sincronizzazione. Sono esposte solo ricerca e iterazione in sola lettura.
+ */
+class const_json_document {
+
+public:
+
+    const_json_document(); // Documento null
+    explicit const_json_document(json doc);
+    const_json_document(const_json_document&&) = default;
+    const_json_document(const_json_document const&) = delete;
+    const_json_document& operator=(const_json_document const&) = delete;
+
+    json const& root() const;
+    json const& operator[](std::string const& key) const;
+    json_ref at_pointer(std::string const& pointer) const;
+    std::size_t size() const;
+
+    json::const_list_iterator begin_list() const;
+    json::const_list_iterator end_list() const;
+    json::const_dictionary_iterator begin_dictionary() const;
+    json::const_dictionary_iterator end_dictionary() const;
+
+private:
+
+    json doc;
+
+};
+
+/*
+ * Riferimento al documento corrente, sostituibile mentre altri thread lo
+ * leggono (schema RCU). read() restituisce una guardia che mantiene valido
+ * il documento finché esiste e non attende mai. publish() installa il nuovo
+ * documento con uno scambio atomico del puntatore e distrugge il vecchio
+ * solo quando tutti i lettori che potevano vederlo hanno rilasciato la
+ * guardia; più publish() concorrenti sono serializzati tra loro.
+ * Le guardie non devono sopravvivere al json_snapshot.
+ */
+class json_snapshot {
+
+public:
+
+    struct state;
+
+    class reader {
+
+    public:
+
+        reader(reader&& other) noexcept;
+        reader(reader const&) = delete;
+        reader& operator=(reader const&) = delete;
+        ~reader();
+
+        const_json_document const& operator*() const { return *doc; }
+        const_json_document const* operator->() const { return doc; }
+
+    private:
+
+        friend class json_snapshot;
+        reader(state* owner, unsigned slot, const_json_document const* doc);
+
+        state* owner;
+        unsigned slot;
+        const_json_document const* doc;
+
+    };
+
+    json_snapshot();
+    explicit json_snapshot(const_json_document doc);
+    json_snapshot(json_snapshot const&) = delete;
+    json_snapshot& operator=(json_snapshot const&) = delete;
+    ~json_snapshot();
+
+    reader read() const;
+    void publish(const_json_document doc);
+
+private:
+
+    state* st;
+
+};
+
+/*
+ * Documento che conserva il testo da cui è stato letto: ogni valore ricorda
+ * il proprio tratto di testo e le modifiche fatte tramite root() lo
+ * invalidano insieme a quello di tutti i contenitori che lo includono.
+ * Come per hash(), i metodi non const che restituiscono riferimenti o
+ * iteratori modificabili (operator[], begin_list, at_pointer, ...) contano
+ * come modifica al momento della chiamata, quindi anche gli scambi fatti
+ * con std::swap o std::sort sono riportati da write().
+ * write() copia dal testo i sottoalberi invariati e serializza come
+ * operator<< solo quelli modificati, quindi dopo poche modifiche costa in
+ * proporzione alle modifiche più che al documento. Il risultato è JSON
+ * equivalente a quello di operator<<, con la formattazione originale nei
+ * tratti copiati. Il costruttore lancia json_exception se il testo non è
+ * valido.
+ */
+class json_source_document {
+
+public:
+
+    explicit json_source_document(std::string text);
+
+    json& root();
+    json const& root() const;
+    std::string const& text() const;
+
+    void write(std::ostream& os) const;
+
+private:
+
+    std::string source;
+    json doc;
+    std::uint32_t id;
+
+};
+
+struct json_view::list_iterator
+{
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = json_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = json_view;
+
+    json_view list;
+    std::size_t index;
+
+    json_view operator*() const { return list[index]; }
+    json_view operator[](difference_type n) const { return list[index + n]; }
+
+    list_iterator &operator++() { ++index; return *this; }
+    list_iterator operator++(int) { list_iterator temp = *this; ++index; return temp; }
+    list_iterator &operator--() { --index; return *this; }
+    list_iterator operator--(int) { list_iterator temp = *this; --index; return temp; }
+    list_iterator &operator+=(difference_type n) { index += n; return *this; }
+    list_iterator &operator-=(difference_type n) { index -= n; return *this; }
+
+    friend list_iterator operator+(list_iterator it, difference_type n) { return it += n; }
+    friend list_iterator operator+(difference_type n, list_iterator it) { return it += n; }
+    friend list_iterator operator-(list_iterator it, difference_type n) { return it -= n; }
+    friend difference_type operator-(const list_iterator &a, const list_iterator &b)
+    {
+        return static_cast<difference_type>(a.index) - static_cast<difference_type>(b.index);
+    }
+
+    bool operator==(const list_iterator &other) const { return index == other.index; }
+    bool operator!=(const list_iterator &other) const { return index != other.index; }
+    bool operator<(const list_iterator &other) const { return index < other.index; }
+    bool operator>(const list_iterator &other) const { return index > other.index; }
+    bool operator<=(const list_iterator &other) const { return index <= other.index; }
+    bool operator>=(const list_iterator &other) const { return index >= other.index; }
+};
+
+struct json_view::dictionary_iterator
+{
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::pair<std::string_view, json_view>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = value_type;
+
+    json_view dict;
+    std::size_t index;
+
+    value_type operator*() const { return value_type(dict.key_at(index), dict.value_at(index)); }
+
+    dictionary_iterator &operator++() { ++index; return *this; }
+    dictionary_iterator operator++(int) { dictionary_iterator temp = *this; ++index; return temp; }
+
+    bool operator==(const dictionary_iterator &other) const { return index == other.index; }
+    bool operator!=(const dictionary_iterator &other) const { return index != other.index; }
+};
+
+inline json_view::list_iterator json_view::begin_list() const
+{
+    if (!is_list()) {
+        throw json_exception{"ERRORE: L'oggetto json non è una lista"};
+    }
+    return list_iterator{*this, 0};
+}
+
+inline json_view::list_iterator json_view::end_list() const
+{
+    if (!is_list()) {
+        throw json_exception{"ERRORE: L'oggetto json non è una lista"};
+    }
+    return list_iterator{*this, size()};
+}
+
+inline json_view::dictionary_iterator json_view::begin_dictionary() const
+{
+    if (!is_dictionary()) {
+        throw json_exception{"ERRORE: L'oggetto json non è un dizionario"};
+    }
+    return dictionary_iterator{*this, 0};
+}
+
+inline json_view::dictionary_iterator json_view::end_dictionary() const
+{
+    if (!is_dictionary()) {
+        throw json_exception{"ERRORE: L'oggetto json non è un dizionario"};
+    }
+    return dictionary_iterator{*this, size()};
+}
+
+/*
+ * Gli elementi di una lista sono memorizzati in modo contiguo, quindi gli
+ * iteratori di lista sono ad accesso casuale e utilizzabili con <algorithm>
+ * (std::sort, std::lower_bound, ...). Il controllo sull'iteratore vuoto è
+ * attivo solo nelle build di debug (senza NDEBUG).
+ * Le liste compatte di numeri e booleani non contengono oggetti json:
+ * list_iterator le espande, mentre const_list_iterator non modifica la
+ * lista e restituisce json_ref, che per un elemento compatto contiene il
+ * valore stesso. reference è quindi un tipo proxy, come per
+ * std::vector<bool>: gli algoritmi vanno usati con lambda che ricevono
+ * json_ref (o auto) e non json const&.
+ */
+struct json::list_iterator
+{
+    friend class json;
+    friend struct json::const_list_iterator;
+
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = json;
+    using difference_type = std::ptrdiff_t;
+    using pointer = json*;
+    using reference = json&;
+
+private:
+    json *current;
+
+    list_iterator(json *node) : current(node) {}
+
+public:
+    list_iterator() : current(nullptr) {}
+
+    list_iterator &operator++()
+    {
+        ++current;
+        return *this;
+    }
+
+    list_iterator operator++(int)
+    {
+        list_iterator temp = *this;
+        ++current;
+        return temp;
+    }
+
+    list_iterator &operator--()
+    {
+        --current;
+        return *this;
+    }
+
+    list_iterator operator--(int)
+    {
+        list_iterator temp = *this;
+        --current;
+        return temp;
+    }
+
+    list_iterator &operator+=(difference_type n)
+    {
+        current += n;
+        return *this;
+    }
+
+    list_iterator &operator-=(difference_type n)
+    {
+        current -= n;
+        return *this;
+    }
+
+    friend list_iterator operator+(list_iterator it, difference_type n) { return it += n; }
+    friend list_iterator operator+(difference_type n, list_iterator it) { return it += n; }
+    friend list_iterator operator-(list_iterator it, difference_type n) { return it -= n; }
+    friend difference_type operator-(const list_iterator &a, const list_iterator &b) { return a.current - b.current; }
+
+    json &operator*() const
+    {
+#ifndef NDEBUG
+        if (!current)
+        {
+            throw json_exception{"ERRORE: Tentativo di dereferenziare un iteratore vuoto"};
+        }
+#endif
+        return *current;
+    }
+
+    json *operator->() const
+    {
+        return &operator*();
+    }
+
+    json &operator[](difference_type n) const
+    {
+        return *(*this + n);
+    }
+
+    bool operator==(const list_iterator &other) const { return current == other.current; }
+    bool operator!=(const list_iterator &other) const { return current != other.current; }
+    bool operator<(const list_iterator &other) const { return current < other.current; }
+    bool operator>(const list_iterator &other) const { return current > other.current; }
+    bool operator<=(const list_iterator &other) const { return current <= other.current; }
+    bool operator>=(const list_iterator &other) const { return current >= other.current; }
+};
+
+struct json::const_list_iterator
+{
+    friend class json;
+
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = json;
+    using difference_type = std::ptrdiff_t;
+    using pointer = json_ref;
+    using reference = json_ref;
+
+private:
+    const json *current;     // Elemento corrente di una lista normale
+    const json *packed;      // Lista compatta percorsa (nullptr per le liste normali)
+    difference_type index;   // Posizione nella lista compatta
+
+    const_list_iterator(const json *node) : current(node), packed(nullptr), index(0) {}
+
+    const_list_iterator(const json *list, difference_type i) : current(nullptr), packed(list), index(i) {}
+
+public:
+    const_list_iterator() : current(nullptr), packed(nullptr), index(0) {}
+
+    const_list_iterator(const list_iterator &it) : current(it.current), packed(nullptr), index(0) {}
+
+    const_list_iterator &operator++()
+    {
+        return *this += 1;
+    }
+
+    const_list_iterator operator++(int)
+    {
+        const_list_iterator temp = *this;
+        *this += 1;
+        return temp;
+    }
+
+    const_list_iterator &operator--()
+    {
+        return *this -= 1;
+    }
+
+    const_list_iterator operator--(int)
+    {
+        const_list_iterator temp = *this;
+        *this -= 1;
+        return temp;
+    }
+
+    const_list_iterator &operator+=(difference_type n)
+    {
+        if (packed)
+        {
+            index += n;
+        }
+        else
+        {
+            current += n;
+        }
+        return *this;
+    }
+
+    const_list_iterator &operator-=(difference_type n)
+    {
+        return *this += -n;
+    }
+
+    friend const_list_iterator operator+(const_list_iterator it, difference_type n) { return it += n; }
+    friend const_list_iterator operator+(difference_type n, const_list_iterator it) { return it += n; }
+    friend const_list_iterator operator-(const_list_iterator it, difference_type n) { return it -= n; }
+    friend difference_type operator-(const const_list_iterator &a, const const_list_iterator &b)
+    {
+        return (a.current - b.current) + (a.index - b.index);
+    }
+
+    json_ref operator*() const
+    {
+        return operator[](0);
+    }
+
+    json_ref operator->() const
+    {
+        return operator*();
+    }
+
+    json_ref operator[](difference_type n) const
+    {
+        if (packed)
+        {
+            return packed->packed_item(static_cast<std::size_t>(index + n));
+        }
+#ifndef NDEBUG
+        if (!current)
+        {
+            throw json_exception{"ERRORE: Tentativo di dereferenziare un iteratore vuoto"};
+        }
+#endif
+        return current[n];
+    }
+
+    // Nelle liste normali index vale sempre 0, nelle compatte current è sempre nullptr
+    bool operator==(const const_list_iterator &other) const { return current == other.current && index == other.index; }
+    bool operator!=(const const_list_iterator &other) const { return !(*this == other); }
+    bool operator<(const const_list_iterator &other) const { return other - *this > 0; }
+    bool operator>(const const_list_iterator &other) const { return other < *this; }
+    bool operator<=(const const_list_iterator &other) const { return !(other < *this); }
+    bool operator>=(const const_list_iterator &other) const { return !(*this < other); }
+};
+
+/*
+ * Gli iteratori di dizionario sono bidirezionali e percorrono le coppie in
+ * ordine di inserimento. I nodi della lista delle coppie sono un tipo
+ * interno di json.cpp: l'iteratore li conserva come puntatori opachi e
+ * li percorre con json::dict_next e json::dict_prev. Un dizionario
+ * compattato da freeze() è invece un blocco contiguo di coppie.
+ */
+struct json::dictionary_iterator
+{
+    friend class json;
+
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::pair<std::string, json>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::pair<std::string, json>*;
+    using reference = std::pair<std::string, json>&;
+
+private:
+    const void *current;
+    // La lista di appartenenza serve per decrementare l'iteratore "past-the-end"
+    const void *owner;
+    // Posizione nel layout piatto, usata al posto dei nodi se il dizionario è compattato
+    std::pair<std::string, json> *flat;
+
+    dictionary_iterator(const void *node, const void *list)
+        : current(node), owner(list), flat(nullptr) {}
+
+    dictionary_iterator(std::pair<std::string, json> *entry)
+        : current(nullptr), owner(nullptr), flat(entry) {}
+
+public:
+    dictionary_iterator() : current(nullptr), owner(nullptr), flat(nullptr) {}
+
+    dictionary_iterator &operator++()
+    {
+        if (flat)
+        {
+            ++flat;
+        }
+        else if (current)
+        {
+            current = json::dict_next(current);
+        }
+        return *this;
+    }
+
+    dictionary_iterator operator++(int)
+    {
+        dictionary_iterator temp = *this;
+        ++(*this);
+        return temp;
+    }
+
+    dictionary_iterator &operator--()
+    {
+        if (flat)
+        {
+            --flat;
+        }
+        else
+        {
+            current = json::dict_prev(current, owner);
+        }
+        return *this;
+    }
+
+    dictionary_iterator operator--(int)
+    {
+        dictionary_iterator temp = *this;
+        --(*this);
+        return temp;
+    }
+
+    std::pair<std::string, json> &operator*() const
+    {
+        if (flat)
+        {
+            return *flat;
+        }
+#ifndef NDEBUG
+        if (!current)
+        {
+            throw json_exception{"ERRORE: Tentativo di dereferenziare un iteratore vuoto"};
+        }
+#endif
+        return json::dict_entry(current);
+    }
+
+    std::pair<std::string, json> *operator->() const
+    {
+        return &operator*();
+    }
+
+    bool operator==(const dictionary_iterator &other) const
+    {
+        return current == other.current && flat == other.flat;
+    }
+
+    bool operator!=(const dictionary_iterator &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+struct json::const_dictionary_iterator
+{
+    friend class json;
+
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::pair<std::string, json>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::pair<std::string, json>*;
+    using reference = const std::pair<std::string, json>&;
+
+private:
+    const void *current;
+    // La lista di appartenenza serve per decrementare l'iteratore "past-the-end"
+    const void *owner;
+    // Posizione nel layout piatto, usata al posto dei nodi se il dizionario è compattato
+    const std::pair<std::string, json> *flat;
+
+    const_dictionary_iterator(const void *node, const void *list)
+        : current(node), owner(list), flat(nullptr) {}
+
+    const_dictionary_iterator(const std::pair<std::string, json> *entry)
+        : current(nullptr), owner(nullptr), flat(entry) {}
+
+public:
+    const_dictionary_iterator() : current(nullptr), owner(nullptr), flat(nullptr) {}
+
+    const_dictionary_iterator(const dictionary_iterator &it) : current(it.current), owner(it.owner), flat(it.flat) {}
+
+    const_dictionary_iterator &operator++()
+    {
+        if (flat)
+        {
+            ++flat;
+        }
+        else if (current)
+        {
+            current = json::dict_next(current);
+        }
+        return *this;
+    }
+
+    const_dictionary_iterator operator++(int)
+    {
+        const_dictionary_iterator temp = *this;
+        ++(*this);
+        return temp;
+    }
+
+    const_dictionary_iterator &operator--()
+    {
+        if (flat)
+        {
+            --flat;
+        }
+        else
+        {
+            current = json::dict_prev(current, owner);
+        }
+        return *this;
+    }
+
+    const_dictionary_iterator operator--(int)
+    {
+        const_dictionary_iterator temp = *this;
+        --(*this);
+        return temp;
+    }
+
+    const std::pair<std::string, json> &operator*() const
+    {
+        if (flat)
+        {
+            return *flat;
+        }
+#ifndef NDEBUG
+        if (!current)
+        {
+            throw json_exception{"ERRORE: Tentativo di dereferenziare un iteratore vuoto"};
+        }
+#endif
+        return json::dict_entry(current);
+    }
+
+    const std::pair<std::string, json> *operator->() const
+    {
+        return &operator*();
+    }
+
+    bool operator==(const const_dictionary_iterator &other) const
+    {
+        return current == other.current && flat == other.flat;
+    }
+
+    bool operator!=(const const_dictionary_iterator &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+std::ostream& operator<<(std::ostream& lhs, json const& rhs);
+std::istream& operator>>(std::istream& lhs, json& rhs);
+
+/*
+ * Uguaglianza profonda: stesso tipo e stesso valore, con i dizionari
+ * confrontati senza tenere conto dell'ordine delle chiavi. Se gli hash dei
+ * due sottoalberi sono già in cache e differiscono il risultato è immediato.
+ */
+bool operator==(json const& lhs, json const& rhs);
+bool operator!=(json const& lhs, json const& rhs);
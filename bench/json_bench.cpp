@@ -0,0 +1,419 @@
+/*
+ * Benchmark di parsing, serializzazione e accesso per json.
+ *
+ * Compilazione (dalla radice del repository):
+ *     g++ -std=c++17 -O2 -DNDEBUG -I887017 887017/json.cpp bench/json_bench.cpp -o json_bench
+ *
+ * (aggiungere -mssse3 o -march=native per la validazione UTF-8 vettoriale)
+ *
+ * Uso:
+ *     ./json_bench [cartella_corpus] [file_risultati]
+ *
+ * Se nella cartella ci sono twitter.json, canada.json o citm_catalog.json
+ * vengono misurati insieme ai documenti sintetici (profondo, largo, lista
+ * di numeri, record, catalogo con blocchi ripetuti). I risultati sono
+ * scritti come un array json (uno oggetto per misura, più la memoria
+ * occupata dove indicato) nel file indicato, oppure su stdout.
+ */
+#include "json.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+namespace {
+
+struct result {
+    std::string name;
+    std::string input;
+    double ns_per_op;
+    double mb_per_s;     // 0 se la misura non riguarda un volume di byte
+    std::size_t iterations;
+};
+
+std::vector<result> results;
+
+// Misure di memoria (byte secondo json::memory_usage), scritte dopo i tempi
+struct footprint {
+    std::string name;
+    std::string input;
+    std::size_t bytes;
+};
+
+std::vector<footprint> footprints;
+
+// Ripete op fino a superare min_seconds e restituisce il tempo medio per operazione
+double measure(const std::function<void()>& op, std::size_t& iterations, double min_seconds = 0.3) {
+    using clock = std::chrono::steady_clock;
+    op(); // riscaldamento
+    iterations = 0;
+    std::size_t batch = 1;
+    double elapsed = 0;
+    while (elapsed < min_seconds) {
+        auto start = clock::now();
+        for (std::size_t i = 0; i < batch; ++i) {
+            op();
+        }
+        elapsed += std::chrono::duration<double>(clock::now() - start).count();
+        iterations += batch;
+        batch *= 2;
+    }
+    return elapsed * 1e9 / iterations;
+}
+
+void record(const std::string& name, const std::string& input, std::size_t bytes, const std::function<void()>& op) {
+    std::size_t iterations;
+    double ns = measure(op, iterations);
+    double mbs = bytes ? (bytes / 1e6) / (ns / 1e9) : 0.0;
+    results.push_back(result{name, input, ns, mbs, iterations});
+    std::fprintf(stderr, "%-22s %-18s %14.1f ns/op %10.1f MB/s\n", name.c_str(), input.c_str(), ns, mbs);
+}
+
+json parse_text(const std::string& text, std::pmr::memory_resource* resource = nullptr) {
+    json doc(resource);
+    json_parse_result result = json::parse(text, doc);
+    if (!result) {
+        throw json_exception{result.message()};
+    }
+    return doc;
+}
+
+std::string serialize(const json& doc) {
+    std::ostringstream os;
+    os << doc;
+    return os.str();
+}
+
+std::string deep_document(std::size_t depth) {
+    std::string text;
+    for (std::size_t i = 0; i < depth; ++i) {
+        text += i % 2 ? "[" : "{\"k\": ";
+    }
+    text += "1";
+    for (std::size_t i = depth; i-- > 0;) {
+        text += i % 2 ? "]" : "}";
+    }
+    return text;
+}
+
+std::string wide_document(std::size_t keys) {
+    std::string text = "{";
+    for (std::size_t i = 0; i < keys; ++i) {
+        text += (i ? ", \"key_" : "\"key_") + std::to_string(i) + "\": " + std::to_string(i);
+    }
+    return text + "}";
+}
+
+std::string numbers_document(std::size_t count) {
+    std::string text = "[";
+    for (std::size_t i = 0; i < count; ++i) {
+        text += (i ? ", " : "") + std::to_string(i * 0.25 - 1000.0);
+    }
+    return text + "]";
+}
+
+std::string records_document(std::size_t records, std::size_t fields) {
+    std::string text = "[";
+    for (std::size_t r = 0; r < records; ++r) {
+        text += r ? ", {" : "{";
+        for (std::size_t f = 0; f < fields; ++f) {
+            text += (f ? ", \"field_" : "\"field_") + std::to_string(f) + "\": ";
+            text += f % 3 == 0 ? "\"value " + std::to_string(r) + "\"" : std::to_string(r * f);
+        }
+        text += "}";
+    }
+    return text + "]";
+}
+
+std::string utf8_document(std::size_t count) {
+    const char* words[] = {"perché", "città", "naïve", "Größe", "日本語のテキスト", "😀 emoji", "ascii only text"};
+    std::string text = "[";
+    for (std::size_t i = 0; i < count; ++i) {
+        text += (i ? ", \"" : "\"") + std::string(words[i % 7]) + " " + words[(i * 3) % 7] + " " + words[(i * 5) % 7] + "\"";
+    }
+    return text + "]";
+}
+
+// Catalogo con blocchi identici ripetuti (valuta, indirizzo) in ogni prodotto
+std::string catalog_document(std::size_t products) {
+    const char* currencies[] = {
+        "{\"code\": \"EUR\", \"symbol\": \"€\", \"decimals\": 2, \"rounding\": 0.01}",
+        "{\"code\": \"USD\", \"symbol\": \"$\", \"decimals\": 2, \"rounding\": 0.01}",
+        "{\"code\": \"JPY\", \"symbol\": \"¥\", \"decimals\": 0, \"rounding\": 1}"};
+    const char* warehouses[] = {
+        "{\"city\": \"Milano\", \"street\": \"Via Roma 1\", \"zip\": \"20100\", \"tags\": [\"nord\", \"hub\"]}",
+        "{\"city\": \"Napoli\", \"street\": \"Via Toledo 5\", \"zip\": \"80100\", \"tags\": [\"sud\"]}"};
+    std::string text = "[";
+    for (std::size_t i = 0; i < products; ++i) {
+        text += i ? ", {" : "{";
+        text += "\"sku\": \"P" + std::to_string(i) + "\", \"price\": " + std::to_string(i % 500) + ".5";
+        text += ", \"currency\": " + std::string(currencies[i % 3]);
+        text += ", \"warehouse\": " + std::string(warehouses[i % 2]) + ", \"active\": true}";
+    }
+    return text + "]";
+}
+
+bool read_file(const std::string& path, std::string& out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+void bench_document(const std::string& input, const std::string& text) {
+    record("parse", input, text.size(), [&] { parse_text(text); });
+    record("validate", input, text.size(), [&] { json::validate(text); });
+    // Senza controllo UTF-8: misura il costo della validazione fusa nella scansione delle stringhe
+    record("parse_trusted", input, text.size(), [&] {
+        json doc;
+        json::parse(text, doc, 512, false);
+    });
+
+    // Input rifiutato all'ultimo byte: il costo deve restare vicino a quello di un parsing riuscito
+    std::string broken = text;
+    broken.back() = ',';
+    record("parse_reject", input, broken.size(), [&] {
+        json doc;
+        json::parse(broken, doc);
+    });
+
+    json doc = parse_text(text);
+    std::string compact = serialize(doc);
+    record("serialize", input, compact.size(), [&] { serialize(doc); });
+    // Scrittore con buffer: compatto, indentato (deve restare entro 1.5x) e canonico
+    std::string minimal = doc.to_string();
+    json_write_options pretty;
+    pretty.indent = 2;
+    json_write_options canonical;
+    canonical.canonical = true;
+    record("write_compact", input, minimal.size(), [&] { doc.to_string(); });
+    record("write_pretty", input, minimal.size(), [&] { doc.to_string(pretty); });
+    record("write_canonical", input, minimal.size(), [&] { doc.to_string(canonical); });
+
+    // La copia viene distrutta a fine lambda: la misura comprende entrambe le operazioni
+    record("copy_destroy", input, 0, [&] { json copy(doc); });
+    record("move", input, 0, [&] { json moved(std::move(doc)); doc = std::move(moved); });
+
+    // Uguaglianza profonda tra due alberi distinti, poi con gli hash già in cache
+    json twin = parse_text(text);
+    record("equal", input, text.size(), [&] { volatile bool same = doc == twin; (void)same; });
+    record("equal_serialized", input, text.size(), [&] { volatile bool same = serialize(doc) == serialize(twin); (void)same; });
+    doc.hash();
+    twin.hash();
+    record("hash_cached", input, 0, [&] { volatile std::uint64_t h = doc.hash(); (void)h; });
+
+    std::stringstream cbor;
+    doc.to_cbor(cbor);
+    std::string cbor_bytes = cbor.str();
+    record("cbor_write", input, cbor_bytes.size(), [&] { std::ostringstream os; doc.to_cbor(os); });
+    record("cbor_read", input, cbor_bytes.size(), [&] {
+        std::istringstream is(cbor_bytes);
+        json decoded;
+        decoded.from_cbor(is);
+    });
+}
+
+// Parsing e distruzione con allocatori pmr al posto dello heap globale
+void bench_allocators(const std::string& input, const std::string& text) {
+    record("parse_monotonic", input, text.size(), [&] {
+        std::pmr::monotonic_buffer_resource arena;
+        parse_text(text, &arena);
+    });
+    std::pmr::unsynchronized_pool_resource pool;
+    record("parse_pool", input, text.size(), [&] { parse_text(text, &pool); });
+}
+
+// Condivisione dei sottoalberi ripetuti: tempi e memoria prima e dopo
+void bench_dedup(const std::string& input, const std::string& text) {
+    record("parse_deduplicated", input, text.size(), [&] {
+        json doc;
+        json::parse_deduplicated(text, doc);
+    });
+    record("parse_then_deduplicate", input, text.size(), [&] { parse_text(text).deduplicate(); });
+
+    json plain = parse_text(text);
+    json shared;
+    json::parse_deduplicated(text, shared);
+    footprints.push_back(footprint{"memory_plain", input, plain.memory_usage().total});
+    footprints.push_back(footprint{"memory_deduplicated", input, shared.memory_usage().total});
+}
+
+void bench_lookup(std::size_t keys) {
+    json dict = parse_text(wide_document(keys));
+    std::vector<std::string> probes;
+    for (std::size_t i = 0; i < 64; ++i) {
+        probes.push_back("key_" + std::to_string((i * 7919) % keys));
+    }
+    const json& linked = dict;
+    std::size_t next = 0;
+    std::string input = "dict_" + std::to_string(keys);
+    record("lookup", input, 0, [&] { linked[probes[next++ % probes.size()]]; });
+
+    json frozen = dict;
+    frozen.freeze();
+    const json& flat = frozen;
+    record("lookup_frozen", input, 0, [&] { flat[probes[next++ % probes.size()]]; });
+
+    json_path path("/" + probes[0]);
+    record("json_path", input, 0, [&] { path.find(flat); });
+
+    // Patch piccola e ripetibile: il costo dipende dal percorso, non dal documento
+    json patch = parse_text("[{\"op\": \"replace\", \"path\": \"/" + probes[1] + "\", \"value\": 1},"
+                            " {\"op\": \"add\", \"path\": \"/extra\", \"value\": [1, 2]},"
+                            " {\"op\": \"remove\", \"path\": \"/extra\"}]");
+    record("apply_patch", input, 0, [&] { dict.apply_patch(patch); });
+    record("apply_patch_frozen", input, 0, [&] { frozen.apply_patch(patch); });
+}
+
+void bench_projection(const std::string& text) {
+    json_projection few;
+    few.add("/*/field_1");
+    few.add("/*/field_7");
+    few.add("/*/field_42");
+    record("parse_projection", "records", text.size(), [&] {
+        json doc;
+        few.parse(text, doc);
+    });
+}
+
+// Differenza tra due versioni vicine: dopo la prima chiamata gli hash sono in cache
+void bench_diff(const std::string& input, const std::string& text) {
+    json before = parse_text(text);
+    json after = before;
+    after.apply_patch(parse_text("[{\"op\": \"replace\", \"path\": \"/1000/field_7\", \"value\": -1},"
+                                 " {\"op\": \"remove\", \"path\": \"/1500/field_3\"},"
+                                 " {\"op\": \"add\", \"path\": \"/500\", \"value\": {\"field_0\": \"new\"}}]"));
+    record("diff", input, text.size(), [&] { json::diff(before, after); });
+}
+
+// Riscrittura dopo una modifica: i tratti invariati sono copiati dal testo originale
+void bench_source(const std::string& input, const std::string& text) {
+    json_source_document doc(text);
+    doc.root().at_pointer("/1000/field_7").set_number(-1);
+    record("write_source_edited", input, text.size(), [&] {
+        std::ostringstream os;
+        doc.write(os);
+    });
+}
+
+// Scrittura parallela con 1, 2, 4 thread e tutti i core, in un sink che scarta i byte
+void bench_parallel(const std::string& input, const std::string& text) {
+    struct discard : json_sink {
+        void write(const char*, std::size_t) override {}
+    };
+    json doc = parse_text(text);
+    std::size_t size = doc.to_string().size();
+    std::vector<std::size_t> counts = {1, 2, 4};
+    std::size_t cores = std::thread::hardware_concurrency();
+    if (cores > 4) {
+        counts.push_back(cores);
+    }
+    for (std::size_t threads : counts) {
+        json_write_options options;
+        options.threads = threads;
+        discard sink;
+        record("write_threads_" + std::to_string(threads), input, size, [&] { doc.write(sink, options); });
+    }
+}
+
+// Scrittura su file: operator<< su ofstream, json::write su ofstream e json_file_sink
+void bench_file(const std::string& input, const std::string& text) {
+    const char* path = "json_bench_output.tmp";
+    json doc = parse_text(text);
+    std::size_t size = doc.to_string().size();
+    record("file_operator", input, size, [&] {
+        std::ofstream out(path, std::ios::binary);
+        out << doc;
+    });
+    record("file_write_ofstream", input, size, [&] {
+        std::ofstream out(path, std::ios::binary);
+        doc.write(out);
+    });
+    record("file_sink", input, size, [&] {
+        json_file_sink out(path);
+        doc.write(out);
+        out.close();
+    });
+    std::remove(path);
+}
+
+void bench_numbers(const std::string& text) {
+    json doc = parse_text(text);
+    std::vector<double> out(doc.size());
+    record("copy_numbers", "numbers", out.size() * sizeof(double), [&] { doc.copy_numbers(out.data(), out.size()); });
+    record("sum_numbers", "numbers", out.size() * sizeof(double), [&] { doc.sum_numbers(); });
+}
+
+void write_results(std::ostream& os) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    os << "[\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const result& r = results[i];
+        os << "  {\"benchmark\": \"" << r.name << "\", \"input\": \"" << r.input
+           << "\", \"ns_per_op\": " << r.ns_per_op << ", \"mb_per_s\": " << r.mb_per_s
+           << ", \"iterations\": " << r.iterations << "},\n";
+    }
+    for (const footprint& f : footprints) {
+        os << "  {\"benchmark\": \"" << f.name << "\", \"input\": \"" << f.input << "\", \"bytes\": " << f.bytes << "},\n";
+    }
+    // ru_maxrss è in KB su Linux
+    os << "  {\"benchmark\": \"peak_rss\", \"input\": \"process\", \"kb\": " << usage.ru_maxrss << "}\n]\n";
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string corpus = argc > 1 ? argv[1] : ".";
+    try {
+        for (const char* name : {"twitter.json", "canada.json", "citm_catalog.json"}) {
+            std::string text;
+            if (read_file(corpus + "/" + name, text)) {
+                bench_document(name, text);
+                bench_allocators(name, text);
+            }
+        }
+        bench_document("synthetic_deep", deep_document(200));
+        bench_document("synthetic_wide", wide_document(20000));
+        std::string numbers = numbers_document(200000);
+        bench_document("synthetic_numbers", numbers);
+        bench_document("synthetic_utf8", utf8_document(100000));
+        bench_numbers(numbers);
+        std::string records = records_document(2000, 120);
+        bench_document("synthetic_records", records);
+        bench_allocators("synthetic_records", records);
+        bench_projection(records);
+        bench_diff("synthetic_records", records);
+        bench_source("synthetic_records", records);
+        std::string catalog = catalog_document(20000);
+        bench_document("synthetic_catalog", catalog);
+        bench_dedup("synthetic_catalog", catalog);
+        bench_parallel("synthetic_records", records);
+        bench_parallel("synthetic_catalog", catalog);
+        bench_file("synthetic_records", records);
+        bench_lookup(16);
+        bench_lookup(4096);
+    } catch (json_exception& e) {
+        std::fprintf(stderr, "json_exception: %s\n", e.msg.c_str());
+        return 1;
+    }
+
+    if (argc > 2) {
+        std::ofstream out(argv[2]);
+        write_results(out);
+    } else {
+        write_results(std::cout);
+    }
+    return 0;
+}
@@ -0,0 +1,959 @@
+/*
+ * Test di conformità e di regressione per json.
+ *
+ * Compilazione (dalla radice del repository):
+ *     g++ -std=c++17 -O1 -g -I887017 887017/json.cpp tests/json_tests.cpp -o json_tests
+ *
+ * (aggiungere -fsanitize=address,undefined per i controlli di memoria)
+ *
+ * Uso:
+ *     ./json_tests
+ *
+ * I casi di conformità sono presi da JSONTestSuite (N. Seriot, "Parsing
+ * JSON is a Minefield"), con lo stesso nome del file originale: y_ deve
+ * essere accettato, n_ rifiutato, i_ è a discrezione dell'implementazione
+ * e deve solo essere gestito senza errori di memoria. Ogni caso passa per
+ * json::parse, json::validate e json_push_parser (un blocco intero e un
+ * byte alla volta). Il programma termina con 1 se un controllo fallisce.
+ */
+#include "json.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+std::size_t failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        ++failures;
+        std::fprintf(stderr, "FALLITO: %s\n", what.c_str());
+    }
+}
+
+struct conformance_case {
+    const char* name;
+    std::string_view text;
+};
+
+#define CASE(name, text) {name, std::string_view(text, sizeof(text) - 1)}
+
+const conformance_case cases[] = {
+    CASE("y_array_arraysWithSpaces", "[[]   ]"),
+    CASE("y_array_empty-string", "[\"\"]"),
+    CASE("y_array_empty", "[]"),
+    CASE("y_array_ending_with_newline", "[\"a\"]"),
+    CASE("y_array_false", "[false]"),
+    CASE("y_array_heterogeneous", "[null, 1, \"1\", {}]"),
+    CASE("y_array_null", "[null]"),
+    CASE("y_array_with_1_and_newline", "[1\n]"),
+    CASE("y_array_with_leading_space", " [1]"),
+    CASE("y_array_with_several_null", "[1,null,null,null,2]"),
+    CASE("y_array_with_trailing_space", "[2] "),
+    CASE("y_number", "[123e65]"),
+    CASE("y_number_0e+1", "[0e+1]"),
+    CASE("y_number_0e1", "[0e1]"),
+    CASE("y_number_after_space", "[ 4]"),
+    CASE("y_number_double_close_to_zero",
+         "[-0.000000000000000000000000000000000000000000000000000000000000000000000000000001]"),
+    CASE("y_number_int_with_exp", "[20e1]"),
+    CASE("y_number_minus_zero", "[-0]"),
+    CASE("y_number_negative_int", "[-123]"),
+    CASE("y_number_negative_one", "[-1]"),
+    CASE("y_number_real_capital_e", "[1E22]"),
+    CASE("y_number_real_capital_e_neg_exp", "[1E-2]"),
+    CASE("y_number_real_capital_e_pos_exp", "[1E+2]"),
+    CASE("y_number_real_exponent", "[123e45]"),
+    CASE("y_number_real_fraction_exponent", "[123.456e78]"),
+    CASE("y_number_real_neg_exp", "[1e-2]"),
+    CASE("y_number_real_pos_exponent", "[1e+2]"),
+    CASE("y_number_simple_int", "[123]"),
+    CASE("y_number_simple_real", "[123.456789]"),
+    CASE("y_object", "{\"asd\":\"sdf\", \"dfg\":\"fgh\"}"),
+    CASE("y_object_basic", "{\"asd\":\"sdf\"}"),
+    CASE("y_object_duplicated_key", "{\"a\":\"b\",\"a\":\"c\"}"),
+    CASE("y_object_duplicated_key_and_value", "{\"a\":\"b\",\"a\":\"b\"}"),
+    CASE("y_object_empty", "{}"),
+    CASE("y_object_empty_key", "{\"\":0}"),
+    CASE("y_object_escaped_null_in_key", "{\"foo\\u0000bar\": 42}"),
+    CASE("y_object_extreme_numbers", "{ \"min\": -1.0e+28, \"max\": 1.0e+28 }"),
+    CASE("y_object_long_strings", "{\"x\":[{\"id\": \"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\"}], "
+                                  "\"id\": \"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\"}"),
+    CASE("y_object_simple", "{\"a\":[]}"),
+    CASE("y_object_string_unicode", "{\"title\":\"\\u041f\\u043e\\u043b\\u0442\\u043e\\u0440\\u0430 "
+                                    "\\u0417\\u0435\\u043c\\u043b\\u0435\\u043a\\u043e\\u043f\\u0430\" }"),
+    CASE("y_object_with_newlines", "{\n\"a\": \"b\"\n}"),
+    CASE("y_string_1_2_3_bytes_UTF-8_sequences", "[\"\\u0060\\u012a\\u12AB\"]"),
+    CASE("y_string_accepted_surrogate_pair", "[\"\\uD801\\udc37\"]"),
+    CASE("y_string_accepted_surrogate_pairs", "[\"\\ud83d\\ude39\\ud83d\\udc8d\"]"),
+    CASE("y_string_allowed_escapes", "[\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"]"),
+    CASE("y_string_backslash_and_u_escaped_zero", "[\"\\\\u0000\"]"),
+    CASE("y_string_backslash_doublequotes", "[\"\\\"\"]"),
+    CASE("y_string_comments", "[\"a/*b*/c/*d//e\"]"),
+    CASE("y_string_double_escape_a", "[\"\\\\a\"]"),
+    CASE("y_string_double_escape_n", "[\"\\\\n\"]"),
+    CASE("y_string_escaped_control_character", "[\"\\u0012\"]"),
+    CASE("y_string_escaped_noncharacter", "[\"\\uFFFF\"]"),
+    CASE("y_string_in_array", "[\"asd\"]"),
+    CASE("y_string_in_array_with_leading_space", "[ \"asd\"]"),
+    CASE("y_string_last_surrogates_1_and_2", "[\"\\uDBFF\\uDFFF\"]"),
+    CASE("y_string_nbsp_uescaped", "[\"new\\u00A0line\"]"),
+    CASE("y_string_nonCharacterInUTF-8_U+10FFFF", "[\"\xf4\x8f\xbf\xbf\"]"),
+    CASE("y_string_nonCharacterInUTF-8_U+FFFF", "[\"\xef\xbf\xbf\"]"),
+    CASE("y_string_null_escape", "[\"\\u0000\"]"),
+    CASE("y_string_one-byte-utf-8", "[\"\\u002c\"]"),
+    CASE("y_string_pi", "[\"\xcf\x80\"]"),
+    CASE("y_string_simple_ascii", "[\"asd \"]"),
+    CASE("y_string_space", "\" \""),
+    CASE("y_string_three-byte-utf-8", "[\"\\u0821\"]"),
+    CASE("y_string_two-byte-utf-8", "[\"\\u0123\"]"),
+    CASE("y_string_u+2028_line_sep", "[\"\xe2\x80\xa8\"]"),
+    CASE("y_string_utf8", "[\"\xe2\x82\xac\xf0\x9d\x84\x9e\"]"),
+    CASE("y_string_with_del_character", "[\"a\x7f" "a\"]"),
+    CASE("y_structure_lonely_false", "false"),
+    CASE("y_structure_lonely_int", "42"),
+    CASE("y_structure_lonely_negative_real", "-0.1"),
+    CASE("y_structure_lonely_null", "null"),
+    CASE("y_structure_lonely_string", "\"asd\""),
+    CASE("y_structure_lonely_true", "true"),
+    CASE("y_structure_string_empty", "\"\""),
+    CASE("y_structure_trailing_newline", "[\"a\"]\n"),
+    CASE("y_structure_true_in_array", "[true]"),
+    CASE("y_structure_whitespace_array", " [] "),
+
+    CASE("n_array_1_true_without_comma", "[1 true]"),
+    CASE("n_array_a_invalid_utf8", "[a\xe5]"),
+    CASE("n_array_colon_instead_of_comma", "[\"\": 1]"),
+    CASE("n_array_comma_after_close", "[\"\"],"),
+    CASE("n_array_comma_and_number", "[,1]"),
+    CASE("n_array_double_comma", "[1,,2]"),
+    CASE("n_array_double_extra_comma", "[\"x\",,]"),
+    CASE("n_array_extra_close", "[\"x\"]]"),
+    CASE("n_array_extra_comma", "[\"\",]"),
+    CASE("n_array_incomplete", "[\"x\""),
+    CASE("n_array_incomplete_invalid_value", "[x"),
+    CASE("n_array_inner_array_no_comma", "[3[4]]"),
+    CASE("n_array_invalid_utf8", "[\xff]"),
+    CASE("n_array_items_separated_by_semicolon", "[1:2]"),
+    CASE("n_array_just_comma", "[,]"),
+    CASE("n_array_just_minus", "[-]"),
+    CASE("n_array_missing_value", "[   , \"\"]"),
+    CASE("n_array_newlines_unclosed", "[\"a\",\n4\n,1,"),
+    CASE("n_array_number_and_comma", "[1,]"),
+    CASE("n_array_number_and_several_commas", "[1,,]"),
+    CASE("n_array_star_inside", "[*]"),
+    CASE("n_array_unclosed", "[\"\""),
+    CASE("n_array_unclosed_trailing_comma", "[1,"),
+    CASE("n_array_unclosed_with_new_lines", "[1,\n1\n,1"),
+    CASE("n_array_unclosed_with_object_inside", "[{}"),
+    CASE("n_incomplete_false", "[fals]"),
+    CASE("n_incomplete_null", "[nul]"),
+    CASE("n_incomplete_true", "[tru]"),
+    CASE("n_multidigit_number_then_00", "123\0"),
+    CASE("n_number_++", "[++1234]"),
+    CASE("n_number_+1", "[+1]"),
+    CASE("n_number_+Inf", "[+Inf]"),
+    CASE("n_number_-01", "[-01]"),
+    CASE("n_number_-1.0.", "[-1.0.]"),
+    CASE("n_number_-2.", "[-2.]"),
+    CASE("n_number_-NaN", "[-NaN]"),
+    CASE("n_number_.-1", "[.-1]"),
+    CASE("n_number_.2e-3", "[.2e-3]"),
+    CASE("n_number_0.1.2", "[0.1.2]"),
+    CASE("n_number_0.3e+", "[0.3e+]"),
+    CASE("n_number_0.3e", "[0.3e]"),
+    CASE("n_number_0.e1", "[0.e1]"),
+    CASE("n_number_0_capital_E+", "[0E+]"),
+    CASE("n_number_0_capital_E", "[0E]"),
+    CASE("n_number_0e+", "[0e+]"),
+    CASE("n_number_0e", "[0e]"),
+    CASE("n_number_1.0e+", "[1.0e+]"),
+    CASE("n_number_1.0e-", "[1.0e-]"),
+    CASE("n_number_1.0e", "[1.0e]"),
+    CASE("n_number_1_000", "[1 000.0]"),
+    CASE("n_number_1eE2", "[1eE2]"),
+    CASE("n_number_2.e+3", "[2.e+3]"),
+    CASE("n_number_9.e+", "[9.e+]"),
+    CASE("n_number_Inf", "[Inf]"),
+    CASE("n_number_NaN", "[NaN]"),
+    CASE("n_number_U+FF11_fullwidth_digit_one", "[\xef\xbc\x91]"),
+    CASE("n_number_expression", "[1+2]"),
+    CASE("n_number_hex_1_digit", "[0x1]"),
+    CASE("n_number_hex_2_digits", "[0x42]"),
+    CASE("n_number_infinity", "[Infinity]"),
+    CASE("n_number_invalid+-", "[0e+-1]"),
+    CASE("n_number_invalid-negative-real", "[-123.123foo]"),
+    CASE("n_number_minus_infinity", "[-Infinity]"),
+    CASE("n_number_minus_sign_with_trailing_garbage", "[-foo]"),
+    CASE("n_number_minus_space_1", "[- 1]"),
+    CASE("n_number_neg_int_starting_with_zero", "[-012]"),
+    CASE("n_number_neg_real_without_int_part", "[-.123]"),
+    CASE("n_number_neg_with_garbage_at_end", "[-1x]"),
+    CASE("n_number_real_garbage_after_e", "[1ea]"),
+    CASE("n_number_real_without_fractional_part", "[1.]"),
+    CASE("n_number_starting_with_dot", "[.123]"),
+    CASE("n_number_with_alpha", "[1.2a-3]"),
+    CASE("n_number_with_alpha_char", "[1.8011670033376514H-308]"),
+    CASE("n_number_with_leading_zero", "[012]"),
+    CASE("n_object_bad_value", "[\"x\", truth]"),
+    CASE("n_object_bracket_key", "{[: \"x\"}"),
+    CASE("n_object_comma_instead_of_colon", "{\"x\", null}"),
+    CASE("n_object_double_colon", "{\"x\"::\"b\"}"),
+    CASE("n_object_garbage_at_end", "{\"a\":\"a\" 123}"),
+    CASE("n_object_key_with_single_quotes", "{key: 'value'}"),
+    CASE("n_object_missing_colon", "{\"a\" b}"),
+    CASE("n_object_missing_key", "{:\"b\"}"),
+    CASE("n_object_missing_semicolon", "{\"a\" \"b\"}"),
+    CASE("n_object_missing_value", "{\"a\":"),
+    CASE("n_object_no-colon", "{\"a\""),
+    CASE("n_object_non_string_key", "{1:1}"),
+    CASE("n_object_repeated_null_null", "{null:null,null:null}"),
+    CASE("n_object_several_trailing_commas", "{\"id\":0,,,,,}"),
+    CASE("n_object_single_quote", "{'a':0}"),
+    CASE("n_object_trailing_comma", "{\"id\":0,}"),
+    CASE("n_object_trailing_comment", "{\"a\":\"b\"}/**/"),
+    CASE("n_object_two_commas_in_a_row", "{\"a\":\"b\",,\"c\":\"d\"}"),
+    CASE("n_object_unquoted_key", "{a: \"b\"}"),
+    CASE("n_object_unterminated-value", "{\"a\":\"a"),
+    CASE("n_object_with_single_string", "{ \"foo\" : \"bar\", \"a\" }"),
+    CASE("n_object_with_trailing_garbage", "{\"a\":\"b\"}#"),
+    CASE("n_single_space", " "),
+    CASE("n_string_1_surrogate_then_escape", "[\"\\uD800\\\"]"),
+    CASE("n_string_accentuated_char_no_quotes", "[\xc3\xa9]"),
+    CASE("n_string_backslash_00", "[\"\\\0\"]"),
+    CASE("n_string_escape_x", "[\"\\x00\"]"),
+    CASE("n_string_escaped_backslash_bad", "[\"\\\\\\\"]"),
+    CASE("n_string_escaped_ctrl_char_tab", "[\"\\\t\"]"),
+    CASE("n_string_incomplete_escape", "[\"\\\"]"),
+    CASE("n_string_incomplete_escaped_character", "[\"\\u00A\"]"),
+    CASE("n_string_incomplete_surrogate_escape_invalid", "[\"\\uD800\\uD800\\x\"]"),
+    CASE("n_string_invalid_backslash_esc", "[\"\\a\"]"),
+    CASE("n_string_invalid_unicode_escape", "[\"\\uqqqq\"]"),
+    CASE("n_string_invalid_utf8_after_escape", "[\"\\\xe5\"]"),
+    CASE("n_string_leading_uescaped_thinspace", "[\\u0020\"asd\"]"),
+    CASE("n_string_no_quotes_with_bad_escape", "[\\n]"),
+    CASE("n_string_single_doublequote", "\""),
+    CASE("n_string_single_quote", "['single quote']"),
+    CASE("n_string_single_string_no_double_quotes", "abc"),
+    CASE("n_string_start_escape_unclosed", "[\"\\"),
+    CASE("n_string_unescaped_ctrl_char", "[\"a\0a\"]"),
+    CASE("n_string_unescaped_newline", "[\"new\nline\"]"),
+    CASE("n_string_unescaped_tab", "[\"\t\"]"),
+    CASE("n_string_unicode_CapitalU", "\"\\UA66D\""),
+    CASE("n_string_with_trailing_garbage", "\"\"x"),
+    CASE("n_structure_angle_bracket_.", "<.>"),
+    CASE("n_structure_angle_bracket_null", "[<null>]"),
+    CASE("n_structure_array_trailing_garbage", "[1]x"),
+    CASE("n_structure_array_with_extra_array_close", "[1]]"),
+    CASE("n_structure_array_with_unclosed_string", "[\"asd]"),
+    CASE("n_structure_capitalized_True", "[True]"),
+    CASE("n_structure_close_unopened_array", "1]"),
+    CASE("n_structure_comma_instead_of_closing_brace", "{\"x\": true,"),
+    CASE("n_structure_double_array", "[][]"),
+    CASE("n_structure_end_array", "]"),
+    CASE("n_structure_lone-open-bracket", "["),
+    CASE("n_structure_no_data", ""),
+    CASE("n_structure_null-byte-outside-string", "[\0]"),
+    CASE("n_structure_number_with_trailing_garbage", "2@"),
+    CASE("n_structure_object_followed_by_closing_object", "{}}"),
+    CASE("n_structure_object_unclosed_no_value", "{\"\":"),
+    CASE("n_structure_object_with_comment", "{\"a\":/*comment*/\"b\"}"),
+    CASE("n_structure_object_with_trailing_garbage", "{\"a\": true} \"x\""),
+    CASE("n_structure_open_array_apostrophe", "['"),
+    CASE("n_structure_open_array_comma", "[,"),
+    CASE("n_structure_open_object", "{"),
+    CASE("n_structure_single_star", "*"),
+    CASE("n_structure_trailing_#", "{\"a\":\"b\"}#{}"),
+    CASE("n_structure_unclosed_array", "[1"),
+    CASE("n_structure_unclosed_object", "{\"asd\":\"asd\""),
+    CASE("n_structure_UTF8_BOM_no_data", "\xef\xbb\xbf"),
+    CASE("n_structure_whitespace_formfeed", "[\f]"),
+    CASE("n_structure_whitespace_U+2060_word_joiner", "[\xe2\x81\xa0]"),
+
+    CASE("i_number_double_huge_neg_exp", "[123.456e-789]"),
+    CASE("i_number_neg_int_huge_exp", "[-1e+9999]"),
+    CASE("i_number_pos_double_huge_exp", "[1.5e+9999]"),
+    CASE("i_number_real_neg_overflow", "[-123123e100000]"),
+    CASE("i_number_real_pos_overflow", "[123123e100000]"),
+    CASE("i_number_real_underflow", "[123e-10000000]"),
+    CASE("i_number_too_big_neg_int", "[-123123123123123123123123123123]"),
+    CASE("i_number_too_big_pos_int", "[100000000000000000000]"),
+    CASE("i_number_very_big_negative_int", "[-237462374673276894279832749832423479823246327846]"),
+    CASE("i_object_key_lone_2nd_surrogate", "{\"\\uDFAA\":0}"),
+    CASE("i_string_1st_surrogate_but_2nd_missing", "[\"\\uDADA\"]"),
+    CASE("i_string_1st_valid_surrogate_2nd_invalid", "[\"\\uD888\\u1234\"]"),
+    CASE("i_string_UTF-8_invalid_sequence", "[\"\xe6\x97\xa5\xd1\x88\xfa\"]"),
+    CASE("i_string_UTF8_surrogate_U+D800", "[\"\xed\xa0\x80\"]"),
+    CASE("i_string_incomplete_surrogate_and_escape_valid", "[\"\\uD800\\n\"]"),
+    CASE("i_string_invalid_lonely_surrogate", "[\"\\ud800\"]"),
+    CASE("i_string_invalid_surrogate", "[\"\\ud800abc\"]"),
+    CASE("i_string_invalid_utf-8", "[\"\xff\"]"),
+    CASE("i_string_inverted_surrogates_U+1D11E", "[\"\\uDd1e\\uD834\"]"),
+    CASE("i_string_iso_latin_1", "[\"\xe9\"]"),
+    CASE("i_string_lone_second_surrogate", "[\"\\uDFAA\"]"),
+    CASE("i_string_lone_utf8_continuation_byte", "[\"\x81\"]"),
+    CASE("i_string_not_in_unicode_range", "[\"\xf4\xbf\xbf\xbf\"]"),
+    CASE("i_string_overlong_sequence_2_bytes", "[\"\xc0\xaf\"]"),
+    CASE("i_string_overlong_sequence_6_bytes", "[\"\xfc\x83\xbf\xbf\xbf\xbf\"]"),
+    CASE("i_string_truncated-utf-8", "[\"\xe0\xff\"]"),
+    CASE("i_structure_UTF-8_BOM_empty_object", "\xef\xbb\xbf{}"),
+};
+
+#undef CASE
+
+// Il parser incrementale accetta un documento se produce esattamente un valore senza errori
+bool push_accepts(std::string_view text, bool bytewise) {
+    json_push_parser parser;
+    try {
+        std::size_t values = 0;
+        if (bytewise) {
+            for (char c : text) {
+                values += parser.feed(&c, 1);
+            }
+        } else {
+            values += parser.feed(text.data(), text.size());
+        }
+        values += parser.finish();
+        return values == 1;
+    } catch (json_exception&) {
+        return false;
+    }
+}
+
+void conformance(const std::string& name, std::string_view text) {
+    json doc;
+    bool parsed = static_cast<bool>(json::parse(text, doc));
+    bool valid = static_cast<bool>(json::validate(text));
+    bool pushed = push_accepts(text, false);
+    bool bytewise = push_accepts(text, true);
+    check(pushed == bytewise, name + ": json_push_parser dipende dalla divisione in blocchi");
+    if (name[0] == 'i') {
+        return;
+    }
+    bool expected = name[0] == 'y';
+    check(parsed == expected, name + ": json::parse");
+    check(valid == expected, name + ": json::validate");
+    check(pushed == expected, name + ": json_push_parser");
+}
+
+void test_conformance() {
+    for (const conformance_case& c : cases) {
+        conformance(c.name, c.text);
+    }
+    // Casi generati: annidamento oltre il limite e non chiuso
+    conformance("i_structure_500_nested_arrays", std::string(500, '[') + std::string(500, ']'));
+    conformance("n_structure_100000_opening_arrays", std::string(100000, '['));
+    std::string open;
+    for (int i = 0; i < 50000; ++i) {
+        open += "[{\"\":";
+    }
+    conformance("n_structure_open_array_object", open);
+}
+
+// Nastri alterati: ogni parola di 8 byte sostituita da valori enormi deve dare json_exception, mai letture fuori dal buffer
+void test_tape_corruption() {
+    json doc = json::parse("{\"a\": [1, 2.5, \"abc\"], \"b\": {\"c\": [true, null]}, \"d\": [1, 2, 3]}");
+    std::ostringstream os;
+    doc.to_tape(os);
+    const std::string tape = os.str();
+    const std::uint64_t forged[] = {~std::uint64_t(0), ~std::uint64_t(0) - 7, std::uint64_t(1) << 63,
+                                    std::uint64_t(1) << 60, std::uint64_t(1) << 32};
+    std::size_t rejected = 0;
+    for (std::size_t at = 0; at + 8 <= tape.size(); at += 8) {
+        for (std::uint64_t value : forged) {
+            std::string bytes = tape;
+            std::memcpy(&bytes[at], &value, sizeof(value));
+            try {
+                json_tape t(bytes.data(), bytes.size());
+                json_view root = t.root();
+                root.materialize();
+                root["a"][2].get_string();
+                root["b"]["c"].size();
+            } catch (json_exception&) {
+                ++rejected;
+            }
+        }
+    }
+    check(rejected > 0, "nastro alterato: nessuna corruzione rilevata");
+}
+
+
+// Un figlio che punta all'indietro (un ciclo) o un annidamento troppo profondo non esauriscono lo stack
+void test_tape_cycles() {
+    json doc = json::parse("[[1, \"x\"], {\"k\": [2]}]");
+    std::ostringstream os;
+    doc.to_tape(os);
+    const std::string tape = os.str();
+    std::uint64_t root;
+    std::memcpy(&root, tape.data() + 16, sizeof(root));
+    std::size_t rejected = 0, slots = 0;
+    for (std::size_t at = 32; at + 8 <= tape.size(); at += 8) {
+        std::uint64_t value;
+        std::memcpy(&value, tape.data() + at, sizeof(value));
+        if ((value & 7) != 5 && (value & 7) != 6) {
+            continue;
+        }
+        ++slots;
+        std::string bytes = tape;
+        std::memcpy(&bytes[at], &root, sizeof(root));
+        try {
+            json_tape(bytes.data(), bytes.size()).root().materialize();
+        } catch (json_exception&) {
+            ++rejected;
+        }
+    }
+    check(slots > 0 && rejected == slots, "nastro con un ciclo accettato");
+
+    json deep;
+    deep.set_list();
+    for (int i = 0; i < 2000; ++i) {
+        json outer;
+        outer.set_list();
+        outer.push_back(std::move(deep));
+        deep = std::move(outer);
+    }
+    std::ostringstream deep_os;
+    deep.to_tape(deep_os);
+    const std::string deep_tape = deep_os.str();
+    json_tape t(deep_tape.data(), deep_tape.size());
+    bool thrown = false;
+    try {
+        t.root().materialize();
+    } catch (json_exception&) {
+        thrown = true;
+    }
+    check(thrown, "nastro troppo annidato materializzato");
+    json_view v = t.root();
+    for (int i = 0; i < 2000; ++i) {
+        v = v[0];
+    }
+    check(v.is_list() && v.size() == 0, "nastro annidato: la navigazione diretta deve restare possibile");
+}
+
+
+// operator>> legge un valore alla volta e lascia lo stream subito dopo
+void test_stream_extraction() {
+    std::istringstream ss("{} [1, \"]\", {\"a\": 2}]\n\"x\\\"\" -3.5e2 true null");
+    json a, b, c, d, e, f;
+    ss >> a >> b >> c >> d >> e >> f;
+    check(static_cast<bool>(ss), "operator>>: estrazioni concatenate fallite");
+    check(a == json::parse("{}"), "operator>>: primo valore");
+    check(b == json::parse("[1, \"]\", {\"a\": 2}]"), "operator>>: lista con stringhe e dizionari");
+    check(c == json::parse("\"x\\\"\""), "operator>>: stringa con escape");
+    check(d == json::parse("-350"), "operator>>: numero");
+    check(e == json::parse("true") && f == json::parse("null"), "operator>>: letterali");
+    json end = json::parse("7");
+    ss >> end;
+    check(ss.fail() && ss.eof(), "operator>>: a fine stream deve impostare failbit");
+    check(end == json::parse("7"), "operator>>: a fine stream il valore non cambia");
+    std::istringstream bad("[1, 2} 3");
+    bool thrown = false;
+    try {
+        bad >> a;
+    } catch (json_exception&) {
+        thrown = true;
+    }
+    check(thrown, "operator>>: valore malformato accettato");
+}
+
+
+// Le letture const di una lista compatta non la espandono
+void test_packed_const_reads() {
+    json doc = json::parse("{\"l\": [1, 2, 3, 4], \"b\": [true, false], \"r\": [{\"v\": [5, 6]}, {\"v\": [7]}]}");
+    const json& c = doc;
+    const std::size_t packed = doc.memory_usage().total;
+    double sum = 0;
+    for (auto it = c["l"].begin_list(); it != c["l"].end_list(); ++it) {
+        sum += it->get_number();
+    }
+    check(sum == 10, "lista compatta: iterazione const");
+    auto it = c["l"].begin_list();
+    check(it[2].get_number() == 3 && (it + 3)->get_number() == 4 && c["l"].end_list() - it == 4,
+          "lista compatta: accesso casuale const");
+    auto at = std::lower_bound(c["l"].begin_list(), c["l"].end_list(), 3.0,
+                               [](json_ref a, double v) { return a.get_number() < v; });
+    check(at - c["l"].begin_list() == 2, "lista compatta: lower_bound const");
+    // Ogni dereferenziazione è un valore a sé, non una copia condivisa nell'iteratore
+    json_ref first = it[0];
+    json_ref last = it[3];
+    check(first.get_number() == 1 && last.get_number() == 4 && first != last && *it == first,
+          "lista compatta: elementi letti dallo stesso iteratore");
+    auto by_number = [](json_ref a, json_ref b) { return a.get_number() < b.get_number(); };
+    auto range = std::minmax_element(c["l"].begin_list(), c["l"].end_list(), by_number);
+    check(range.first->get_number() == 1 && range.second->get_number() == 4, "lista compatta: minmax_element const");
+    check(std::count(c["b"].begin_list(), c["b"].end_list(), json_ref(json::parse("true"))) == 1,
+          "lista compatta di booleani: std::count const");
+    check(!(c["b"].begin_list() + 1)->get_bool(), "lista compatta di booleani: iterazione const");
+    check(c.at_pointer("/l/1").get_number() == 2, "lista compatta: at_pointer const");
+    json_path v0("/v/0");
+    json_ref out[2];
+    check(v0.evaluate_all(c["r"], out, 2) == 2 && out[0] && out[1] && out[0]->get_number() == 5 &&
+              out[1]->get_number() == 7,
+          "lista compatta: evaluate_all const");
+    // I risultati non sono copie riusate dalla valutazione successiva
+    json_ref second = c.at_pointer("/l/1");
+    json_ref third = c.at_pointer("/l/2");
+    json_path l0("/l/0");
+    json_ref found = l0.find(c);
+    check(second.get_number() == 2 && third.get_number() == 3 && found.get_number() == 1,
+          "lista compatta: risultati const indipendenti");
+    check(!json_path("/l/9").find(c) && !json_path("/l/0/x").find(c), "lista compatta: percorso assente");
+    json_ref items[2];
+    check(json_path("").evaluate_all(c["l"], items, 2) == 2 && items[0].get_number() == 1 && items[1].get_number() == 2,
+          "lista compatta: evaluate_all su una lista compatta");
+    check(doc.memory_usage().total == packed, "lista compatta espansa da una lettura const");
+    json flat = doc;
+    flat.freeze();
+    const_json_document frozen(doc);
+    check(frozen.root().memory_usage().total == flat.memory_usage().total,
+          "const_json_document espande le liste compatte");
+}
+
+
+// Le modifiche tramite iteratori e riferimenti invalidano l'hash in cache
+void test_hash_after_mutable_access() {
+    auto by_string = [](const json& a, const json& b) { return a.get_string() < b.get_string(); };
+    json doc = json::parse("{\"l\": [\"b\", \"a\", \"c\"], \"d\": {\"x\": [1, 2], \"y\": [3]}}");
+    const json orig = doc;
+    doc.hash();
+    std::sort(doc["l"].begin_list(), doc["l"].end_list(), by_string);
+    json sorted = json::parse("{\"l\": [\"a\", \"b\", \"c\"], \"d\": {\"x\": [1, 2], \"y\": [3]}}");
+    check(doc == sorted && doc.hash() == sorted.hash(), "hash non aggiornato dopo std::sort");
+    check(json::diff(orig, doc).size() > 0, "diff vuoto dopo std::sort");
+
+    std::uint64_t h = doc.hash();
+    std::swap(doc["d"]["x"], doc["d"]["y"]);
+    check(doc.hash() != h, "hash non aggiornato dopo std::swap");
+
+    // Gli elementi spostati dall'ordinamento tornano collegati al contenitore
+    json& list = doc["l"];
+    std::sort(list.begin_list(), list.end_list(), [&](const json& a, const json& b) { return by_string(b, a); });
+    json& first = *list.begin_list();
+    h = doc.hash();
+    first.set_string("z");
+    check(doc.hash() != h, "hash non aggiornato modificando un elemento spostato");
+
+    h = doc.hash();
+    doc.at_pointer("/d/y").begin_list()->set_number(9);
+    check(doc.hash() != h, "hash non aggiornato dopo at_pointer");
+}
+
+
+std::string source_text(const json_source_document& src) {
+    std::ostringstream os;
+    src.write(os);
+    return os.str();
+}
+
+std::string legacy_text(const json& doc) {
+    std::ostringstream os;
+    os << doc;
+    return os.str();
+}
+
+// json_source_document::write non copia il testo di origine dei valori modificati sul posto
+void test_source_after_mutable_access() {
+    json_source_document src("{\"a\": \"x\", \"b\": \"y\", \"l\": [3, 1, 2], \"o\": [{\"k\": 1}, {\"k\": 2}]}");
+    std::swap(src.root()["a"], src.root()["b"]);
+    check(json::parse(source_text(src)) == src.root(), "write dopo std::swap tramite operator[]");
+
+    json& list = src.root()["l"];
+    std::sort(list.begin_list(), list.end_list(),
+              [](const json& a, const json& b) { return a.get_number() < b.get_number(); });
+    check(json::parse(source_text(src)) == src.root(), "write dopo std::sort tramite iteratori");
+
+    auto it = src.root()["o"].begin_list();
+    std::swap(it[0], it[1]);
+    (*it)["k"].get_number() = 5;
+    check(json::parse(source_text(src)) == src.root(), "write dopo modifiche tramite iteratori");
+    check(source_text(src) == legacy_text(src.root()), "write diverso da operator<< dopo le modifiche");
+}
+
+
+// apply_patch che fallisce lascia il documento com'era
+bool patch_fails(json& doc, const char* patch) {
+    try {
+        doc.apply_patch(json::parse(patch));
+    } catch (json_exception&) {
+        return true;
+    }
+    return false;
+}
+
+void test_patch_rollback() {
+    json doc = json::parse("{\"a\": 1, \"l\": [{\"k\": true}, 2]}");
+    const json orig = doc;
+    check(patch_fails(doc, "[{\"op\": \"move\", \"from\": \"/a\", \"path\": \"/x/y\"}]") && doc == orig,
+          "move verso un percorso assente non annullato");
+    check(patch_fails(doc, "[{\"op\": \"move\", \"from\": \"/l/0\", \"path\": \"/l/5\"}]") && doc == orig,
+          "move verso un indice fuori dalla lista non annullato");
+    check(patch_fails(doc, "[{\"op\": \"move\", \"from\": \"/a\", \"path\": \"/b\"}, "
+                           "{\"op\": \"test\", \"path\": \"/b\", \"value\": 2}]") && doc == orig,
+          "move seguito da un test fallito non annullato");
+    check(patch_fails(doc, "[{\"op\": \"copy\", \"from\": \"/l/0\", \"path\": \"/x/y\"}]") && doc == orig,
+          "copy verso un percorso assente non annullato");
+    check(patch_fails(doc, "[{\"op\": \"copy\", \"from\": \"/a\", \"path\": \"/l/0\"}, "
+                           "{\"op\": \"copy\", \"from\": \"/nope\", \"path\": \"/c\"}]") && doc == orig,
+          "copy da un percorso assente non annullato");
+
+    // Sostituire l'intero sottodocumento aggiorna il documento che lo contiene
+    json outer = json::parse("{\"x\": {\"y\": 1}}");
+    json& inner = outer["x"];
+    std::uint64_t h = outer.hash();
+    inner.apply_patch(json::parse("[{\"op\": \"replace\", \"path\": \"\", \"value\": 5}]"));
+    check(outer == json::parse("{\"x\": 5}") && outer.hash() != h, "replace dell'intero sottodocumento");
+    h = outer.hash();
+    inner.apply_patch(json::parse("[{\"op\": \"test\", \"path\": \"\", \"value\": 5}, "
+                                  "{\"op\": \"replace\", \"path\": \"\", \"value\": [1]}]"));
+    check(outer.hash() != h, "replace dell'intero sottodocumento scollega il valore dal contenitore");
+}
+
+
+// Gli iteratori di dizionario sono utilizzabili fuori da json.cpp, anche su const_json_document
+void test_dictionary_iteration() {
+    json doc = json::parse("{\"b\": 2, \"a\": 1, \"c\": {\"x\": true}}");
+    std::string keys;
+    for (auto it = doc.begin_dictionary(); it != doc.end_dictionary(); ++it) {
+        keys += it->first;
+    }
+    check(keys == "bac", "iterazione di un dizionario in ordine di inserimento");
+    for (auto it = doc.begin_dictionary(); it != doc.end_dictionary(); ++it) {
+        if (it->second.is_number()) {
+            it->second.set_number(it->second.get_number() * 10);
+        }
+    }
+    check(doc["a"].get_number() == 10 && doc["b"].get_number() == 20, "modifica tramite dictionary_iterator");
+
+    const_json_document frozen(doc);
+    keys.clear();
+    double sum = 0;
+    for (auto it = frozen.begin_dictionary(); it != frozen.end_dictionary(); ++it) {
+        keys += it->first;
+        sum += it->second.is_number() ? it->second.get_number() : 0;
+    }
+    check(keys == "bac" && sum == 30, "iterazione di const_json_document");
+    auto last = frozen.end_dictionary();
+    --last;
+    check(last->first == "c" && (--last)->first == "a", "dictionary_iterator bidirezionale");
+    check(std::distance(frozen.begin_dictionary(), frozen.end_dictionary()) == 3, "std::distance su un dizionario");
+}
+
+
+// I nodi scalari non pagano lo spazio dei contenitori; freeze() ricompatta le liste espanse
+void test_node_size() {
+    std::string text = "[";
+    for (int i = 0; i < 1000; ++i) {
+        text += (i ? ", \"" : "\"") + std::to_string(i) + "\"";
+    }
+    json strings = json::parse(text + "]");
+    json_memory_usage usage = strings.memory_usage();
+    check(usage.overhead / usage.strings <= 128, "nodo scalare troppo grande");
+
+    json numbers = json::parse("[1, 2, 3, 4, 5, 6, 7, 8]");
+    const std::size_t packed = numbers.memory_usage().total;
+    numbers.begin_list()->set_number(0);
+    const std::size_t expanded = numbers.memory_usage().total;
+    numbers.freeze();
+    check(expanded > packed && numbers.memory_usage().total < expanded, "freeze() non ricompatta la lista");
+    check(numbers == json::parse("[0, 2, 3, 4, 5, 6, 7, 8]"), "lista ricompattata con valori diversi");
+    json bools = json::parse("[true, false]");
+    *bools.begin_list() = json::parse("false");
+    bools.freeze();
+    check(bools == json::parse("[false, false]") && bools.memory_usage().bools == 2, "lista di booleani ricompattata");
+}
+
+
+// Le chiavi ripetute lasciano una sola coppia: posizione della prima, valore dell'ultima
+void test_duplicate_keys() {
+    const std::string text = "{\"a\": 1, \"b\": {\"c\": true, \"c\": false}, \"a\": [2]}";
+    const json expected = json::parse("{\"a\": [2], \"b\": {\"c\": false}}");
+    json doc = json::parse(text);
+    check(doc == expected && doc.size() == 2 && doc.begin_dictionary()->first == "a", "parse: chiavi ripetute");
+
+    std::istringstream in(text);
+    json streamed;
+    in >> streamed;
+    check(streamed == expected, "operator>>: chiavi ripetute");
+
+    json deduplicated;
+    check(json::parse_deduplicated(text, deduplicated) && deduplicated == expected, "parse_deduplicated: chiavi ripetute");
+
+    json_push_parser push;
+    push.feed(text);
+    push.finish();
+    check(push.has_value() && push.next() == expected, "json_push_parser: chiavi ripetute");
+
+    json_projection projection;
+    projection.add("/a");
+    projection.add("/b/c");
+    json projected;
+    projection.parse(text, projected);
+    check(projected == expected, "json_projection: chiavi ripetute");
+
+    std::istringstream cbor(std::string("\xA2\x61\x61\x01\x61\x61\x02", 7));
+    json decoded;
+    decoded.from_cbor(cbor);
+    check(decoded == json::parse("{\"a\": 2}"), "from_cbor: chiavi ripetute");
+
+    std::string wide = "{";
+    for (int i = 0; i < 100; ++i) {
+        wide += "\"k" + std::to_string(i % 40) + "\": " + std::to_string(i) + ", ";
+    }
+    json many = json::parse(wide + "\"z\": 0}");
+    check(many.size() == 41 && many["k5"].get_number() == 85 && many.begin_dictionary()->first == "k0",
+          "parse: molte chiavi ripetute");
+}
+
+
+/*
+ * Documento casuale con chiavi ripetute (inserite con insert()). Con lo
+ * stesso shape la struttura è la stessa; noise cambia qualche numero e
+ * qualche chiave.
+ */
+json random_value(std::mt19937& shape, std::mt19937* noise, int depth) {
+    json value;
+    switch (shape() % (depth > 0 ? 6 : 3)) {
+        case 0:
+            value.set_number(static_cast<double>(shape() % 4 + (noise && (*noise)() % 4 == 0 ? 10 : 0)));
+            break;
+        case 1:
+            value.set_string(std::string(1, static_cast<char>('a' + shape() % 3)));
+            break;
+        case 2:
+            value.set_bool(shape() % 2 == 0);
+            break;
+        case 3:
+        case 4:
+            value.set_list();
+            for (std::size_t n = shape() % 4; n > 0; --n) {
+                value.push_back(random_value(shape, noise, depth - 1));
+            }
+            break;
+        default:
+            value.set_dictionary();
+            for (std::size_t n = shape() % 4; n > 0; --n) {
+                std::string key(1, static_cast<char>('k' + shape() % 3));
+                if (noise && (*noise)() % 8 == 0) {
+                    key = "z";
+                }
+                value.insert(std::make_pair(key, random_value(shape, noise, depth - 1)));
+            }
+            break;
+    }
+    return value;
+}
+
+// from.apply_patch(diff(from, to)) == to anche con chiavi ripetute
+void test_diff_round_trip() {
+    json from = json::parse("{\"a\": 1, \"b\": 2}");
+    from.insert(std::make_pair(std::string("a"), json::parse("2")));
+    json to = json::parse("{\"a\": 1, \"b\": 2}");
+    to.insert(std::make_pair(std::string("a"), json::parse("3")));
+    json patched = from;
+    patched.apply_patch(json::diff(from, to));
+    check(patched == to, "diff: chiave ripetuta");
+
+    std::mt19937 noise(46);
+    std::size_t failed = 0;
+    for (unsigned seed = 0; seed < 2000; ++seed) {
+        std::mt19937 a(seed), b(seed);
+        json x = random_value(a, nullptr, 3);
+        json y = random_value(b, &noise, 3);
+        if (seed % 3 == 0) {
+            x.freeze();
+        }
+        json result = x;
+        json back = y;
+        try {
+            result.apply_patch(json::diff(x, y));
+            back.apply_patch(json::diff(y, x));
+        } catch (json_exception&) {
+            ++failed;
+        }
+        failed += !(result == y) + !(back == x);
+    }
+    check(failed == 0, "diff: round trip casuale");
+}
+
+
+// La scrittura parallela produce gli stessi byte di quella su un solo thread
+void test_parallel_write() {
+    std::string text = "{\"meta\": {\"name\": \"catalogo\", \"tags\": [\"b\", \"a\"]}, \"records\": [";
+    for (int i = 0; i < 60000; ++i) {
+        if (i) {
+            text += ", ";
+        }
+        std::string n = std::to_string(i);
+        text += "{\"z\": " + n + ", \"id\": \"r" + n + "\", \"\u00e8\": " + std::to_string(i * 0.25) +
+                ", \"ok\": " + (i % 3 ? "true" : "false") + ", \"v\": [" + n + ", 1e21, -0.5], \"f\": [true, false]" +
+                ", \"sub\": {\"b\": null, \"a\": \"\\ud83d\\ude00" + n + "\"}}";
+    }
+    text += "], \"big\": {\"items\": [";
+    for (int i = 0; i < 20000; ++i) {
+        text += (i ? ", \"" : "\"") + std::string(40, 'a' + i % 26) + "\"";
+    }
+    text += "]}}";
+    json doc = json::parse(text);
+    json_write_options variants[6];
+    variants[1].indent = 2;
+    variants[2].sort_keys = true;
+    variants[3].indent = 4;
+    variants[3].sort_keys = true;
+    variants[4].canonical = true;
+    variants[5].ascii = true;
+    for (int frozen = 0; frozen < 2; ++frozen) {
+        if (frozen) {
+            doc.freeze();
+        }
+        for (json_write_options options : variants) {
+            options.threads = 1;
+            const std::string serial = doc.to_string(options);
+            options.threads = 4;
+            check(doc.to_string(options) == serial, "scrittura parallela: uscita diversa da quella seriale");
+        }
+    }
+}
+
+
+// Forma canonica RFC 8785 (JCS): esempi della sezione 3.2 e numeri dell'appendice B
+void test_canonical_output() {
+    json_write_options jcs;
+    jcs.canonical = true;
+    jcs.indent = 2;
+    jcs.ascii = true;
+    json doc = json::parse(
+        "{\n  \"numbers\": [333333333.33333329, 1E30, 4.50, 2e-3, 0.000000000000000000000000001],\n"
+        "  \"string\": \"\\u20ac$\\u000F\\u000aA'\\u0042\\u0022\\u005c\\\\\\\"\\/\",\n"
+        "  \"literals\": [null, true, false]\n}");
+    check(doc.to_string(jcs) == "{\"literals\":[null,true,false],\"numbers\":[333333333.3333333,1e+30,4.5,0.002,1e-27],"
+                                "\"string\":\"\xE2\x82\xAC$\\u000f\\nA'B\\\"\\\\\\\\\\\"/\"}",
+          "JCS: esempio della sezione 3.2.3");
+
+    // Ordine per unità UTF-16: U+1F600 (surrogati D83D DE00) precede U+FB33
+    json keys = json::parse("{\"\\u20ac\": 1, \"\\r\": 2, \"\\ufb33\": 3, \"1\": 4, \"\\ud83d\\ude00\": 5, "
+                            "\"\\u0080\": 6, \"\\u00f6\": 7}");
+    check(keys.to_string(jcs) == "{\"\\r\":2,\"1\":4,\"\xC2\x80\":6,\"\xC3\xB6\":7,\"\xE2\x82\xAC\":1,"
+                                 "\"\xF0\x9F\x98\x80\":5,\"\xEF\xAC\xB3\":3}",
+          "JCS: ordine delle chiavi per unità UTF-16");
+    keys.freeze();
+    check(keys.to_string(jcs) == "{\"\\r\":2,\"1\":4,\"\xC2\x80\":6,\"\xC3\xB6\":7,\"\xE2\x82\xAC\":1,"
+                                 "\"\xF0\x9F\x98\x80\":5,\"\xEF\xAC\xB3\":3}",
+          "JCS: ordine delle chiavi di un dizionario compattato");
+
+    const std::pair<const char*, const char*> numbers[] = {
+        {"0", "0"}, {"-0", "0"}, {"5e-324", "5e-324"}, {"-1.7976931348623157e308", "-1.7976931348623157e+308"},
+        {"9007199254740992", "9007199254740992"}, {"295147905179352830000", "295147905179352830000"},
+        {"1e21", "1e+21"}, {"1e20", "100000000000000000000"}, {"1e23", "1e+23"}, {"0.000001", "0.000001"},
+        {"1e-7", "1e-7"}, {"1.5e-7", "1.5e-7"}, {"123456789012345680000", "123456789012345680000"},
+        {"1.2345678901234568e21", "1.2345678901234568e+21"}, {"-0.5", "-0.5"}, {"100", "100"},
+    };
+    for (const auto& n : numbers) {
+        check(json::parse(n.first).to_string(jcs) == n.second, "JCS: forma dei numeri");
+    }
+
+    bool thrown = false;
+    json nan;
+    nan.set_number(std::numeric_limits<double>::quiet_NaN());
+    try {
+        nan.to_string(jcs);
+    } catch (json_exception&) {
+        thrown = true;
+    }
+    check(thrown, "JCS: NaN accettato");
+}
+
+
+// from_cbor su input ostile: lancia json_exception senza allocare in base
+// alle lunghezze dichiarate, senza esaurire lo stack e lasciando intatto il json
+void test_cbor_hardening() {
+    json doc = json::parse("{\"a\": [1, -2, 2.5, \"x\\u00e8\"], \"b\": {\"c\": [true, false, null]}, "
+                           "\"d\": [1.5, 2.5, 3.5, 4.5, 5.5, 6.5, 7.5, 8.5, 9.5]}");
+    std::ostringstream os;
+    doc.to_cbor(os);
+    const std::string encoded = os.str();
+    json back;
+    std::istringstream in(encoded);
+    back.from_cbor(in);
+    check(back == doc, "CBOR: round trip");
+
+    auto rejected = [](const std::string& bytes) {
+        json target = json::parse("[\"intatto\"]");
+        std::istringstream is(bytes);
+        try {
+            target.from_cbor(is);
+        } catch (json_exception&) {
+            return target == json::parse("[\"intatto\"]");
+        }
+        return false;
+    };
+    std::size_t accepted = 0;
+    for (std::size_t n = 0; n < encoded.size(); ++n) {
+        accepted += !rejected(encoded.substr(0, n));
+    }
+    check(accepted == 0, "CBOR: input troncato accettato");
+
+    const std::string huge = "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xF8";
+    check(rejected("\x9B" + huge), "CBOR: lista con lunghezza enorme");
+    check(rejected("\xBB" + huge), "CBOR: dizionario con lunghezza enorme");
+    check(rejected("\x7B" + huge + "abc"), "CBOR: stringa con lunghezza enorme");
+    check(rejected(std::string("\xA1\x7B", 2) + huge), "CBOR: chiave con lunghezza enorme");
+    check(rejected("\xD8\x56\x5B" + huge), "CBOR: typed array con lunghezza enorme");
+    check(rejected(std::string("\xD8\x56\x43\x00\x00\x00", 6)), "CBOR: typed array con lunghezza non multipla di 8");
+
+    check(rejected(std::string(100000, '\x81')), "CBOR: liste annidate senza limite");
+    check(rejected(std::string(100000, '\xC1')), "CBOR: tag annidati senza limite");
+    std::string nested;
+    for (int i = 0; i < 100000; ++i) {
+        nested += "\xA1\x61k";
+    }
+    check(rejected(nested), "CBOR: dizionari annidati senza limite");
+    std::string deep(500, '\x81');
+    deep += '\x01';
+    std::istringstream deep_in(deep);
+    back.from_cbor(deep_in);
+    check(back == json::parse(std::string(500, '[') + "1" + std::string(500, ']')),
+          "CBOR: annidamento entro il limite rifiutato");
+
+    check(rejected(std::string("\xA1\x01\x01", 3)), "CBOR: chiave numerica accettata");
+    check(rejected(std::string("\xA1\x41k\x01", 4)), "CBOR: chiave byte string accettata");
+    check(rejected(std::string("\xA1\xA0\x01", 3)), "CBOR: chiave dizionario accettata");
+    check(rejected(std::string("\x42\x00\x00", 3)), "CBOR: byte string accettata");
+    check(rejected(std::string("\x9F\x01\xFF", 3)), "CBOR: lunghezza indefinita accettata");
+    check(rejected(std::string("\x1C", 1)), "CBOR: codifica riservata accettata");
+    check(rejected(std::string("\xF8\x20", 2)), "CBOR: valore semplice accettato");
+}
+
+}
+
+int main() {
+    test_conformance();
+    test_tape_corruption();
+    test_tape_cycles();
+    test_stream_extraction();
+    test_packed_const_reads();
+    test_hash_after_mutable_access();
+    test_source_after_mutable_access();
+    test_patch_rollback();
+    test_dictionary_iteration();
+    test_node_size();
+    test_duplicate_keys();
+    test_diff_round_trip();
+    test_parallel_write();
+    test_canonical_output();
+    test_cbor_hardening();
+    if (failures) {
+        std::fprintf(stderr, "%zu controlli falliti\n", failures);
+        return 1;
+    }
+    std::fprintf(stderr, "tutti i test superati\n");
+    return 0;
+}